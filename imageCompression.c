@@ -1,76 +1,380 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include "lzw.h"
+#include "lzw_io.h"
+#include "lzw_container.h"
+#include "lzw_report.h"
 
-long get_file_size(const char *filename);
-void compress_file(const char *input_file, const char *output_file);
+// Highest -l level, see the usage text
+#define MAX_LEVEL 2
 
-int main(int argc, char *argv[]) {
+int compress_file(const char *input_file, const char *output_file, const LzwParams *params, LzwTotals *totals);
 
-    // Check if the user has provided the file file
-    if (argc != 3) {
-        printf("Usage: %s <file file>\n", argv[0]);
-        return 1;
+// Parse a filter list such as "delta+planes" into LZW_FILTER_* bits, -1 if
+// it names an unknown step or two predictions
+static int parse_filter(const char *list) {
+    int filter = LZW_FILTER_NONE;
+    while (*list != '\0') {
+        size_t n = strcspn(list, "+");
+        if (n == 4 && strncmp(list, "none", n) == 0) {
+            // no step, e.g. to override a default
+        } else if (n == 5 && strncmp(list, "delta", n) == 0) {
+            filter |= LZW_FILTER_DELTA;
+        } else if (n == 2 && strncmp(list, "up", n) == 0) {
+            filter |= LZW_FILTER_UP;
+        } else if (n == 6 && strncmp(list, "planes", n) == 0) {
+            filter |= LZW_FILTER_PLANES;
+        } else {
+            return -1;
+        }
+        list += list[n] == '+' ? n + 1 : n;
     }
+    if ((filter & LZW_FILTER_DELTA) && (filter & LZW_FILTER_UP)) {
+        return -1;
+    }
+    return filter;
+}
 
-    const char *input_file = argv[1];
-    const char *output_file = argv[2];
+// Parse a --growth rule into LZW_GROWTH_*, -2 if it is unknown
+static int parse_growth(const char *rule) {
+    static const char *const names[] = {"lzw", "lzmw", "lzap"};
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(rule, names[i]) == 0) {
+            return i;
+        }
+    }
+    return strcmp(rule, "auto") == 0 ? LZW_GROWTH_AUTO : -2;
+}
 
-    long original_size = get_file_size(input_file);
+// Paths named by a batch argument, each malloc'd
+typedef struct {
+    char **paths;
+    size_t count;
+    size_t capacity;
+} PathList;
 
-    if (original_size == -1) {
-        fprintf(stderr, "Error: Cannot get the size of the file\n");
-        return 1;
+// Append dir/name, or name alone for a NULL dir, with suffix added
+static int add_path(PathList *list, const char *dir, const char *name, size_t name_len, const char *suffix) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity > 0 ? 2 * list->capacity : 64;
+        char **paths = realloc(list->paths, capacity * sizeof(char *));
+        if (paths == NULL) {
+            return -1;
+        }
+        list->paths = paths;
+        list->capacity = capacity;
+    }
+    size_t dir_len = dir != NULL ? strlen(dir) + 1 : 0;
+    size_t suffix_len = strlen(suffix);
+    char *path = malloc(dir_len + name_len + suffix_len + 1);
+    if (path == NULL) {
+        return -1;
+    }
+    if (dir != NULL) {
+        memcpy(path, dir, dir_len - 1);
+        path[dir_len - 1] = '/';
+    }
+    memcpy(path + dir_len, name, name_len);
+    memcpy(path + dir_len + name_len, suffix, suffix_len + 1);
+    list->paths[list->count++] = path;
+    return 0;
+}
+
+static int by_name(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// The regular files in a directory, by name, or the lines of a list file,
+// skipping blank ones. Returns -1 if it cannot be read.
+static int list_inputs(const char *source, PathList *list) {
+    memset(list, 0, sizeof(*list));
+    struct stat info;
+    if (stat(source, &info) != 0) {
+        return -1;
+    }
+    if (S_ISDIR(info.st_mode)) {
+        DIR *dir = opendir(source);
+        if (dir == NULL) {
+            return -1;
+        }
+        struct dirent *entry;
+        int status = 0;
+        while (status == 0 && (entry = readdir(dir)) != NULL) {
+            size_t mark = list->count;
+            status = add_path(list, source, entry->d_name, strlen(entry->d_name), "");
+            if (status == 0 && (stat(list->paths[mark], &info) != 0 || !S_ISREG(info.st_mode))) {
+                free(list->paths[--list->count]);
+            }
+        }
+        closedir(dir);
+        qsort(list->paths, list->count, sizeof(char *), by_name);
+        return status;
     }
 
-    printf("Original file size: %ld bytes\n", original_size);
+    FILE *file = fopen(source, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    char line[4096];
+    int status = 0;
+    while (status == 0 && fgets(line, sizeof(line), file) != NULL) {
+        size_t len = strcspn(line, "\r\n");
+        if (len > 0) {
+            status = add_path(list, NULL, line, len, "");
+        }
+    }
+    if (ferror(file)) {
+        status = -1;
+    }
+    fclose(file);
+    return status;
+}
+
+static void free_inputs(PathList *list) {
+    for (size_t i = 0; i < list->count; i++) {
+        free(list->paths[i]);
+    }
+    free(list->paths);
+}
 
-    // Compress the file
-    compress_file(input_file, output_file);
+static double wall_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
 
-    long compressed_size = get_file_size(output_file);
-    if (compressed_size == -1) {
-        fprintf(stderr, "Error: Cannot get the size of the compressed file\n");
+// Compress every file a directory or list names, each to <output>/<name>.lzw
+// or all into the archive, and report the throughput of the whole batch
+static int compress_batch(const char *source, const char *output, int archive, const LzwParams *params,
+                          const LzwReportOptions *report_options) {
+    PathList inputs;
+    if (list_inputs(source, &inputs) != 0) {
+        fprintf(stderr, "Error: Cannot read the file list %s.\n", source);
+        free_inputs(&inputs);
+        return 1;
+    }
+    LzwBatchFile *files = calloc(inputs.count > 0 ? inputs.count : 1, sizeof(LzwBatchFile));
+    PathList outputs;
+    memset(&outputs, 0, sizeof(outputs));
+    int status = files != NULL ? 0 : -1;
+    for (size_t i = 0; status == 0 && i < inputs.count; i++) {
+        files[i].input_file = inputs.paths[i];
+        if (!archive) {
+            const char *name = strrchr(inputs.paths[i], '/');
+            name = name != NULL ? name + 1 : inputs.paths[i];
+            status = add_path(&outputs, output, name, strlen(name), ".lzw");
+            if (status == 0) {
+                files[i].output_file = outputs.paths[i];
+            }
+        }
+    }
+    if (status != 0) {
+        fprintf(stderr, "Error: %s\n", lzw_strerror(LZW_ERR_MEMORY));
+        free(files);
+        free_inputs(&inputs);
+        free_inputs(&outputs);
         return 1;
     }
 
-    printf("Compressed file size: %ld bytes\n", compressed_size);
+    double start = wall_clock();
+    LzwTotals totals;
+    int result = lzw_compress_batch(files, inputs.count, archive ? output : NULL, params, &totals);
+    double seconds = wall_clock() - start;
 
-    printf("Compression ratio: %.2f%%\n", (1 - (double)compressed_size / original_size) * 100);
+    size_t failed = 0;
+    for (size_t i = 0; i < inputs.count; i++) {
+        if (files[i].status != LZW_OK) {
+            fprintf(stderr, "Error: %s: %s\n", files[i].input_file, files[i].totals.message);
+            failed++;
+        }
+    }
+    if (result != LZW_OK && failed == 0) {
+        fprintf(stderr, "Error: %s\n", totals.message);
+    }
+    if (result == LZW_ERR_PARAM) {
+        // Refused before any file started, there is nothing to report
+        free(files);
+        free_inputs(&inputs);
+        free_inputs(&outputs);
+        return 1;
+    }
 
-    return 0;
+    FILE *report = lzw_message_stream(archive ? output : "");
+    if (!report_options->json) {
+        fprintf(report, "Batch complete: %zu files, %zu failed, in %.3f s (%.1f MB/s)\n", inputs.count, failed,
+                seconds, seconds > 0 ? (double)totals.input_bytes / seconds / 1e6 : 0);
+    }
+    lzw_report(report, "batch", totals.input_bytes, totals.output_bytes, &totals, report_options);
+
+    free(files);
+    free_inputs(&inputs);
+    free_inputs(&outputs);
+    return result == LZW_OK ? 0 : 1;
 }
 
-long get_file_size(const char *filename) {
-// Open file in binary mode
-    FILE *file = fopen(filename, "rb");
-    if (file == NULL) {
-        printf("Error: Cannot open file %s\n", filename);
+int main(int argc, char *argv[]) {
+    LzwParams params;
+    lzw_params_init(&params);
+    int have_bits = 0, have_growth = 0;
+    int level = 0;
+    LzwReportOptions report_options = {0, 0};
+    const char *dictionary_file = NULL;
+    int batch = 0, archive = 0, append = 0;
+
+    // Parse options
+    int arg = 1;
+    while (arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0') {
+        if (strcmp(argv[arg], "-d") == 0 && arg + 1 < argc) {
+            params.max_code_bits = atoi(argv[arg + 1]);
+            have_bits = 1;
+            arg += 2;
+        } else if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc) {
+            params.io_buffer_size = (size_t)atoi(argv[arg + 1]) << 20;
+            arg += 2;
+        } else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+            params.block_size = (size_t)atoi(argv[arg + 1]) << 10;
+            arg += 2;
+        } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            params.threads = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--bin") == 0) {
+            params.bin_layout = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--symbol-bits") == 0 && arg + 1 < argc) {
+            params.symbol_bits = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--filter") == 0 && arg + 1 < argc) {
+            params.filter = parse_filter(argv[arg + 1]);
+            if (params.filter < 0) {
+                fprintf(stderr, "Invalid filter: %s\n", argv[arg + 1]);
+                return 1;
+            }
+            arg += 2;
+        } else if (strcmp(argv[arg], "--growth") == 0 && arg + 1 < argc) {
+            params.growth = parse_growth(argv[arg + 1]);
+            if (params.growth == -2) {
+                fprintf(stderr, "Invalid growth rule: %s\n", argv[arg + 1]);
+                return 1;
+            }
+            have_growth = 1;
+            arg += 2;
+        } else if (strcmp(argv[arg], "-l") == 0 && arg + 1 < argc) {
+            level = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-D") == 0 && arg + 1 < argc) {
+            dictionary_file = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "--no-mmap") == 0) {
+            params.use_mmap = 0;
+            arg++;
+        } else if (strcmp(argv[arg], "--stats") == 0) {
+            report_options.stats = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--json") == 0) {
+            report_options.json = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--batch") == 0) {
+            batch = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--archive") == 0) {
+            archive = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--append") == 0) {
+            append = 1;
+            arg++;
+        } else {
+            break;
+        }
+    }
+
+    // Check if the user has provided the input and output files
+    if (argc - arg != 2 || (archive && !batch) || (append && batch) || level < 0 || level > MAX_LEVEL) {
+        printf("Usage: %s [-l level] [-d dict_bits] [-b buffer_mib] [-s block_kib] [-j threads] [--bin] [--filter list] [--symbol-bits 8|16] [--growth rule] [-D dict_file] [--no-mmap] [--stats] [--json] <input_file> <output_file>\n", argv[0]);
+        printf("       %s [options] --batch [--archive] <input_dir|list_file> <output_dir|archive_file>\n", argv[0]);
+        printf("       %s [options] --append <input_file> <compressed_file>\n", argv[0]);
+        printf("  Either file may be - for stdin or stdout.\n");
+        printf("  -l level       trade speed for size: 0 packs codes as they are, 1 also\n");
+        printf("                 Huffman-codes them, 2 also picks --growth per block, unless\n");
+        printf("                 given (default 0)\n");
+        printf("  -d dict_bits   dictionary holds up to 2^dict_bits codes (%d-%d, default %d)\n",
+               LZW_MIN_CODE_BITS, LZW_MAX_CODE_BITS, LZW_DEFAULT_CODE_BITS);
+        printf("  -b buffer_mib  I/O buffer size in MiB (default %d)\n", LZW_IO_BUFFER_SIZE >> 20);
+        printf("  -s block_kib   uncompressed KiB per independent block (default %d)\n", LZW_DEFAULT_BLOCK_SIZE >> 10);
+        printf("  -j threads     compress blocks on this many threads, 0 for all processors (default 1)\n");
+        printf("  --bin          input is an npz_to_bin.py file, compress each array on its own\n");
+        printf("  --filter list  with --bin, pre-filter integer arrays with '+'-separated steps:\n");
+        printf("                 delta (previous element), up (row above), planes (byte planes)\n");
+        printf("  --symbol-bits n\n");
+        printf("                 16 codes u16 elements as single symbols, with --bin only in\n");
+        printf("                 uint16 arrays (default 8, and -d defaults to %d with 16)\n", LZW_DEFAULT_CODE_BITS_16);
+        printf("  --growth rule  how each block's dictionary learns phrases: lzw (one symbol at\n");
+        printf("                 a time), lzmw (whole phrases), lzap (every prefix of them), or\n");
+        printf("                 auto to try each on a sample of every block (default lzw)\n");
+        printf("  -D dict_file   prime every block with a dictionary from lzwTrain, which\n");
+        printf("                 decompressing then needs too\n");
+        printf("  --no-mmap      read regular files through the buffer instead of mapping them\n");
+        printf("  --stats        also report dictionary, phrase and timing counters\n");
+        printf("  --json         report sizes and counters as one JSON object\n");
+        printf("  --batch        compress every file in a directory, or listed one per line, to\n");
+        printf("                 output_dir/<name>.lzw, sharing the -j threads between them\n");
+        printf("  --archive      with --batch, write one archive instead, a container per file\n");
+        printf("                 and a table of their names that lzwDecompression --list and\n");
+        printf("                 --member read\n");
+        printf("  --append       add input_file to the end of an existing compressed file, which\n");
+        printf("                 keeps its own -d and -s and needs the same -D it was made with\n");
         return 1;
     }
 
-    // Move to the end of the file
-    if (fseek(file, 0, SEEK_END) != 0) {
-        perror("Error: Cannot seek to the end of file\n");
-        fclose(file);
+    if (params.symbol_bits == 16 && !have_bits) {
+        params.max_code_bits = LZW_DEFAULT_CODE_BITS_16;
+    }
+    if (level >= 1) {
+        params.entropy = LZW_ENTROPY_HUFFMAN;
+    }
+    if (level >= 2 && !have_growth) {
+        params.growth = LZW_GROWTH_AUTO;
+    }
+
+    LzwDictionary *dictionary = NULL;
+    if (dictionary_file != NULL && (dictionary = lzw_report_load_dictionary(dictionary_file)) == NULL) {
         return 1;
     }
+    params.dictionary = dictionary;
 
-    // Get the size of the file
-    long size = ftell(file);
+    if (batch) {
+        int result = compress_batch(argv[arg], argv[arg + 1], archive, &params, &report_options);
+        lzw_dictionary_free(dictionary);
+        return result;
+    }
+
+    const char *input_file = argv[arg];
+    const char *output_file = argv[arg + 1];
 
-    if (size == -1) {
-        perror("Error getting file size");
-        fclose(file);
+    // Compress the file, counting bytes as they pass so pipes work too
+    LzwTotals totals;
+    int status = append ? lzw_compress_append(input_file, output_file, &params, &totals)
+                        : compress_file(input_file, output_file, &params, &totals);
+    lzw_dictionary_free(dictionary);
+    if (status != LZW_OK) {
+        fprintf(stderr, "Error: %s\n", totals.message);
         return 1;
     }
 
-    fclose(file);
+    FILE *report = lzw_message_stream(output_file);
+    if (!report_options.json) {
+        fprintf(report, append ? "Append complete.\n" : "Compression complete.\n");
+    }
+    lzw_report(report, append ? "append" : "compress", totals.input_bytes, totals.output_bytes, &totals, &report_options);
 
-    return size;
+    return 0;
 }
 
-void compress_file(const char *input_file, const char *output_file) {
+int compress_file(const char *input_file, const char *output_file, const LzwParams *params, LzwTotals *totals) {
     // Call LZW compression
-    lzw_compress(input_file, output_file);
-}
\ No newline at end of file
+    return lzw_compress(input_file, output_file, params, totals);
+}
@@ -1,108 +1,1387 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
 #include "lzw.h"
+#include "lzw_io.h"
+#include "lzw_bitio.h"
+#include "lzw_checksum.h"
+#include "lzw_container.h"
+#include "lzw_pool.h"
+#include "lzw_binfile.h"
+#include "lzw_arena.h"
+#include "lzw_stats.h"
+#include "lzw_pipe.h"
+#include "lzw_dict.h"
+#include "lzw_huffman.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Once the dictionary is full, the ratio is sampled over windows of this
+// many input bytes. A window more than 1/RESET_TOLERANCE worse than the best
+// one since the table filled triggers a CLEAR.
+#define RESET_WINDOW (64 * 1024)
+#define RESET_TOLERANCE 16
+
+// Dictionary state reused from one block to the next. The hash table is an
+// array of cache-line buckets with twice as many slots as the dictionary has
+// codes. It is carved from the worker's arena for whichever symbol width the
+// block uses, so switching widths reuses the same memory.
+typedef struct {
+    int max_bits;
+    LzwArena arena;
+    int symbol_bits;            // width the table is laid out for, 0 for none
+    struct DictBucket8 *dictionary8;
+    struct DictBucket16 *dictionary16;
+    uint32_t *node_codes;       // LZMW trie nodes to codes, carved once needed
+    LzwWriter trial;            // sample output while choosing the growth rule
+    LzwWriter codes;            // LzwBitItems of a block bound for the entropy stage
+    LzwWriter *record;          // &codes while coding such a block, else NULL
+} BlockEncoder;
+
+// Bytes of a block that LZW_GROWTH_AUTO codes each way, in slices spread
+// over it. The rules differ most where the input repeats, so a few short
+// slices judge a block better than one long one.
+// LZMW and LZAP fill the dictionary sooner, which slices are too short to
+// show, so on slices they must beat LZW by more than 1/GROWTH_MARGIN.
+#define GROWTH_SAMPLE (128 * 1024)
+#define GROWTH_SLICES 8
+#define GROWTH_MARGIN 32
+
+// Hash table primed with a dictionary's phrases, copied in at the start of
+// every block of the dictionary's symbol width
 typedef struct {
-    int code;
-    char *value;
-} DictEntry;
-
-void lzw_compress(const char *input_file, const char *output_file) {
-    FILE *input = fopen(input_file, "rb");
-    FILE *output = fopen(output_file, "wb");
-    if (!input || !output) {
-        fprintf(stderr, "Error opening files.\n");
-        exit(1);
-    }
-
-    // Reserve space for the dictionary size at the beginning of the file
-    int placeholder = 0;
-    fwrite(&placeholder, sizeof(int), 1, output);
-
-    // Initialize dictionary
-    DictEntry dictionary[MAX_DICT_SIZE];
-    int dict_size = INIT_DICT_SIZE;
-
-    for (int i = 0; i < INIT_DICT_SIZE; i++) {
-        dictionary[i].code = i;
-        dictionary[i].value = malloc(2);
-        dictionary[i].value[0] = (char)i;
-        dictionary[i].value[1] = '\0';
-    }
-
-    char *sequence = malloc(2);
-    sequence[0] = '\0';
-    sequence[1] = '\0';
-
-    int current;
-
-    while ((current = fgetc(input)) != EOF) {
-        // Extend the sequence
-        char *new_sequence = malloc(strlen(sequence) + 2);
-        strcpy(new_sequence, sequence);
-        new_sequence[strlen(sequence)] = (char)current;
-        new_sequence[strlen(sequence) + 1] = '\0';
-
-        // Check if the sequence exists in the dictionary
-        int found = -1;
-        for (int i = 0; i < dict_size; i++) {
-            if (strcmp(dictionary[i].value, new_sequence) == 0) {
-                found = i;
-                break;
+    void *table;                // buckets as in BlockEncoder, NULL without a dictionary
+    int symbol_bits;
+    int codes;                  // phrases in the table
+} Preset;
+
+static inline uint16_t load_u16(const unsigned char *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+#define SYMBOL_BITS 8
+#include "lzw_encode_impl.h"
+#undef SYMBOL_BITS
+
+#define SYMBOL_BITS 16
+#include "lzw_encode_impl.h"
+#undef SYMBOL_BITS
+
+static int block_encoder_init(BlockEncoder *enc, int max_bits) {
+    enc->max_bits = max_bits;
+    enc->symbol_bits = 0;
+    enc->dictionary8 = NULL;
+    enc->dictionary16 = NULL;
+    enc->node_codes = NULL;
+    enc->record = NULL;
+    if (lzw_writer_open_memory(&enc->trial, 0) != 0) {
+        return -1;
+    }
+    if (lzw_writer_open_memory(&enc->codes, 0) != 0) {
+        lzw_writer_close(&enc->trial);
+        return -1;
+    }
+    // Room for the 8-bit table; a 16-bit one grows the arena once
+    if (lzw_arena_init(&enc->arena, table_buckets8(max_bits) * sizeof(DictBucket8)) != 0) {
+        lzw_writer_close(&enc->trial);
+        lzw_writer_close(&enc->codes);
+        return -1;
+    }
+    return 0;
+}
+
+static void block_encoder_free(BlockEncoder *enc) {
+    lzw_arena_free(&enc->arena);
+    lzw_writer_close(&enc->trial);
+    lzw_writer_close(&enc->codes);
+}
+
+// Code with the given LZW_GROWTH_* rule. Returns -1 if the table for this
+// width cannot be allocated.
+static int encode_block(BlockEncoder *enc, int symbol_bits, int growth, const Preset *preset,
+                        const unsigned char *data, size_t len, LzwWriter *out, LzwStats *stats) {
+    if (enc->symbol_bits != symbol_bits) {
+        lzw_arena_reset(&enc->arena);
+        enc->node_codes = NULL;
+        size_t table_size = symbol_bits == 8 ? table_buckets8(enc->max_bits) * sizeof(DictBucket8)
+                                             : table_buckets16(enc->max_bits) * sizeof(DictBucket16);
+        void *table = lzw_arena_alloc(&enc->arena, table_size);
+        enc->dictionary8 = symbol_bits == 8 ? table : NULL;
+        enc->dictionary16 = symbol_bits == 16 ? table : NULL;
+        enc->symbol_bits = table != NULL ? symbol_bits : 0;
+        if (table == NULL) {
+            return -1;
+        }
+    }
+    if (growth == LZW_GROWTH_LZMW && enc->node_codes == NULL) {
+        enc->node_codes = lzw_arena_alloc(&enc->arena, ((size_t)1 << enc->max_bits) * sizeof(uint32_t));
+        if (enc->node_codes == NULL) {
+            return -1;
+        }
+    }
+    if (growth == LZW_GROWTH_LZW) {
+        if (symbol_bits == 8) {
+            encode_block8(enc, preset, data, len, out, stats);
+        } else {
+            encode_block16(enc, preset, data, len, out, stats);
+        }
+    } else if (symbol_bits == 8) {
+        encode_block_grow8(enc, preset, growth, data, len, out, stats);
+    } else {
+        encode_block_grow16(enc, preset, growth, data, len, out, stats);
+    }
+    stats->lzmw_blocks += growth == LZW_GROWTH_LZMW;
+    stats->lzap_blocks += growth == LZW_GROWTH_LZAP;
+    return 0;
+}
+
+// Code a block with the rule that does best on a sample of it. A block of
+// up to GROWTH_SAMPLE bytes is its own sample, is coded whole each way and
+// ends up in out, with *growth saying how. A longer one is sampled in
+// GROWTH_SLICES slices spread over it, each coded on its own, and out is
+// left empty, as it is when out is NULL and only the rule is wanted.
+// Returns -1 if memory runs out.
+static int choose_growth(BlockEncoder *enc, int symbol_bits, const Preset *preset, const unsigned char *data,
+                         size_t len, LzwWriter *out, LzwStats *stats, int *growth) {
+    static const int rules[] = {LZW_GROWTH_LZW, LZW_GROWTH_LZMW, LZW_GROWTH_LZAP};
+    size_t symbol_bytes = (size_t)symbol_bits / 8;
+    int slices = len > GROWTH_SAMPLE ? GROWTH_SLICES : 1;
+    size_t slice = len > GROWTH_SAMPLE ? GROWTH_SAMPLE / GROWTH_SLICES : len;
+    uint64_t best_size = 0;
+    LzwStats best_stats;
+    memset(&best_stats, 0, sizeof(best_stats));
+    for (int i = 0; i < 3; i++) {
+        LzwWriter *trial = i == 0 && slices == 1 && out != NULL ? out : &enc->trial;
+        LzwStats counts;
+        memset(&counts, 0, sizeof(counts));
+        uint64_t size = 0;
+        for (int k = 0; k < slices; k++) {
+            size_t offset = (len - slice) / (2 * (size_t)slices) * (2 * (size_t)k + 1);
+            offset -= offset % symbol_bytes;
+            trial->len = 0;
+            if (encode_block(enc, symbol_bits, rules[i], preset, data + offset, slice, trial, &counts) != 0 ||
+                trial->failed) {
+                return -1;
+            }
+            size += trial->len;
+        }
+        if (i > 0 && slices > 1) {
+            size += size / GROWTH_MARGIN;
+        }
+        if (i == 0 || size < best_size) {
+            if (slices == 1 && out != NULL && trial != out) {
+                LzwWriter swap = *out;
+                *out = *trial;
+                *trial = swap;
             }
+            *growth = rules[i];
+            best_size = size;
+            best_stats = counts;
         }
+    }
+    if (slices == 1 && out != NULL) {
+        lzw_stats_add(stats, &best_stats);
+    }
+    return 0;
+}
 
-        if (found != -1) {
-            // Sequence exists, extend it
-            free(sequence);
-            sequence = new_sequence;
-        } else {
-            // Sequence doesn't exist, write code for existing sequence
-            for (int i = 0; i < dict_size; i++) {
-                if (strcmp(dictionary[i].value, sequence) == 0) {
-                    fwrite(&dictionary[i].code, sizeof(int), 1, output);
-                    break;
-                }
+// One block in flight between the caller, a worker and the writer
+typedef struct {
+    const unsigned char *data;  // into the caller's buffer, or a copy in `input`
+    unsigned char *input;
+    size_t len;
+    size_t limit;               // bytes this block takes before it is submitted
+    int pairs;                  // whether 16-bit symbols line up with the data
+    int borrowed;               // data points into the caller's buffer
+    LzwWriter output;
+    uint32_t checksum;
+    LzwFilter filter;
+    int symbol_bits;
+    int growth;                 // LZW_GROWTH_* asked for, then used
+    int entropy;                // LZW_ENTROPY_* asked for, then used
+    int status;
+    LzwStats stats;             // of this block
+    unsigned char *filtered;    // the block after filtering
+    unsigned char *scratch;
+    BlockEncoder *encoders;     // one per worker
+    const Preset *preset;       // primed table for this block, or NULL
+    LzwTask task;
+} BlockJob;
+
+static void compress_job(void *arg, int worker) {
+    BlockJob *job = arg;
+    const unsigned char *data = job->data;
+    if (job->filter.type != LZW_FILTER_NONE) {
+        lzw_filter_apply(&job->filter, job->data, job->filtered, job->scratch, job->len);
+        data = job->filtered;
+    }
+    job->output.len = 0;
+    job->output.failed = 0;
+    job->status = LZW_OK;
+    memset(&job->stats, 0, sizeof(job->stats));
+    double start = lzw_stats_clock();
+    BlockEncoder *enc = &job->encoders[worker];
+    int status = 0;
+    int entropy = job->entropy == LZW_ENTROPY_HUFFMAN;
+    if (job->growth == LZW_GROWTH_AUTO) {
+        // The rule is judged on packed sizes, which rank the rules the same
+        // way the entropy stage would, near enough
+        status = choose_growth(enc, job->symbol_bits, job->preset, data, job->len, entropy ? NULL : &job->output,
+                               &job->stats, &job->growth);
+    }
+    if (status == 0 && job->output.len == 0) {
+        enc->codes.len = 0;
+        enc->codes.failed = 0;
+        enc->record = entropy ? &enc->codes : NULL;
+        status = encode_block(enc, job->symbol_bits, job->growth, job->preset, data, job->len, &job->output,
+                              &job->stats);
+        enc->record = NULL;
+    }
+    if (status == 0 && entropy) {
+        // Keep whichever of the packed and Huffman-coded streams is smaller
+        uint32_t run = (1u << job->symbol_bits) + 2;     // the RUN code, after CLEAR and END
+        status = enc->codes.failed ? -1 : 0;
+        if (status == 0 && lzw_huffman_write((const LzwBitItem *)enc->codes.buffer,
+                                             enc->codes.len / sizeof(LzwBitItem), run, enc->max_bits,
+                                             &job->output) == 0) {
+            job->entropy = LZW_ENTROPY_NONE;
+        }
+    }
+    job->stats.huffman_blocks = job->entropy == LZW_ENTROPY_HUFFMAN;
+    job->stats.coding_seconds = lzw_stats_clock() - start;
+    if (status != 0 || job->output.failed) {
+        job->status = LZW_ERR_MEMORY;
+        return;
+    }
+    job->checksum = lzw_crc32c(LZW_CRC32C_INIT, job->data, job->len);
+}
+
+void lzw_params_init(LzwParams *params) {
+    params->max_code_bits = LZW_DEFAULT_CODE_BITS;
+    params->io_buffer_size = LZW_IO_BUFFER_SIZE;
+    params->use_mmap = 1;
+    params->block_size = LZW_DEFAULT_BLOCK_SIZE;
+    params->threads = 1;
+    params->max_inflight = 0;
+    params->bin_layout = 0;
+    params->filter = LZW_FILTER_NONE;
+    params->symbol_bits = 8;
+    params->growth = LZW_GROWTH_LZW;
+    params->entropy = LZW_ENTROPY_NONE;
+    params->dictionary = NULL;
+}
+
+const char *lzw_strerror(int status) {
+    switch (status) {
+    case LZW_OK:
+        return "success";
+    case LZW_ERR_PARAM:
+        return "invalid parameter";
+    case LZW_ERR_MEMORY:
+        return "out of memory";
+    case LZW_ERR_IO:
+        return "I/O error";
+    case LZW_ERR_FORMAT:
+        return "not a compressed file";
+    case LZW_ERR_CORRUPT:
+        return "corrupt compressed data";
+    case LZW_ERR_RANGE:
+        return "requested data not in file";
+    case LZW_ERR_MISMATCH:
+        return "decoded data differs";
+    default:
+        return "unknown error";
+    }
+}
+
+// A run of input that blocks must not straddle, and how to filter it
+typedef struct {
+    uint64_t end;
+    LzwFilter filter;
+    int item_size;              // 0 for the header
+} Segment;
+
+// The filter requested by type that suits an array, given its dtype and
+// shape. Every filter only applies to integers: the sign, exponent and
+// mantissa bytes of a float do not form planes that code better apart.
+// Row prediction needs arrays that have rows; anything else falls back to
+// what does apply.
+static LzwFilter array_filter(const LzwBinArray *array, int type) {
+    LzwFilter filter = {LZW_FILTER_NONE, 0, 0};
+    int size = (int)array->item_size;
+    if (size != 1 && size != 2 && size != 4 && size != 8) {
+        return filter;
+    }
+    if (!lzw_dtype_is_integer(array->dtype)) {
+        return filter;
+    }
+    if ((type & LZW_FILTER_UP) && (array->ndim < 2 || array->shape[array->ndim - 1] == 0)) {
+        type = (type & ~LZW_FILTER_UP) | LZW_FILTER_DELTA;
+    }
+    if (size == 1) {
+        type &= ~LZW_FILTER_PLANES;
+    }
+    if (type != LZW_FILTER_NONE) {
+        filter.type = type;
+        filter.item_size = size;
+        filter.row_length = (type & LZW_FILTER_UP) ? array->shape[array->ndim - 1] : 0;
+    }
+    return filter;
+}
+
+struct LzwEncoder {
+    LzwParams params;
+    int threads;
+    LzwPool *pool;
+    BlockEncoder *encoders;     // one per worker
+    int shared;                 // pool and encoders belong to a batch
+    Preset preset;
+    BlockJob *jobs;             // ring of job_count slots
+    int job_count;
+    uint64_t submitted;         // jobs handed to the pool
+    uint64_t written;           // jobs written out, oldest first
+    uint64_t borrowed;          // one past the newest job holding caller memory
+    BlockJob *filling;          // job collecting copied input, or NULL
+
+    LzwWriteFn write;           // the caller's output
+    void *context;
+    LzwCallbackSink sink;       // times write
+    LzwWriter out;
+    LzwStats stats;
+
+    // The container being written
+    int started;                // its file header is out
+    LzwIndex index;
+    uint64_t offset;            // bytes written so far
+    uint64_t consumed;          // input bytes handed to jobs
+    uint32_t content_checksum;  // of the blocks written so far
+    uint64_t input_total;       // over all containers
+
+    // Blocks are cut at array boundaries so every array is coded on its own.
+    // In bin layout the input is held back in `head` until the header
+    // describing those arrays has arrived.
+    Segment *segments;
+    size_t segment_count;
+    size_t segment;             // first segment ending past consumed
+    int layout_known;
+    LzwWriter head;
+
+    int status;                 // first error, which every later call returns
+    char message[LZW_MESSAGE_SIZE];
+};
+
+// Record the first error with a message saying what went wrong
+static int fail(LzwEncoder *enc, int status, const char *format, ...) {
+    if (enc->status == LZW_OK) {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(enc->message, sizeof(enc->message), format, args);
+        va_end(args);
+        enc->status = status;
+    }
+    return enc->status;
+}
+
+static int check_params(LzwEncoder *enc, const LzwParams *params) {
+    int max_bits = params->max_code_bits;
+    if (max_bits < LZW_MIN_CODE_BITS || max_bits > LZW_MAX_CODE_BITS) {
+        return fail(enc, LZW_ERR_PARAM, "Invalid dictionary size: %d bits (must be %d-%d).",
+                    max_bits, LZW_MIN_CODE_BITS, LZW_MAX_CODE_BITS);
+    }
+    if (params->symbol_bits != 8 && params->symbol_bits != 16) {
+        return fail(enc, LZW_ERR_PARAM, "Invalid symbol width: %d bits (must be 8 or 16).", params->symbol_bits);
+    }
+    if (params->symbol_bits == 16 && max_bits < LZW_MIN_CODE_BITS_16) {
+        return fail(enc, LZW_ERR_PARAM, "Invalid dictionary size: %d bits (16-bit symbols need at least %d).",
+                    max_bits, LZW_MIN_CODE_BITS_16);
+    }
+    if (params->growth < LZW_GROWTH_AUTO || params->growth > LZW_GROWTH_LZAP) {
+        return fail(enc, LZW_ERR_PARAM, "Invalid growth rule: %d.", params->growth);
+    }
+    if (params->entropy != LZW_ENTROPY_NONE && params->entropy != LZW_ENTROPY_HUFFMAN) {
+        return fail(enc, LZW_ERR_PARAM, "Invalid entropy coder: %d.", params->entropy);
+    }
+    if (params->block_size < LZW_MIN_BLOCK_SIZE || params->block_size > LZW_MAX_BLOCK_SIZE) {
+        return fail(enc, LZW_ERR_PARAM, "Invalid block size: %zu bytes (must be %d-%d).",
+                    params->block_size, LZW_MIN_BLOCK_SIZE, LZW_MAX_BLOCK_SIZE);
+    }
+    if (params->filter != LZW_FILTER_NONE && !params->bin_layout) {
+        return fail(enc, LZW_ERR_PARAM, "Filters need the array layout of an npz_to_bin.py input.");
+    }
+    if (params->dictionary != NULL && params->dictionary->symbol_bits != params->symbol_bits) {
+        return fail(enc, LZW_ERR_PARAM, "The dictionary is for %d-bit symbols, not %d.",
+                    params->dictionary->symbol_bits, params->symbol_bits);
+    }
+    return LZW_OK;
+}
+
+// Hands output to the caller, timing how long it takes
+static int timed_write(void *context, const void *data, size_t len) {
+    LzwEncoder *enc = context;
+    double start = lzw_stats_clock();
+    int result = enc->write(enc->context, data, len);
+    enc->stats.io_seconds += lzw_stats_clock() - start;
+    return result;
+}
+
+// Set up an encoder. A batch passes the pool and the per-worker
+// dictionaries its encoders share; otherwise pool is NULL and the encoder
+// starts its own.
+static int encoder_create(LzwEncoder **encoder, const LzwParams *params, LzwWriteFn write, void *context,
+                          LzwPool *pool, BlockEncoder *encoders) {
+    LzwEncoder *enc = calloc(1, sizeof(LzwEncoder));
+    *encoder = enc;
+    if (enc == NULL) {
+        return LZW_ERR_MEMORY;
+    }
+    enc->write = write;
+    enc->context = context;
+    enc->sink.write = timed_write;
+    enc->sink.context = enc;
+    if (check_params(enc, params) != LZW_OK) {
+        return enc->status;
+    }
+    enc->params = *params;
+
+    // Each worker owns a dictionary. Twice as many jobs as workers keeps
+    // them busy while the oldest job is written out.
+    if (pool != NULL) {
+        enc->shared = 1;
+        enc->pool = pool;
+        enc->encoders = encoders;
+        enc->threads = lzw_pool_threads(pool);
+    } else {
+        enc->threads = params->threads > 0 ? params->threads : lzw_cpu_count();
+        enc->pool = lzw_pool_create(enc->threads);
+        enc->encoders = calloc((size_t)enc->threads, sizeof(BlockEncoder));
+        if (enc->pool == NULL || enc->encoders == NULL) {
+            return fail(enc, LZW_ERR_MEMORY, "Memory allocation failed for compression jobs.");
+        }
+        for (int i = 0; i < enc->threads; i++) {
+            if (block_encoder_init(&enc->encoders[i], params->max_code_bits) != 0) {
+                return fail(enc, LZW_ERR_MEMORY, "Memory allocation failed for dictionary.");
             }
+        }
+    }
+    enc->job_count = enc->threads > 1 ? 2 * enc->threads : 1;
+    enc->jobs = calloc((size_t)enc->job_count, sizeof(BlockJob));
+    if (enc->jobs == NULL || lzw_writer_open_callback(&enc->out, &enc->sink, params->io_buffer_size) != 0) {
+        return fail(enc, LZW_ERR_MEMORY, "Memory allocation failed for compression jobs.");
+    }
+    // A batch keeps an encoder per worker, so there block outputs start
+    // small and grow only in the jobs that get used
+    size_t output_size = enc->shared ? LZW_MIN_BLOCK_SIZE : params->block_size;
+    for (int i = 0; i < enc->job_count; i++) {
+        if (lzw_writer_open_memory(&enc->jobs[i].output, output_size) != 0) {
+            return fail(enc, LZW_ERR_MEMORY, "Memory allocation failed for compression jobs.");
+        }
+        enc->jobs[i].encoders = enc->encoders;
+    }
 
-            // Add new sequence to dictionary
-            if (dict_size < MAX_DICT_SIZE) {
-                dictionary[dict_size].code = dict_size;
-                dictionary[dict_size].value = new_sequence;
-                dict_size++;
-            } else {
-                free(new_sequence);
+    // Prime one table for all workers to copy, sized as in encode_block
+    const LzwDictionary *dictionary = params->dictionary;
+    int max_bits = params->max_code_bits;
+    uint32_t codes = dictionary != NULL ? lzw_dictionary_codes(dictionary, 1 << max_bits) : 0;
+    if (codes > 0) {
+        uint32_t buckets = (uint32_t)(dictionary->symbol_bits == 8 ? table_buckets8(max_bits) : table_buckets16(max_bits));
+        size_t bucket_size = dictionary->symbol_bits == 8 ? sizeof(DictBucket8) : sizeof(DictBucket16);
+        enc->preset.table = malloc(buckets * bucket_size);
+        if (enc->preset.table == NULL) {
+            return fail(enc, LZW_ERR_MEMORY, "Memory allocation failed for dictionary.");
+        }
+        if (dictionary->symbol_bits == 8) {
+            dict_prime8(enc->preset.table, buckets, dictionary, codes);
+        } else {
+            dict_prime16(enc->preset.table, buckets, dictionary, codes);
+        }
+        enc->preset.symbol_bits = dictionary->symbol_bits;
+        enc->preset.codes = (int)codes;
+    }
+    return LZW_OK;
+}
+
+int lzw_encoder_create(LzwEncoder **encoder, const LzwParams *params, LzwWriteFn write, void *context) {
+    return encoder_create(encoder, params, write, context, NULL, NULL);
+}
+
+void lzw_encoder_destroy(LzwEncoder *enc) {
+    if (enc == NULL) {
+        return;
+    }
+    // Waits for any jobs an error left running
+    if (enc->shared) {
+        for (uint64_t i = enc->written; i < enc->submitted; i++) {
+            lzw_pool_wait(enc->pool, &enc->jobs[i % enc->job_count].task);
+        }
+    } else if (enc->pool != NULL) {
+        lzw_pool_destroy(enc->pool);
+    }
+    if (enc->encoders != NULL && !enc->shared) {
+        for (int i = 0; i < enc->threads; i++) {
+            block_encoder_free(&enc->encoders[i]);
+        }
+    }
+    if (enc->jobs != NULL) {
+        for (int i = 0; i < enc->job_count; i++) {
+            lzw_writer_close(&enc->jobs[i].output);
+            free(enc->jobs[i].input);
+            free(enc->jobs[i].filtered);
+            free(enc->jobs[i].scratch);
+        }
+    }
+    if (!enc->shared) {
+        free(enc->encoders);
+    }
+    free(enc->jobs);
+    free(enc->preset.table);
+    free(enc->segments);
+    lzw_index_free(&enc->index);
+    lzw_writer_close(&enc->head);
+    // Whatever is still buffered belongs to an unfinished container
+    enc->out.len = 0;
+    lzw_writer_close(&enc->out);
+    free(enc);
+}
+
+const char *lzw_encoder_message(const LzwEncoder *enc) {
+    return enc->status != LZW_OK ? enc->message : "";
+}
+
+void lzw_encoder_totals(const LzwEncoder *enc, LzwTotals *totals) {
+    totals->input_bytes = enc->input_total;
+    totals->output_bytes = lzw_writer_tell(&enc->out);
+    totals->stats = enc->stats;
+    totals->stats.enabled = LZW_STATS_ENABLED;
+}
+
+// Append the oldest job to the output and the index
+static int write_oldest(LzwEncoder *enc) {
+    BlockJob *job = &enc->jobs[enc->written % enc->job_count];
+    lzw_pool_wait(enc->pool, &job->task);
+    enc->written++;
+    if (job->status != LZW_OK) {
+        return fail(enc, job->status, "Memory allocation failed for block output.");
+    }
+    lzw_stats_add(&enc->stats, &job->stats);
+
+    LzwBlockInfo info;
+    info.offset = enc->offset;
+    info.compressed_size = (uint32_t)job->output.len;
+    info.uncompressed_size = (uint32_t)job->len;
+    info.checksum = job->checksum;
+    enc->content_checksum = lzw_crc32c_combine(enc->content_checksum, job->checksum, job->len);
+    info.filter = job->filter;
+    info.symbol_bits = job->symbol_bits;
+    info.growth = job->growth;
+    info.entropy = job->entropy;
+    if (lzw_index_push(&enc->index, &info) != 0) {
+        return fail(enc, LZW_ERR_MEMORY, "Memory allocation failed for block index.");
+    }
+
+    lzw_write_block_header(&enc->out, &info);
+    lzw_writer_write(&enc->out, job->output.buffer, job->output.len);
+    enc->offset += LZW_BLOCK_HEADER_SIZE + job->output.len;
+    if (enc->out.failed) {
+        return fail(enc, LZW_ERR_IO, "Cannot write output.");
+    }
+    return LZW_OK;
+}
+
+// Wait for and write every job up to, but not including, job number end
+static int write_until(LzwEncoder *enc, uint64_t end) {
+    while (enc->status == LZW_OK && enc->written < end) {
+        write_oldest(enc);
+    }
+    return enc->status;
+}
+
+// Claim the next slot in the ring and decide how much input it takes: a
+// block, cut short at the end of the current segment
+static BlockJob *start_job(LzwEncoder *enc) {
+    if (enc->submitted - enc->written == (uint64_t)enc->job_count && write_oldest(enc) != LZW_OK) {
+        return NULL;
+    }
+    BlockJob *job = &enc->jobs[enc->submitted % enc->job_count];
+    job->len = 0;
+    job->limit = enc->params.block_size;
+    job->filter.type = LZW_FILTER_NONE;
+    job->pairs = 1;
+
+    while (enc->segment < enc->segment_count && enc->segments[enc->segment].end <= enc->consumed) {
+        enc->segment++;
+    }
+    if (enc->segment < enc->segment_count) {
+        const Segment *segment = &enc->segments[enc->segment];
+        if (segment->end - enc->consumed < job->limit) {
+            job->limit = (size_t)(segment->end - enc->consumed);
+        }
+        job->filter = segment->filter;
+        job->pairs = segment->item_size == 2 && !(job->filter.type & LZW_FILTER_PLANES);
+    } else if (enc->segment_count > 0) {
+        // Bytes past the arrays the header describes
+        job->pairs = 0;
+    }
+    return job;
+}
+
+static int submit_job(LzwEncoder *enc, BlockJob *job) {
+    size_t block_size = enc->params.block_size;
+    if (job->filter.type != LZW_FILTER_NONE && job->filtered == NULL) {
+        job->filtered = malloc(block_size);
+        job->scratch = malloc(block_size);
+        if (job->filtered == NULL || job->scratch == NULL) {
+            return fail(enc, LZW_ERR_MEMORY, "Memory allocation failed for filter buffers.");
+        }
+    }
+    job->symbol_bits = enc->params.symbol_bits == 16 && job->pairs && job->len % 2 == 0 ? 16 : 8;
+    job->growth = enc->params.growth;
+    job->entropy = enc->params.entropy;
+    job->preset = enc->preset.table != NULL && enc->preset.symbol_bits == job->symbol_bits ? &enc->preset : NULL;
+    lzw_pool_submit(enc->pool, &job->task, compress_job, job);
+    enc->submitted++;
+    if (job->borrowed) {
+        enc->borrowed = enc->submitted;
+    }
+    return LZW_OK;
+}
+
+// Cut data into jobs. A job that can take a whole block straight from data
+// codes it in place; anything less is copied so the job can wait for more.
+static int feed(LzwEncoder *enc, const unsigned char *data, size_t len) {
+    while (len > 0 && enc->status == LZW_OK) {
+        BlockJob *job = enc->filling;
+        if (job == NULL && (job = start_job(enc)) == NULL) {
+            break;
+        }
+
+        size_t n = job->limit - job->len;
+        if (n > len) {
+            n = len;
+        }
+        if (job->len == 0 && n == job->limit) {
+            job->data = data;
+            job->borrowed = 1;
+        } else {
+            if (job->input == NULL && (job->input = malloc(enc->params.block_size)) == NULL) {
+                return fail(enc, LZW_ERR_MEMORY, "Memory allocation failed for block buffer.");
             }
+            memcpy(job->input + job->len, data, n);
+            job->data = job->input;
+            job->borrowed = 0;
+        }
+        job->len += n;
+        enc->consumed += n;
+        data += n;
+        len -= n;
 
-            // Reset sequence
-            free(sequence);
-            sequence = malloc(2);
-            sequence[0] = (char)current;
-            sequence[1] = '\0';
+        if (job->len == job->limit) {
+            enc->filling = NULL;
+            submit_job(enc, job);
+        } else {
+            enc->filling = job;
         }
     }
+    return enc->status;
+}
 
-    // Write remaining sequence
-    for (int i = 0; i < dict_size; i++) {
-        if (strcmp(dictionary[i].value, sequence) == 0) {
-            fwrite(&dictionary[i].code, sizeof(int), 1, output);
+// Turn the npz_to_bin.py header at the start of data into segments. Returns
+// 1 if data ends before the header does.
+static int read_layout(LzwEncoder *enc, const unsigned char *data, size_t len) {
+    LzwBinFile bin;
+    int status = lzw_binfile_parse(data, len, &bin);
+    if (status == 1) {
+        return 1;
+    }
+    if (status == -2) {
+        return fail(enc, LZW_ERR_MEMORY, "Memory allocation failed for array list.");
+    }
+    if (status != 0) {
+        return fail(enc, LZW_ERR_FORMAT, "Input does not start with an npz_to_bin.py header.");
+    }
+
+    enc->segments = calloc((size_t)bin.count + 1, sizeof(Segment));
+    if (enc->segments == NULL) {
+        lzw_binfile_free(&bin);
+        return fail(enc, LZW_ERR_MEMORY, "Memory allocation failed for array boundaries.");
+    }
+    enc->segments[0].end = bin.header_size;
+    for (uint32_t i = 0; i < bin.count; i++) {
+        enc->segments[i + 1].end = bin.arrays[i].offset + bin.arrays[i].size;
+        enc->segments[i + 1].filter = array_filter(&bin.arrays[i], enc->params.filter);
+        enc->segments[i + 1].item_size = (int)bin.arrays[i].item_size;
+    }
+    enc->segment_count = (size_t)bin.count + 1;
+    enc->segment = 0;
+    enc->layout_known = 1;
+    lzw_binfile_free(&bin);
+    return LZW_OK;
+}
+
+static int begin_container(LzwEncoder *enc) {
+    if (enc->started) {
+        return enc->status;
+    }
+    int flags = enc->params.bin_layout ? LZW_FLAG_BIN_LAYOUT : 0;
+    uint32_t dictionary_id = enc->params.dictionary != NULL ? enc->params.dictionary->id : 0;
+    LzwFileHeader header = {LZW_FORMAT_VERSION, enc->params.max_code_bits, flags, (uint32_t)enc->params.block_size,
+                            dictionary_id};
+    lzw_write_file_header(&enc->out, &header);
+    enc->offset = LZW_FILE_HEADER_SIZE;
+    enc->consumed = 0;
+    enc->content_checksum = LZW_CRC32C_INIT;
+    enc->layout_known = !enc->params.bin_layout;
+    enc->started = 1;
+    return enc->status;
+}
+
+// Carry on with a container already on file as if this encoder had written
+// its blocks. The next block goes where its end marker starts.
+static int resume_container(LzwEncoder *enc, const LzwIndex *index, uint64_t end_marker,
+                            uint32_t content_checksum) {
+    for (uint64_t i = 0; i < index->count; i++) {
+        if (lzw_index_push(&enc->index, &index->blocks[i]) != 0) {
+            return fail(enc, LZW_ERR_MEMORY, "Memory allocation failed for block index.");
+        }
+    }
+    enc->offset = end_marker;
+    enc->consumed = 0;
+    enc->content_checksum = content_checksum;
+    enc->layout_known = 1;
+    enc->started = 1;
+    return enc->status;
+}
+
+int lzw_encoder_encode(LzwEncoder *enc, const void *data, size_t len) {
+    if (enc->status != LZW_OK || begin_container(enc) != LZW_OK) {
+        return enc->status;
+    }
+    enc->input_total += len;
+
+    const unsigned char *bytes = data;
+    if (enc->layout_known) {
+        feed(enc, bytes, len);
+    } else if (enc->head.len == 0 && read_layout(enc, bytes, len) == LZW_OK) {
+        feed(enc, bytes, len);
+    } else if (enc->status == LZW_OK) {
+        // Hold the input back until the whole header is here
+        if (enc->head.buffer == NULL && lzw_writer_open_memory(&enc->head, 0) != 0) {
+            return fail(enc, LZW_ERR_MEMORY, "Memory allocation failed for array list.");
+        }
+        lzw_writer_write(&enc->head, bytes, len);
+        if (enc->head.failed) {
+            return fail(enc, LZW_ERR_MEMORY, "Memory allocation failed for array list.");
+        }
+        if (read_layout(enc, enc->head.buffer, enc->head.len) == LZW_OK) {
+            feed(enc, enc->head.buffer, enc->head.len);
+            enc->head.len = 0;
+        }
+    }
+
+    // Nothing may still point into the caller's buffer once this returns
+    return write_until(enc, enc->borrowed);
+}
+
+int lzw_encoder_flush(LzwEncoder *enc) {
+    if (enc->status != LZW_OK || begin_container(enc) != LZW_OK) {
+        return enc->status;
+    }
+    if (!enc->layout_known) {
+        return fail(enc, LZW_ERR_FORMAT, "Input does not start with an npz_to_bin.py header.");
+    }
+    if (enc->filling != NULL) {
+        BlockJob *job = enc->filling;
+        enc->filling = NULL;
+        if (submit_job(enc, job) != LZW_OK) {
+            return enc->status;
+        }
+    }
+    if (write_until(enc, enc->submitted) != LZW_OK) {
+        return enc->status;
+    }
+
+    lzw_write_index(&enc->out, enc->index.blocks, enc->index.count, enc->offset, enc->content_checksum);
+    lzw_writer_drain(&enc->out);
+    if (enc->out.failed) {
+        return fail(enc, LZW_ERR_IO, "Cannot write output.");
+    }
+
+    // The next call starts a new container, keeping every allocation
+    enc->index.count = 0;
+    free(enc->segments);
+    enc->segments = NULL;
+    enc->segment_count = 0;
+    enc->segment = 0;
+    enc->head.len = 0;
+    enc->started = 0;
+    return LZW_OK;
+}
+
+// Feed enc, which was created with the given status, everything the read
+// stage delivers and flush it. Fills totals and destroys enc.
+static int encode_input(LzwEncoder *enc, int status, LzwReadStage *reading, LzwReader *in, const char *input_file,
+                        LzwTotals *totals) {
+    double read_seconds = 0;
+    while (status == LZW_OK) {
+        double start = lzw_stats_clock();
+        size_t len;
+        const unsigned char *data = lzw_read_stage_next(reading, &len);
+        read_seconds += lzw_stats_clock() - start;
+        if (data == NULL) {
             break;
         }
+        status = lzw_encoder_encode(enc, data, len);
+    }
+    lzw_read_stage_finish(reading);
+    if (status == LZW_OK && in->failed) {
+        status = fail(enc, LZW_ERR_IO, "Cannot read %s.", input_file);
+    }
+    if (status == LZW_OK) {
+        status = lzw_encoder_flush(enc);
     }
 
-    // Go back and write the dictionary size at the start of the file
-    fseek(output, 0, SEEK_SET);
-    fwrite(&dict_size, sizeof(int), 1, output);
+    if (enc != NULL) {
+        lzw_encoder_totals(enc, totals);
+        totals->stats.io_seconds += read_seconds;
+        snprintf(totals->message, sizeof(totals->message), "%s", lzw_encoder_message(enc));
+    } else {
+        snprintf(totals->message, sizeof(totals->message), "%s", lzw_strerror(status));
+    }
+    lzw_encoder_destroy(enc);
+    return status;
+}
 
-    // Cleanup
-    free(sequence);
-    for (int i = 0; i < dict_size; i++) {
-        free(dictionary[i].value);
+int lzw_compress(const char *input_file, const char *output_file, const LzwParams *params, LzwTotals *totals) {
+    LzwTotals local;
+    if (totals == NULL) {
+        totals = &local;
     }
+    memset(totals, 0, sizeof(*totals));
 
-    fclose(input);
-    fclose(output);
-    printf("Compression complete.\n");
+    LzwReader in;
+    if (lzw_reader_open_path(&in, input_file, params->io_buffer_size, params->use_mmap) != 0) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot open %s.", input_file);
+        return LZW_ERR_IO;
+    }
+    FILE *output = lzw_open_output(output_file);
+    if (output == NULL) {
+        lzw_reader_close(&in);
+        snprintf(totals->message, sizeof(totals->message), "Cannot open %s.", output_file);
+        return LZW_ERR_IO;
+    }
+
+    // Reads and writes run on threads of their own. A mapped input arrives
+    // as one piece, so its blocks are coded in place.
+    LzwEncoder *enc;
+    LzwReadStage reading;
+    LzwWriteStage writing;
+    if (lzw_read_stage_start(&reading, &in) != 0) {
+        lzw_reader_close(&in);
+        lzw_close_output(output);
+        snprintf(totals->message, sizeof(totals->message), "Cannot start the input thread.");
+        return LZW_ERR_MEMORY;
+    }
+    if (lzw_write_stage_start(&writing, output, params->io_buffer_size) != 0) {
+        lzw_read_stage_finish(&reading);
+        lzw_reader_close(&in);
+        lzw_close_output(output);
+        snprintf(totals->message, sizeof(totals->message), "Cannot start the output thread.");
+        return LZW_ERR_MEMORY;
+    }
+    int status = lzw_encoder_create(&enc, params, lzw_write_stage_write, &writing);
+    status = encode_input(enc, status, &reading, &in, input_file, totals);
+    lzw_reader_close(&in);
+    int write_failed = lzw_write_stage_finish(&writing) != 0;
+    if ((lzw_close_output(output) != 0 || write_failed) && status == LZW_OK) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot write %s.", output_file);
+        status = LZW_ERR_IO;
+    }
+    return status;
 }
 
+// Put the end marker, index and trailer that the file had before an append
+// back where they were. Returns -1 if they cannot be written.
+static int restore_index(FILE *file, const LzwIndex *index, uint64_t end_marker, uint32_t content_checksum) {
+    LzwWriter out;
+    if (lzw_writer_open_memory(&out, 0) != 0) {
+        return -1;
+    }
+    lzw_write_index(&out, index->blocks, index->count, end_marker, content_checksum);
+    int failed = out.failed || fseeko(file, (off_t)end_marker, SEEK_SET) != 0 ||
+                 fwrite(out.buffer, 1, out.len, file) != out.len || fflush(file) != 0 ||
+                 ftruncate(fileno(file), (off_t)(end_marker + out.len)) != 0;
+    lzw_writer_close(&out);
+    return failed ? -1 : 0;
+}
+
+// Check that archive_file can take more blocks from an encoder with params
+// and load its index. Leaves the file positioned at its end marker.
+static int open_for_append(FILE *file, const char *archive_file, const LzwParams *params, LzwFileHeader *header,
+                           LzwIndex *index, LzwTrailer *trailer, LzwTotals *totals) {
+    unsigned char header_data[LZW_FILE_HEADER_SIZE];
+    if (fread(header_data, 1, sizeof(header_data), file) != sizeof(header_data) ||
+        lzw_parse_file_header(header_data, header) != 0) {
+        snprintf(totals->message, sizeof(totals->message), "%s is not an LZW container of versions %d-%d.",
+                 archive_file, LZW_MIN_FORMAT_VERSION, LZW_FORMAT_VERSION);
+        return LZW_ERR_FORMAT;
+    }
+    if (header->version != LZW_FORMAT_VERSION) {
+        snprintf(totals->message, sizeof(totals->message), "Appending needs a version %d file; recompress %s first.",
+                 LZW_FORMAT_VERSION, archive_file);
+        return LZW_ERR_FORMAT;
+    }
+    if ((header->flags & LZW_FLAG_BIN_LAYOUT) || params->bin_layout) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot append to or in npz_to_bin.py layout.");
+        return LZW_ERR_PARAM;
+    }
+    uint32_t dictionary_id = params->dictionary != NULL ? params->dictionary->id : 0;
+    if (dictionary_id != header->dictionary_id) {
+        if (header->dictionary_id == 0) {
+            snprintf(totals->message, sizeof(totals->message), "%s was compressed without a dictionary.",
+                     archive_file);
+        } else {
+            snprintf(totals->message, sizeof(totals->message), "%s needs dictionary %08x to append to.",
+                     archive_file, header->dictionary_id);
+        }
+        return LZW_ERR_PARAM;
+    }
+
+    if (fseeko(file, 0, SEEK_END) != 0) {
+        snprintf(totals->message, sizeof(totals->message), "%s is not seekable.", archive_file);
+        return LZW_ERR_PARAM;
+    }
+    int result = lzw_read_index(file, (uint64_t)ftello(file), header, index, trailer);
+    if (result == -2) {
+        snprintf(totals->message, sizeof(totals->message), "Memory allocation failed for block index.");
+        return LZW_ERR_MEMORY;
+    }
+    if (result != 0) {
+        snprintf(totals->message, sizeof(totals->message), "Missing or inconsistent block index in %s.",
+                 archive_file);
+        return LZW_ERR_CORRUPT;
+    }
+    if (fseeko(file, (off_t)(trailer->index_offset - LZW_BLOCK_HEADER_SIZE), SEEK_SET) != 0) {
+        snprintf(totals->message, sizeof(totals->message), "%s is not seekable.", archive_file);
+        return LZW_ERR_PARAM;
+    }
+    return LZW_OK;
+}
+
+int lzw_compress_append(const char *input_file, const char *archive_file, const LzwParams *params,
+                        LzwTotals *totals) {
+    LzwTotals local;
+    if (totals == NULL) {
+        totals = &local;
+    }
+    memset(totals, 0, sizeof(*totals));
+
+    if (strcmp(archive_file, "-") == 0) {
+        snprintf(totals->message, sizeof(totals->message), "Appending needs a file, not stdout.");
+        return LZW_ERR_PARAM;
+    }
+    FILE *file = fopen(archive_file, "r+b");
+    if (file == NULL) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot open %s.", archive_file);
+        return LZW_ERR_IO;
+    }
+    LzwFileHeader header;
+    LzwIndex index = {NULL, 0, 0};
+    LzwTrailer trailer;
+    int status = open_for_append(file, archive_file, params, &header, &index, &trailer, totals);
+    LzwReader in;
+    if (status == LZW_OK && lzw_reader_open_path(&in, input_file, params->io_buffer_size, params->use_mmap) != 0) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot open %s.", input_file);
+        status = LZW_ERR_IO;
+    }
+    if (status != LZW_OK) {
+        lzw_index_free(&index);
+        fclose(file);
+        return status;
+    }
+
+    // The new blocks overwrite the end marker, index and trailer, and a new
+    // index covering every block follows them. The blocks already there are
+    // never touched, so a failure only has to put the old index back.
+    uint64_t end_marker = trailer.index_offset - LZW_BLOCK_HEADER_SIZE;
+    LzwParams container = *params;
+    container.max_code_bits = header.max_code_bits;
+    container.block_size = header.block_size;
+    LzwEncoder *enc;
+    LzwReadStage reading;
+    LzwWriteStage writing;
+    if (lzw_read_stage_start(&reading, &in) != 0) {
+        lzw_reader_close(&in);
+        lzw_index_free(&index);
+        fclose(file);
+        snprintf(totals->message, sizeof(totals->message), "Cannot start the input thread.");
+        return LZW_ERR_MEMORY;
+    }
+    if (lzw_write_stage_start(&writing, file, params->io_buffer_size) != 0) {
+        lzw_read_stage_finish(&reading);
+        lzw_reader_close(&in);
+        lzw_index_free(&index);
+        fclose(file);
+        snprintf(totals->message, sizeof(totals->message), "Cannot start the output thread.");
+        return LZW_ERR_MEMORY;
+    }
+    status = lzw_encoder_create(&enc, &container, lzw_write_stage_write, &writing);
+    if (status == LZW_OK) {
+        status = resume_container(enc, &index, end_marker, trailer.content_checksum);
+    }
+    status = encode_input(enc, status, &reading, &in, input_file, totals);
+    lzw_reader_close(&in);
+    int write_failed = lzw_write_stage_finish(&writing) != 0;
+    if (status == LZW_OK && (write_failed || fflush(file) != 0 ||
+                             ftruncate(fileno(file), (off_t)(end_marker + totals->output_bytes)) != 0)) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot write %s.", archive_file);
+        status = LZW_ERR_IO;
+    }
+    if (status != LZW_OK && restore_index(file, &index, end_marker, trailer.content_checksum) != 0) {
+        snprintf(totals->message + strlen(totals->message), sizeof(totals->message) - strlen(totals->message),
+                 " %s has no valid index now.", archive_file);
+    }
+    lzw_index_free(&index);
+    if (fclose(file) != 0 && status == LZW_OK) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot write %s.", archive_file);
+        status = LZW_ERR_IO;
+    }
+    return status;
+}
+
+// Shared by the files of one lzw_compress_batch
+typedef struct {
+    const LzwParams *params;
+    LzwPool *pool;
+    BlockEncoder *dictionaries; // one per worker, used by every file's blocks
+    LzwEncoder **encoders;      // one per worker, reused from file to file
+    int archive;                // outputs are collected in memory
+} Batch;
+
+typedef struct {
+    Batch *batch;
+    LzwBatchFile *file;
+    uint64_t size;              // of the input, to start the largest first
+    LzwWriter output;           // the container, when writing an archive
+    LzwTask task;
+} FileJob;
+
+static int write_stream(void *context, const void *data, size_t len) {
+    return fwrite(data, 1, len, context) == len ? 0 : -1;
+}
+
+static int write_memory(void *context, const void *data, size_t len) {
+    LzwWriter *writer = context;
+    lzw_writer_write(writer, data, len);
+    return writer->failed ? -1 : 0;
+}
+
+// Compress one file of a batch with the encoder of the worker running it
+static void compress_file_job(void *arg, int worker) {
+    FileJob *job = arg;
+    Batch *batch = job->batch;
+    LzwBatchFile *file = job->file;
+    LzwTotals *totals = &file->totals;
+    const LzwParams *params = batch->params;
+
+    LzwReader in;
+    if (lzw_reader_open_path(&in, file->input_file, params->io_buffer_size, params->use_mmap) != 0) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot open %s.", file->input_file);
+        file->status = LZW_ERR_IO;
+        return;
+    }
+    FILE *output = NULL;
+    if (batch->archive) {
+        if (lzw_writer_open_memory(&job->output, 0) != 0) {
+            lzw_reader_close(&in);
+            snprintf(totals->message, sizeof(totals->message), "%s", lzw_strerror(LZW_ERR_MEMORY));
+            file->status = LZW_ERR_MEMORY;
+            return;
+        }
+    } else if ((output = lzw_open_output(file->output_file)) == NULL) {
+        lzw_reader_close(&in);
+        snprintf(totals->message, sizeof(totals->message), "Cannot open %s.", file->output_file);
+        file->status = LZW_ERR_IO;
+        return;
+    }
+    LzwWriteFn write = batch->archive ? write_memory : write_stream;
+    void *context = batch->archive ? (void *)&job->output : (void *)output;
+
+    LzwEncoder **slot = &batch->encoders[worker];
+    int status = LZW_OK;
+    if (*slot == NULL) {
+        status = encoder_create(slot, params, write, context, batch->pool, batch->dictionaries);
+    }
+    LzwEncoder *enc = *slot;
+    if (enc != NULL) {
+        enc->write = write;
+        enc->context = context;
+    }
+    double read_seconds = 0;
+    while (status == LZW_OK) {
+        double start = lzw_stats_clock();
+        size_t len = lzw_reader_fill(&in);
+        read_seconds += lzw_stats_clock() - start;
+        if (len == 0) {
+            break;
+        }
+        status = lzw_encoder_encode(enc, in.buffer + in.pos, len);
+        in.pos = in.len;
+    }
+    if (status == LZW_OK && in.failed) {
+        status = fail(enc, LZW_ERR_IO, "Cannot read %s.", file->input_file);
+    }
+    if (status == LZW_OK) {
+        status = lzw_encoder_flush(enc);
+    }
+
+    if (enc != NULL) {
+        lzw_encoder_totals(enc, totals);
+        totals->stats.io_seconds += read_seconds;
+        snprintf(totals->message, sizeof(totals->message), "%s", lzw_encoder_message(enc));
+        if (status == LZW_OK) {
+            // Count the next file from zero
+            enc->input_total = 0;
+            enc->out.offset = 0;
+            memset(&enc->stats, 0, sizeof(enc->stats));
+        } else {
+            // An error sticks to the encoder, so the next file gets a new one
+            lzw_encoder_destroy(enc);
+            *slot = NULL;
+        }
+    } else {
+        snprintf(totals->message, sizeof(totals->message), "%s", lzw_strerror(status));
+    }
+    lzw_reader_close(&in);
+    if (output != NULL && lzw_close_output(output) != 0 && status == LZW_OK) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot write %s.", file->output_file);
+        status = LZW_ERR_IO;
+    }
+    file->status = status;
+}
+
+static int larger_first(const void *a, const void *b) {
+    const FileJob *x = *(FileJob *const *)a;
+    const FileJob *y = *(FileJob *const *)b;
+    return x->size < y->size ? 1 : x->size > y->size ? -1 : 0;
+}
+
+// Where a file of a batch goes: its output path, or in an archive the base
+// name of its input
+static const char *batch_name(const LzwBatchFile *file, int archive) {
+    if (!archive) {
+        return file->output_file;
+    }
+    const char *name = strrchr(file->input_file, '/');
+    return name != NULL ? name + 1 : file->input_file;
+}
+
+typedef struct {
+    const char *name;
+    const LzwBatchFile *file;
+} BatchName;
+
+static int by_batch_name(const void *a, const void *b) {
+    const BatchName *x = a, *y = b;
+    int order = strcmp(x->name, y->name);
+    return order != 0 ? order : x->file < y->file ? -1 : x->file > y->file;
+}
+
+// Two files of a batch would overwrite each other's output or share a
+// member name, so refuse the batch before anything is written
+static int check_batch_names(const LzwBatchFile *files, size_t count, int archive, LzwTotals *totals) {
+    if (count < 2) {
+        return LZW_OK;
+    }
+    BatchName *names = malloc(count * sizeof(BatchName));
+    if (names == NULL) {
+        snprintf(totals->message, sizeof(totals->message), "%s", lzw_strerror(LZW_ERR_MEMORY));
+        return LZW_ERR_MEMORY;
+    }
+    for (size_t i = 0; i < count; i++) {
+        names[i].name = batch_name(&files[i], archive);
+        names[i].file = &files[i];
+    }
+    qsort(names, count, sizeof(BatchName), by_batch_name);
+    int status = LZW_OK;
+    for (size_t i = 1; i < count && status == LZW_OK; i++) {
+        if (strcmp(names[i - 1].name, names[i].name) == 0) {
+            snprintf(totals->message, sizeof(totals->message), "%s and %s would both be %s %s.",
+                     names[i - 1].file->input_file, names[i].file->input_file,
+                     archive ? "archive member" : "written to", names[i].name);
+            status = LZW_ERR_PARAM;
+        }
+    }
+    free(names);
+    return status;
+}
+
+static void free_batch(Batch *batch, int threads) {
+    if (batch->encoders != NULL) {
+        for (int i = 0; i < threads; i++) {
+            lzw_encoder_destroy(batch->encoders[i]);
+        }
+    }
+    if (batch->pool != NULL) {
+        lzw_pool_destroy(batch->pool);
+    }
+    if (batch->dictionaries != NULL) {
+        for (int i = 0; i < threads; i++) {
+            block_encoder_free(&batch->dictionaries[i]);
+        }
+    }
+    free(batch->encoders);
+    free(batch->dictionaries);
+}
+
+int lzw_compress_batch(LzwBatchFile *files, size_t count, const char *archive_file, const LzwParams *params,
+                       LzwTotals *totals) {
+    LzwTotals local;
+    if (totals == NULL) {
+        totals = &local;
+    }
+    memset(totals, 0, sizeof(*totals));
+    totals->stats.enabled = LZW_STATS_ENABLED;
+
+    // The dictionaries are sized from params, so check them first
+    LzwEncoder *probe = calloc(1, sizeof(LzwEncoder));
+    if (probe == NULL) {
+        snprintf(totals->message, sizeof(totals->message), "%s", lzw_strerror(LZW_ERR_MEMORY));
+        return LZW_ERR_MEMORY;
+    }
+    int status = check_params(probe, params);
+    snprintf(totals->message, sizeof(totals->message), "%s", lzw_encoder_message(probe));
+    free(probe);
+    if (status != LZW_OK) {
+        return status;
+    }
+    status = check_batch_names(files, count, archive_file != NULL, totals);
+    if (status != LZW_OK) {
+        return status;
+    }
+
+    Batch batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.params = params;
+    batch.archive = archive_file != NULL;
+    batch.pool = lzw_pool_create(params->threads > 0 ? params->threads : lzw_cpu_count());
+    int threads = batch.pool != NULL ? lzw_pool_threads(batch.pool) : 0;
+    batch.dictionaries = calloc((size_t)threads, sizeof(BlockEncoder));
+    batch.encoders = calloc((size_t)threads, sizeof(LzwEncoder *));
+    FileJob *jobs = calloc(count, sizeof(FileJob));
+    FileJob **order = calloc(count, sizeof(FileJob *));
+    LzwMember *members = batch.archive ? calloc(count > 0 ? count : 1, sizeof(LzwMember)) : NULL;
+    int ready = batch.pool != NULL && batch.dictionaries != NULL && batch.encoders != NULL &&
+                (count == 0 || (jobs != NULL && order != NULL)) && (!batch.archive || members != NULL);
+    for (int i = 0; ready && i < threads; i++) {
+        ready = block_encoder_init(&batch.dictionaries[i], params->max_code_bits) == 0;
+    }
+    if (!ready) {
+        free(jobs);
+        free(order);
+        free(members);
+        free_batch(&batch, threads);
+        snprintf(totals->message, sizeof(totals->message), "%s", lzw_strerror(LZW_ERR_MEMORY));
+        return LZW_ERR_MEMORY;
+    }
+    FILE *archive = NULL;
+    if (batch.archive && (archive = lzw_open_output(archive_file)) == NULL) {
+        free(jobs);
+        free(order);
+        free(members);
+        free_batch(&batch, threads);
+        snprintf(totals->message, sizeof(totals->message), "Cannot open %s.", archive_file);
+        return LZW_ERR_IO;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        struct stat info;
+        jobs[i].batch = &batch;
+        jobs[i].file = &files[i];
+        jobs[i].size = stat(files[i].input_file, &info) == 0 ? (uint64_t)info.st_size : 0;
+        memset(&files[i].totals, 0, sizeof(files[i].totals));
+        files[i].status = LZW_OK;
+        order[i] = &jobs[i];
+    }
+    // An archive takes its containers in the order given, so it starts them
+    // in that order and only a window ahead of the one being written, which
+    // bounds the containers held in memory
+    size_t window = count;
+    if (!batch.archive) {
+        qsort(order, count, sizeof(FileJob *), larger_first);
+    } else if (window > 2 * (size_t)threads) {
+        window = 2 * (size_t)threads;
+    }
+    for (size_t i = 0; i < window; i++) {
+        lzw_pool_submit(batch.pool, &order[i]->task, compress_file_job, order[i]);
+    }
+
+    status = LZW_OK;
+    int archive_failed = 0;
+    size_t member_count = 0;
+    uint64_t archive_offset = 0;
+    for (size_t i = 0; i < count; i++) {
+        FileJob *job = &jobs[i];
+        lzw_pool_wait(batch.pool, &job->task);
+        if (batch.archive && job->output.buffer != NULL) {
+            if (job->file->status == LZW_OK && !archive_failed) {
+                if (fwrite(job->output.buffer, 1, job->output.len, archive) != job->output.len) {
+                    archive_failed = 1;
+                }
+                LzwMember *member = &members[member_count++];
+                member->name = batch_name(job->file, 1);
+                member->offset = archive_offset;
+                member->length = job->output.len;
+                member->size = job->file->totals.input_bytes;
+                archive_offset += job->output.len;
+            }
+            lzw_writer_close(&job->output);
+        }
+        if (i + window < count) {
+            lzw_pool_submit(batch.pool, &order[i + window]->task, compress_file_job, order[i + window]);
+        }
+        LzwTotals *part = &job->file->totals;
+        totals->input_bytes += part->input_bytes;
+        totals->output_bytes += part->output_bytes;
+        lzw_stats_add(&totals->stats, &part->stats);
+        if (job->file->status != LZW_OK && status == LZW_OK) {
+            status = job->file->status;
+            size_t n = (size_t)snprintf(totals->message, sizeof(totals->message), "%s: ", job->file->input_file);
+            if (n < sizeof(totals->message)) {
+                snprintf(totals->message + n, sizeof(totals->message) - n, "%s", part->message);
+            }
+        }
+    }
+
+    if (archive != NULL && !archive_failed) {
+        LzwWriter table;
+        if (lzw_writer_open_file(&table, archive, 0) != 0) {
+            archive_failed = 1;
+        } else {
+            lzw_write_members(&table, members, member_count, archive_offset);
+            lzw_writer_close(&table);
+            archive_failed = table.failed;
+            totals->output_bytes = archive_offset + lzw_writer_tell(&table);
+        }
+    }
+    if (archive != NULL && (lzw_close_output(archive) != 0 || archive_failed) && status == LZW_OK) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot write %s.", archive_file);
+        status = LZW_ERR_IO;
+    }
+    free(jobs);
+    free(order);
+    free(members);
+    free_batch(&batch, threads);
+    return status;
+}
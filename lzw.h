@@ -1,10 +1,254 @@
 #ifndef LZW_H
 #define LZW_H
 
-#define MAX_DICT_SIZE 256
-#define INIT_DICT_SIZE 8
+#include <stddef.h>
+#include <stdint.h>
 
-void lzw_compress(const char *input_file, const char *output_file);
-void lzw_decompress(const char *input_file, const char *output_file);
+// Every byte value is a root code, followed by the three control codes
+#define INIT_DICT_SIZE 256
+#define LZW_CODE_CLEAR 256      // reset the dictionary to its roots
+#define LZW_CODE_END 257        // end of the code stream
+#define LZW_CODE_RUN 258        // a run of one symbol, see lzw_encode_impl.h
+#define LZW_FIRST_CODE 259      // first code assigned to a learned phrase
+
+// Shorter runs of one symbol are left to the dictionary
+#define LZW_RUN_MIN 64
+
+// The dictionary holds up to 2^max_code_bits codes
+#define LZW_MIN_CODE_BITS 9
+#define LZW_MAX_CODE_BITS 20
+#define LZW_DEFAULT_CODE_BITS 16
+
+// With 16-bit symbols every u16 value is a root, CLEAR, END and RUN follow
+// at 65536-65538, and the dictionary needs room beyond the roots
+#define LZW_MIN_CODE_BITS_16 17
+#define LZW_DEFAULT_CODE_BITS_16 20
+
+// How a block's dictionary grows after each code: LZW adds the previous
+// phrase plus the first symbol of the next, LZMW the previous phrase plus
+// the whole next one, and LZAP the previous phrase plus every prefix of the
+// next. The longer entries of LZMW and LZAP learn long repeats, such as
+// rows of a mask, in far fewer codes. AUTO codes a sample of each block
+// every way and keeps the smallest.
+#define LZW_GROWTH_LZW 0
+#define LZW_GROWTH_LZMW 1
+#define LZW_GROWTH_LZAP 2
+#define LZW_GROWTH_AUTO -1
+
+// How a block's codes are stored: packed at the width of the dictionary, or
+// Huffman-coded where that comes out smaller, see lzw_huffman.h
+#define LZW_ENTROPY_NONE 0
+#define LZW_ENTROPY_HUFFMAN 1
+
+// Container versions written and read, see lzw_container.h for the layout
+#define LZW_FORMAT_VERSION 7    // 3 added the RUN code, 4 the dictionary id, 5 CRC-32C, 6 growth, 7 Huffman
+#define LZW_MIN_FORMAT_VERSION 3    // the same layout with no dictionary
+
+// Status codes returned by the library; every failure also leaves a message
+// describing it
+#define LZW_OK 0
+#define LZW_ERR_PARAM -1        // a parameter is out of range
+#define LZW_ERR_MEMORY -2
+#define LZW_ERR_IO -3           // a file could not be opened, read or written
+#define LZW_ERR_FORMAT -4       // the input is not in the expected format
+#define LZW_ERR_CORRUPT -5      // compressed data is damaged or truncated
+#define LZW_ERR_RANGE -6        // the requested bytes or array are not in the file
+#define LZW_ERR_MISMATCH -7     // decoded data differs from the file it was tested against
+
+#define LZW_MESSAGE_SIZE 160
+
+// A pre-trained sample of typical input that primes every block, so that
+// small blocks such as tiles of a few KB start out with a warm dictionary.
+// A compressed file names its dictionary by id and can only be decoded
+// with the same one.
+typedef struct LzwDictionary LzwDictionary;
+
+#define LZW_MAX_DICTIONARY_BYTES (1 << 20)
+
+typedef struct {
+    int max_code_bits;
+    size_t io_buffer_size;  // bytes buffered per input and output stream
+    int use_mmap;           // map regular input files instead of reading them
+    size_t block_size;      // uncompressed bytes per independently coded block
+    int threads;            // block workers, 0 for one per processor
+    int max_inflight;       // blocks held in memory while decoding, 0 for 2 per thread
+    int bin_layout;         // input is an npz_to_bin.py file, code each array separately
+    int filter;             // LZW_FILTER_* bits to apply to arrays that suit them
+    int symbol_bits;        // 8, or 16 to code u16 elements as single symbols
+    int growth;             // LZW_GROWTH_*, for every block or AUTO to pick per block
+    int entropy;            // LZW_ENTROPY_*
+    const LzwDictionary *dictionary;    // primes blocks of its symbol width, NULL for none
+} LzwParams;
+
+// What the coder did, counted per block by whichever worker coded it.
+// Building the library with -DLZW_NO_STATS removes the counting from the
+// hot loops; every count is then 0 and enabled says so.
+typedef struct {
+    int enabled;
+    uint64_t blocks;
+    uint64_t symbols;           // coded, runs included
+    uint64_t codes;             // phrase and RUN codes, not CLEAR or END
+    uint64_t runs;              // RUN codes
+    uint64_t run_symbols;       // symbols they covered
+    uint64_t hits;              // encoder lookups that extended a phrase
+    uint64_t misses;            // and that ended one
+    uint64_t clears;            // CLEAR codes
+    uint64_t filled_blocks;     // blocks whose dictionary filled up
+    uint64_t fill_symbols;      // symbols into those blocks when it did
+    uint64_t lzmw_blocks;       // blocks grown by LZMW rather than LZW rules
+    uint64_t lzap_blocks;       // and by LZAP
+    uint64_t huffman_blocks;    // blocks whose codes are Huffman-coded
+    double coding_seconds;      // in the LZW core, summed over workers
+    double io_seconds;          // reading input and handing over output
+} LzwStats;
+
+// Bytes read and written by a finished run, counted as they pass through
+// so that pipes can be measured too
+typedef struct {
+    uint64_t input_bytes;
+    uint64_t output_bytes;
+    LzwStats stats;
+    char message[LZW_MESSAGE_SIZE];     // why the run failed, empty on success
+} LzwTotals;
+
+void lzw_params_init(LzwParams *params);
+
+// Short description of a status code
+const char *lzw_strerror(int status);
+
+// Receives output as it is produced. Returning nonzero fails the call that
+// produced it with LZW_ERR_IO.
+typedef int (*LzwWriteFn)(void *context, const void *data, size_t len);
+
+// Streaming compressor. Keeps its pool, dictionaries and buffers from one
+// call to the next, so one encoder can code many inputs cheaply.
+//
+//   lzw_encoder_create   validate params; the output goes to write(context, ...)
+//   lzw_encoder_encode   add input; data is not used after the call returns
+//   lzw_encoder_flush    finish the container, the next input starts a new one
+//
+// Every call returns LZW_OK or a status code. Errors are sticky: once a call
+// fails, later calls return the same status and lzw_encoder_message says
+// what went wrong. create stores the encoder even on failure, so that its
+// message can be read; destroy accepts NULL.
+typedef struct LzwEncoder LzwEncoder;
+
+int lzw_encoder_create(LzwEncoder **encoder, const LzwParams *params, LzwWriteFn write, void *context);
+int lzw_encoder_encode(LzwEncoder *encoder, const void *data, size_t len);
+int lzw_encoder_flush(LzwEncoder *encoder);
+void lzw_encoder_destroy(LzwEncoder *encoder);
+const char *lzw_encoder_message(const LzwEncoder *encoder);
+void lzw_encoder_totals(const LzwEncoder *encoder, LzwTotals *totals);
+
+// Streaming decompressor for any sequence of containers, such as the
+// output of several flushes. finish reports input that stops mid-container.
+typedef struct LzwDecoder LzwDecoder;
+
+int lzw_decoder_create(LzwDecoder **decoder, const LzwParams *params, LzwWriteFn write, void *context);
+int lzw_decoder_decode(LzwDecoder *decoder, const void *data, size_t len);
+int lzw_decoder_finish(LzwDecoder *decoder);
+void lzw_decoder_destroy(LzwDecoder *decoder);
+const char *lzw_decoder_message(const LzwDecoder *decoder);
+void lzw_decoder_totals(const LzwDecoder *decoder, LzwTotals *totals);
+
+// The decoded size of a buffer holding exactly one container, summed from
+// its block index without decoding anything or checking checksums. Returns
+// LZW_ERR_FORMAT for anything else, such as several containers in a row.
+int lzw_decoded_size(const void *data, size_t len, uint64_t *size);
+
+// Whole-file wrappers around the above. Either path may be "-" for stdin or
+// stdout. The output is written strictly front to back, so it never needs
+// to be seekable. They return a status code; totals may be NULL and
+// otherwise also receives the error message.
+int lzw_compress(const char *input_file, const char *output_file, const LzwParams *params, LzwTotals *totals);
+int lzw_decompress(const char *input_file, const char *output_file, const LzwParams *params, LzwTotals *totals);
+
+// Compress input_file as more blocks at the end of archive_file, an existing
+// single-container file of the current format version, and rewrite its
+// index to cover them. The code size and block size come from the file, and
+// params->dictionary must be the one it was compressed with. The blocks
+// already there are left as they are, so the result decodes to the old
+// content followed by the new. If the append fails, the old index is put
+// back; a crash part way through leaves the file without one.
+int lzw_compress_append(const char *input_file, const char *archive_file, const LzwParams *params,
+                        LzwTotals *totals);
+
+// Decode input_file as lzw_decompress would and check every block, index
+// and whole-file checksum, writing nothing. totals->output_bytes counts the
+// bytes that were checked.
+int lzw_verify(const char *input_file, const LzwParams *params, LzwTotals *totals);
+
+// Decode input_file and compare it, as each block is written out, with
+// original_file, which is mapped when params->use_mmap allows. Nothing is
+// written and only the blocks in flight are held in memory. Returns
+// LZW_ERR_MISMATCH, saying where, if the two differ in any byte or length.
+int lzw_test(const char *input_file, const char *original_file, const LzwParams *params, LzwTotals *totals);
+
+// One file of a batch: set the paths, the rest is filled in
+typedef struct {
+    const char *input_file;
+    const char *output_file;    // ignored when writing an archive
+    int status;
+    LzwTotals totals;
+} LzwBatchFile;
+
+// Build a dictionary of at most max_size bytes for symbol_bits symbols from
+// count sample buffers, keeping the stretches whose content recurs most
+// across them. Returns LZW_ERR_FORMAT if the samples are too short to
+// yield anything.
+int lzw_dictionary_train(LzwDictionary **dictionary, const unsigned char *const *samples, const size_t *sizes,
+                         size_t count, size_t max_size, int symbol_bits);
+
+// Read and write dictionary files. load returns LZW_ERR_FORMAT for
+// anything that is not one.
+int lzw_dictionary_load(LzwDictionary **dictionary, const char *path);
+int lzw_dictionary_save(const LzwDictionary *dictionary, const char *path);
+void lzw_dictionary_free(LzwDictionary *dictionary);
+
+uint32_t lzw_dictionary_id(const LzwDictionary *dictionary);
+size_t lzw_dictionary_size(const LzwDictionary *dictionary);
+
+// Compress many files on one pool of params->threads workers. A worker
+// takes a whole file at a time, keeping its encoder from file to file, and
+// the blocks of a file are shared out to workers that run out of files.
+// Separate outputs are started largest input first. With archive_file set,
+// every file instead becomes one container of the archive, in the order
+// given, named by the base name of its input in a member table at the end.
+// lzw_decompress restores their concatenation. Containers that finish early
+// are held in memory until their turn, at most two per worker, and a file
+// only starts once there is room for it. A failed file does not stop the
+// others but is left out of the archive. Two files bound for the same output
+// path or member name fail the whole batch with LZW_ERR_PARAM before any
+// starts. Otherwise returns the first failing status in the order given,
+// with its message in totals, which sums every file.
+int lzw_compress_batch(LzwBatchFile *files, size_t count, const char *archive_file, const LzwParams *params,
+                       LzwTotals *totals);
+
+// One container of an archive from lzw_compress_batch
+typedef struct {
+    const char *name;
+    uint64_t offset;            // of the container in the archive
+    uint64_t length;            // of the container
+    uint64_t size;              // bytes it decodes to
+} LzwMember;
+
+// Read the member table of archive_file, which must be seekable, into one
+// allocation of *count members and their names, to release with free.
+// Returns LZW_ERR_FORMAT if the file has no table or it is damaged.
+int lzw_archive_members(const char *archive_file, LzwMember **members, size_t *count, LzwTotals *totals);
+
+// Decompress only the first member of archive_file called name
+int lzw_decompress_member(const char *archive_file, const char *output_file, const char *name,
+                          const LzwParams *params, LzwTotals *totals);
+
+// Decompress only bytes [offset, offset + length) of the original file. The
+// block index is used to seek straight to the blocks that cover them, so
+// input_file must be seekable.
+int lzw_decompress_range(const char *input_file, const char *output_file,
+                         uint64_t offset, uint64_t length, const LzwParams *params, LzwTotals *totals);
+
+// Decompress only the array named key from a compressed npz_to_bin.py file
+int lzw_decompress_key(const char *input_file, const char *output_file,
+                       const char *key, const LzwParams *params, LzwTotals *totals);
 
 #endif
@@ -0,0 +1,375 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "lzw.h"
+#include "lzw_io.h"
+#include "lzw_binfile.h"
+
+// One input of the corpus, held in memory so that only the codec is timed
+typedef struct {
+    const char *name;
+    unsigned char *data;
+    size_t size;
+    int bin_layout;             // parses as an npz_to_bin.py file
+} BenchInput;
+
+// Timings of one phase over the measured repetitions
+typedef struct {
+    double best;
+    double total;
+} PhaseTimes;
+
+typedef struct {
+    size_t compressed_size;
+    PhaseTimes compress;
+    PhaseTimes decompress;
+} BenchResult;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// High-water mark of the whole process, which includes the corpus itself.
+// It never goes down, so it only means something for the run as a whole.
+static long peak_rss_kib(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void phase_add(PhaseTimes *phase, double seconds) {
+    if (phase->total == 0 || seconds < phase->best) {
+        phase->best = seconds;
+    }
+    phase->total += seconds;
+}
+
+// Collects the codec's output in an in-memory writer
+static int write_memory(void *context, const void *data, size_t len) {
+    LzwWriter *out = context;
+    lzw_writer_write(out, data, len);
+    return out->failed;
+}
+
+static int read_file(const char *path, BenchInput *input) {
+    LzwReader in;
+    LzwWriter data;
+    if (lzw_reader_open_path(&in, path, LZW_IO_BUFFER_SIZE, 0) != 0) {
+        return -1;
+    }
+    if (lzw_writer_open_memory(&data, LZW_IO_BUFFER_SIZE) != 0) {
+        lzw_reader_close(&in);
+        return -1;
+    }
+    while (lzw_reader_fill(&in) > 0) {
+        lzw_writer_write(&data, in.buffer + in.pos, in.len - in.pos);
+        in.pos = in.len;
+    }
+    int failed = in.failed || data.failed;
+    lzw_reader_close(&in);
+    if (failed) {
+        lzw_writer_close(&data);
+        return -1;
+    }
+
+    LzwBinFile bin;
+    input->name = path;
+    input->data = data.buffer;
+    input->size = data.len;
+    input->bin_layout = lzw_binfile_parse(data.buffer, data.len, &bin) == 0 && bin.total_size == data.len;
+    if (input->bin_layout) {
+        lzw_binfile_free(&bin);
+    }
+    return 0;
+}
+
+// Synthetic rasters of u16 samples, 1024 to a row: all zero, white noise,
+// and a smooth gradient with a little noise like real reflectance data
+static int make_synthetic(const char *kind, size_t size, BenchInput *input) {
+    unsigned char *data = malloc(size);
+    if (data == NULL) {
+        return -1;
+    }
+    uint32_t state = 2463534242u;
+    for (size_t i = 0; i + 1 < size; i += 2) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        size_t x = i / 2 % 1024, y = i / 2 / 1024;
+        uint16_t value = 0;
+        if (strcmp(kind, "random") == 0) {
+            value = (uint16_t)state;
+        } else if (strcmp(kind, "gradient") == 0) {
+            value = (uint16_t)(1000 + x + y % 4096 + (state & 7));
+        }
+        data[i] = (unsigned char)value;
+        data[i + 1] = (unsigned char)(value >> 8);
+    }
+    if (size % 2 != 0) {
+        data[size - 1] = 0;
+    }
+    input->name = kind;
+    input->data = data;
+    input->size = size;
+    input->bin_layout = 0;
+    return 0;
+}
+
+static int compress_once(const LzwParams *params, const BenchInput *input, LzwWriter *out) {
+    LzwEncoder *encoder;
+    out->len = 0;
+    int status = lzw_encoder_create(&encoder, params, write_memory, out);
+    if (status == LZW_OK) {
+        status = lzw_encoder_encode(encoder, input->data, input->size);
+    }
+    if (status == LZW_OK) {
+        status = lzw_encoder_flush(encoder);
+    }
+    if (status != LZW_OK) {
+        fprintf(stderr, "Error: %s: %s\n", input->name, lzw_encoder_message(encoder));
+    }
+    lzw_encoder_destroy(encoder);
+    return status;
+}
+
+static int decompress_once(const LzwParams *params, const BenchInput *input, const LzwWriter *compressed,
+                           LzwWriter *out) {
+    LzwDecoder *decoder;
+    out->len = 0;
+    int status = lzw_decoder_create(&decoder, params, write_memory, out);
+    if (status == LZW_OK) {
+        status = lzw_decoder_decode(decoder, compressed->buffer, compressed->len);
+    }
+    if (status == LZW_OK) {
+        status = lzw_decoder_finish(decoder);
+    }
+    if (status != LZW_OK) {
+        fprintf(stderr, "Error: %s: %s\n", input->name, lzw_decoder_message(decoder));
+    }
+    lzw_decoder_destroy(decoder);
+    return status;
+}
+
+// Run warmup untimed rounds and then repeat timed ones, checking that every
+// round trip gives the input back
+static int bench_input(const LzwParams *base, const BenchInput *input, int warmup, int repeat,
+                       BenchResult *result) {
+    LzwParams params = *base;
+    params.bin_layout = input->bin_layout;
+
+    LzwWriter compressed, decompressed;
+    if (lzw_writer_open_memory(&compressed, LZW_IO_BUFFER_SIZE) != 0) {
+        return -1;
+    }
+    if (lzw_writer_open_memory(&decompressed, LZW_IO_BUFFER_SIZE) != 0) {
+        lzw_writer_close(&compressed);
+        return -1;
+    }
+
+    memset(result, 0, sizeof(*result));
+    int status = 0;
+    for (int round = 0; round < warmup + repeat && status == 0; round++) {
+        double start = now_seconds();
+        if (compress_once(&params, input, &compressed) != LZW_OK) {
+            status = -1;
+            break;
+        }
+        double middle = now_seconds();
+        if (decompress_once(&params, input, &compressed, &decompressed) != LZW_OK) {
+            status = -1;
+            break;
+        }
+        double end = now_seconds();
+
+        if (compressed.failed || decompressed.failed) {
+            fprintf(stderr, "Error: %s: Memory allocation failed.\n", input->name);
+            status = -1;
+        } else if (decompressed.len != input->size || memcmp(decompressed.buffer, input->data, input->size) != 0) {
+            fprintf(stderr, "Error: %s: Round trip does not match the input.\n", input->name);
+            status = -1;
+        } else if (round >= warmup) {
+            phase_add(&result->compress, middle - start);
+            phase_add(&result->decompress, end - middle);
+        }
+    }
+    result->compressed_size = compressed.len;
+
+    lzw_writer_close(&compressed);
+    lzw_writer_close(&decompressed);
+    return status;
+}
+
+static double mb_per_second(size_t size, double seconds) {
+    return seconds > 0 ? (double)size / 1e6 / seconds : 0;
+}
+
+static void print_phase_json(FILE *out, const char *name, const PhaseTimes *phase, int repeat, size_t size) {
+    fprintf(out, "\"%s\": {\"best_s\": %.6f, \"mean_s\": %.6f, \"mb_per_s\": %.2f}", name, phase->best,
+            phase->total / repeat, mb_per_second(size, phase->best));
+}
+
+// Every measurement as one JSON document, for comparing runs
+static void write_json(FILE *out, const LzwParams *params, int warmup, int repeat, const BenchInput *inputs,
+                       const BenchResult *results, int count, long run_peak_rss_kib) {
+    fprintf(out, "{\n  \"params\": {\"max_code_bits\": %d, \"block_size\": %zu, \"threads\": %d, "
+            "\"symbol_bits\": %d, \"entropy\": %d, \"growth\": %d, \"warmup\": %d, \"repeat\": %d},\n"
+            "  \"run_peak_rss_kib\": %ld,\n"
+            "  \"results\": [\n",
+            params->max_code_bits, params->block_size, params->threads, params->symbol_bits, params->entropy,
+            params->growth, warmup, repeat, run_peak_rss_kib);
+    for (int i = 0; i < count; i++) {
+        const BenchResult *r = &results[i];
+        fprintf(out, "    {\"input\": \"");
+        // Paths are written as given, escaping only what JSON requires
+        for (const char *c = inputs[i].name; *c != '\0'; c++) {
+            if (*c == '"' || *c == '\\') {
+                fputc('\\', out);
+            }
+            fputc(*c, out);
+        }
+        fprintf(out, "\", \"bytes\": %zu, \"compressed_bytes\": %zu, \"ratio\": %.4f, ",
+                inputs[i].size, r->compressed_size,
+                inputs[i].size > 0 ? (double)r->compressed_size / (double)inputs[i].size : 0);
+        print_phase_json(out, "compress", &r->compress, repeat, inputs[i].size);
+        fprintf(out, ", ");
+        print_phase_json(out, "decompress", &r->decompress, repeat, inputs[i].size);
+        fprintf(out, "}%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char *argv[]) {
+    LzwParams params;
+    lzw_params_init(&params);
+    int have_bits = 0;
+    int level = 0;
+    int warmup = 1, repeat = 5;
+    size_t synthetic_size = 16 << 20;
+    const char *json_file = NULL;
+
+    // Parse options
+    int arg = 1;
+    while (arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0') {
+        if (strcmp(argv[arg], "-d") == 0 && arg + 1 < argc) {
+            params.max_code_bits = atoi(argv[arg + 1]);
+            have_bits = 1;
+            arg += 2;
+        } else if (strcmp(argv[arg], "-l") == 0 && arg + 1 < argc) {
+            level = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+            params.block_size = (size_t)atoi(argv[arg + 1]) << 10;
+            arg += 2;
+        } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            params.threads = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--symbol-bits") == 0 && arg + 1 < argc) {
+            params.symbol_bits = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) {
+            repeat = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-w") == 0 && arg + 1 < argc) {
+            warmup = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) {
+            synthetic_size = (size_t)atoi(argv[arg + 1]) << 20;
+            arg += 2;
+        } else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) {
+            json_file = argv[arg + 1];
+            arg += 2;
+        } else {
+            break;
+        }
+    }
+
+    if ((arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0') || repeat < 1 || warmup < 0 || level < 0 ||
+        level > 2) {
+        printf("Usage: %s [-l level] [-d dict_bits] [-s block_kib] [-j threads] [--symbol-bits 8|16] [-r repeat] [-w warmup] [-n synthetic_mib] [-o results.json] [input_file...]\n", argv[0]);
+        printf("  Times compression and decompression of each input file and of synthetic\n");
+        printf("  constant, random and gradient rasters, all held in memory.\n");
+        printf("  -l, -d, -s, -j and --symbol-bits are as for imageCompression; npz_to_bin.py\n");
+        printf("  files are found by their header and coded with --bin.\n");
+        printf("  -r repeat      timed round trips per input (default 5)\n");
+        printf("  -w warmup      untimed round trips first (default 1)\n");
+        printf("  -n synthetic_mib\n");
+        printf("                 size of each synthetic input, 0 to skip them (default 16)\n");
+        printf("  -o file        also write the results as JSON, - for stdout\n");
+        return 1;
+    }
+
+    if (params.symbol_bits == 16 && !have_bits) {
+        params.max_code_bits = LZW_DEFAULT_CODE_BITS_16;
+    }
+    if (level >= 1) {
+        params.entropy = LZW_ENTROPY_HUFFMAN;
+    }
+    if (level >= 2) {
+        params.growth = LZW_GROWTH_AUTO;
+    }
+
+    // Build the corpus: the named files, then the synthetic inputs
+    static const char *synthetic[] = {"constant", "random", "gradient"};
+    int count = 0;
+    int capacity = argc - arg + 3;
+    BenchInput *inputs = calloc((size_t)capacity, sizeof(BenchInput));
+    BenchResult *results = calloc((size_t)capacity, sizeof(BenchResult));
+    if (inputs == NULL || results == NULL) {
+        fprintf(stderr, "Error: Memory allocation failed.\n");
+        return 1;
+    }
+    for (; arg < argc; arg++) {
+        if (read_file(argv[arg], &inputs[count]) != 0) {
+            fprintf(stderr, "Error: Cannot read %s.\n", argv[arg]);
+            return 1;
+        }
+        count++;
+    }
+    for (int i = 0; i < 3 && synthetic_size > 0; i++) {
+        if (make_synthetic(synthetic[i], synthetic_size, &inputs[count]) != 0) {
+            fprintf(stderr, "Error: Memory allocation failed.\n");
+            return 1;
+        }
+        count++;
+    }
+
+    FILE *report = json_file != NULL && strcmp(json_file, "-") == 0 ? stderr : stdout;
+    fprintf(report, "%-32s %12s %12s %7s %12s %12s\n", "input", "bytes", "compressed", "ratio",
+            "comp MB/s", "decomp MB/s");
+    for (int i = 0; i < count; i++) {
+        if (bench_input(&params, &inputs[i], warmup, repeat, &results[i]) != 0) {
+            return 1;
+        }
+        const BenchResult *r = &results[i];
+        fprintf(report, "%-32s %12zu %12zu %6.2f%% %12.1f %12.1f\n", inputs[i].name, inputs[i].size,
+                r->compressed_size, inputs[i].size > 0 ? 100.0 * (double)r->compressed_size / (double)inputs[i].size : 0,
+                mb_per_second(inputs[i].size, r->compress.best), mb_per_second(inputs[i].size, r->decompress.best));
+    }
+    long run_peak_rss_kib = peak_rss_kib();
+    fprintf(report, "Peak RSS of the run: %ld KiB\n", run_peak_rss_kib);
+
+    if (json_file != NULL) {
+        FILE *out = lzw_open_output(json_file);
+        if (out == NULL) {
+            fprintf(stderr, "Error: Cannot open %s.\n", json_file);
+            return 1;
+        }
+        write_json(out, &params, warmup, repeat, inputs, results, count, run_peak_rss_kib);
+        if (lzw_close_output(out) != 0) {
+            fprintf(stderr, "Error: Cannot write %s.\n", json_file);
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(inputs[i].data);
+    }
+    free(inputs);
+    free(results);
+    return 0;
+}
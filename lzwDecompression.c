@@ -2,153 +2,168 @@
 #include <stdlib.h>
 #include <string.h>
 #include "lzw.h"
+#include "lzw_io.h"
+#include "lzw_report.h"
 
-typedef struct {
-    int code;
-    char *value;
-} DictEntry;
-
-// Decompression function
-void lzw_decompress(const char *input_file, const char *output_file) {
-    FILE *input = fopen(input_file, "rb");
-    FILE *output = fopen(output_file, "wb");
-    if (!input || !output) {
-        fprintf(stderr, "Error opening files.\n");
-        exit(1);
-    }
-
-    // Read the dictionary size from the start of the file
-    int dict_size;
-    if (fread(&dict_size, sizeof(int), 1, input) != 1) {
-        fprintf(stderr, "Error reading dictionary size.\n");
-        fclose(input);
-        fclose(output);
-        exit(1);
-    }
-
-    // Validate the dictionary size
-    if (dict_size <= 0 || dict_size > MAX_DICT_SIZE) {
-        fprintf(stderr, "Invalid dictionary size: %d\n", dict_size);
-        fclose(input);
-        fclose(output);
-        exit(1);
-    }
-
-    // Initialize the dictionary based on the read dictionary size
-    DictEntry dictionary[MAX_DICT_SIZE];
-    for (int i = 0; i < dict_size; i++) {
-        dictionary[i].code = i;
-        dictionary[i].value = malloc(2);
-        if (dictionary[i].value == NULL) {
-            fprintf(stderr, "Memory allocation failed for dictionary[%d].value\n", i);
-            fclose(input);
-            fclose(output);
-            exit(1);
+// Main function
+int main(int argc, char *argv[]) {
+    LzwParams params;
+    lzw_params_init(&params);
+    const char *key = NULL;
+    const char *member = NULL;
+    int list = 0;
+    int have_range = 0;
+    unsigned long long range_offset = 0, range_length = 0;
+    LzwReportOptions report_options = {0, 0};
+    const char *dictionary_file = NULL;
+    int verify = 0;
+    const char *original_file = NULL;
+
+    // Parse options
+    int arg = 1;
+    while (arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0') {
+        if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc) {
+            params.io_buffer_size = (size_t)atoi(argv[arg + 1]) << 20;
+            arg += 2;
+        } else if (strcmp(argv[arg], "-j") == 0 && arg + 1 < argc) {
+            params.threads = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--max-inflight") == 0 && arg + 1 < argc) {
+            params.max_inflight = atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--key") == 0 && arg + 1 < argc) {
+            key = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "--member") == 0 && arg + 1 < argc) {
+            member = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "--list") == 0) {
+            list = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--range") == 0 && arg + 1 < argc) {
+            char *end;
+            range_offset = strtoull(argv[arg + 1], &end, 0);
+            if (*end != ':') {
+                fprintf(stderr, "Invalid range: %s (expected OFFSET:LENGTH).\n", argv[arg + 1]);
+                return 1;
+            }
+            range_length = strtoull(end + 1, &end, 0);
+            if (*end != '\0') {
+                fprintf(stderr, "Invalid range: %s (expected OFFSET:LENGTH).\n", argv[arg + 1]);
+                return 1;
+            }
+            have_range = 1;
+            arg += 2;
+        } else if (strcmp(argv[arg], "-D") == 0 && arg + 1 < argc) {
+            dictionary_file = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "--test") == 0 && arg + 1 < argc) {
+            original_file = argv[arg + 1];
+            arg += 2;
+        } else if (strcmp(argv[arg], "--verify") == 0) {
+            verify = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--no-mmap") == 0) {
+            params.use_mmap = 0;
+            arg++;
+        } else if (strcmp(argv[arg], "--stats") == 0) {
+            report_options.stats = 1;
+            arg++;
+        } else if (strcmp(argv[arg], "--json") == 0) {
+            report_options.json = 1;
+            arg++;
+        } else {
+            break;
         }
-        dictionary[i].value[0] = (char)i;
-        dictionary[i].value[1] = '\0';
     }
 
-    int prev_code, curr_code;
-    char *sequence, *new_entry;
-
-    // Read the first code and output its value
-    if (fread(&prev_code, sizeof(int), 1, input) != 1) {
-        fprintf(stderr, "Error reading the first code.\n");
-        fclose(input);
-        fclose(output);
-        for (int i = 0; i < dict_size; i++) {
-            free(dictionary[i].value);
-        }
-        exit(1);
+    int checking = verify || original_file != NULL || list;
+    int selections = (key != NULL) + have_range + (member != NULL);
+    if (argc - arg != 2 - checking || selections > 1 || (checking && selections > 0) ||
+        verify + (original_file != NULL) + list > 1) {
+        printf("Usage: %s [-b buffer_mib] [-j threads] [--max-inflight blocks] [--key name | --range offset:length | --member name] [-D dict_file] [--no-mmap] [--stats] [--json] <input_compressed_file> <output_decompressed_file>\n", argv[0]);
+        printf("       %s [options] --verify | --test original_file <input_compressed_file>\n", argv[0]);
+        printf("       %s --list <archive_file>\n", argv[0]);
+        printf("  Either file may be - for stdin or stdout; --key, --range, --member and --list\n");
+        printf("  need a seekable input.\n");
+        printf("  -b buffer_mib  I/O buffer size in MiB (default %d)\n", LZW_IO_BUFFER_SIZE >> 20);
+        printf("  -j threads     decode blocks on this many threads, 0 for all processors (default 1)\n");
+        printf("  --max-inflight blocks\n");
+        printf("                 most blocks decoded ahead of the writer (default 2 per thread)\n");
+        printf("  --key name     extract only this array of an npz_to_bin.py file\n");
+        printf("  --range offset:length\n");
+        printf("                 extract only these bytes of the original file\n");
+        printf("  --member name  extract only this file of an imageCompression --archive\n");
+        printf("  --list         list the files of an archive: original size, compressed size\n");
+        printf("                 and name\n");
+        printf("  -D dict_file   the dictionary the input was compressed with\n");
+        printf("  --verify       decode everything and check its checksums, writing nothing\n");
+        printf("  --test original_file\n");
+        printf("                 also compare the decoded data with the original, writing nothing\n");
+        printf("  --no-mmap      read regular files through the buffer instead of mapping them\n");
+        printf("  --stats        also report sizes and dictionary, phrase and timing counters\n");
+        printf("  --json         report sizes and counters as one JSON object\n");
+        return 1;
     }
-    fwrite(dictionary[prev_code].value, 1, strlen(dictionary[prev_code].value), output);
 
-    // Begin decompression
-    while (fread(&curr_code, sizeof(int), 1, input) == 1) {
-        if (curr_code < dict_size) {
-            // Sequence exists in the dictionary
-            sequence = dictionary[curr_code].value;
-        } else if (curr_code == dict_size) {
-            // Special case: curr_code is not in the dictionary yet
-            if (prev_code < dict_size) {
-                sequence = malloc(strlen(dictionary[prev_code].value) + 2);
-                if (sequence == NULL) {
-                    fprintf(stderr, "Memory allocation failed for sequence.\n");
-                    fclose(input);
-                    fclose(output);
-                    for (int i = 0; i < dict_size; i++) {
-                        free(dictionary[i].value);
-                    }
-                    exit(1);
-                }
-                strcpy(sequence, dictionary[prev_code].value);
-                sequence[strlen(dictionary[prev_code].value)] = dictionary[prev_code].value[0];
-                sequence[strlen(dictionary[prev_code].value) + 1] = '\0';
-            } else {
-                fprintf(stderr, "Error: prev_code out of bounds.\n");
-                fclose(input);
-                fclose(output);
-                for (int i = 0; i < dict_size; i++) {
-                    free(dictionary[i].value);
-                }
-                exit(1);
-            }
-        } else {
-            fprintf(stderr, "Error: Invalid code encountered. curr_code: %d, dict_size: %d\n", curr_code, dict_size);
-            fclose(input);
-            fclose(output);
-            for (int i = 0; i < dict_size; i++) {
-                free(dictionary[i].value);
-            }
-            exit(1);
+    if (list) {
+        LzwMember *members;
+        size_t count;
+        LzwTotals totals;
+        if (lzw_archive_members(argv[arg], &members, &count, &totals) != LZW_OK) {
+            fprintf(stderr, "Error: %s\n", totals.message);
+            return 1;
         }
-
-        // Output the sequence
-        fwrite(sequence, 1, strlen(sequence), output);
-
-        // Add new sequence to the dictionary
-        if (dict_size < MAX_DICT_SIZE) {
-            new_entry = malloc(strlen(dictionary[prev_code].value) + 2);
-            if (new_entry == NULL) {
-                fprintf(stderr, "Memory allocation failed for new_entry.\n");
-                fclose(input);
-                fclose(output);
-                for (int i = 0; i < dict_size; i++) {
-                    free(dictionary[i].value);
-                }
-                exit(1);
-            }
-            strcpy(new_entry, dictionary[prev_code].value);
-            new_entry[strlen(dictionary[prev_code].value)] = sequence[0];
-            new_entry[strlen(dictionary[prev_code].value) + 1] = '\0';
-
-            dictionary[dict_size].code = dict_size;
-            dictionary[dict_size].value = new_entry;
-            dict_size++;
+        for (size_t i = 0; i < count; i++) {
+            printf("%12llu %12llu  %s\n", (unsigned long long)members[i].size,
+                   (unsigned long long)members[i].length, members[i].name);
         }
-
-        prev_code = curr_code;
+        free(members);
+        return 0;
     }
 
-    // Cleanup
-    for (int i = 0; i < dict_size; i++) {
-        free(dictionary[i].value);
+    LzwDictionary *dictionary = NULL;
+    if (dictionary_file != NULL && (dictionary = lzw_report_load_dictionary(dictionary_file)) == NULL) {
+        return 1;
     }
-    fclose(input);
-    fclose(output);
-
-    printf("Decompression complete.\n");
-}
-
-// Main function
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        printf("Usage: %s <input_compressed_file> <output_decompressed_file>\n", argv[0]);
+    params.dictionary = dictionary;
+
+    LzwTotals totals;
+    int status;
+    if (verify) {
+        status = lzw_verify(argv[arg], &params, &totals);
+    } else if (original_file != NULL) {
+        status = lzw_test(argv[arg], original_file, &params, &totals);
+    } else if (key != NULL) {
+        status = lzw_decompress_key(argv[arg], argv[arg + 1], key, &params, &totals);
+    } else if (member != NULL) {
+        status = lzw_decompress_member(argv[arg], argv[arg + 1], member, &params, &totals);
+    } else if (have_range) {
+        status = lzw_decompress_range(argv[arg], argv[arg + 1], range_offset, range_length, &params, &totals);
+    } else {
+        status = lzw_decompress(argv[arg], argv[arg + 1], &params, &totals);
+    }
+    lzw_dictionary_free(dictionary);
+    if (status != LZW_OK) {
+        fprintf(stderr, "Error: %s\n", totals.message);
         return 1;
     }
 
-    lzw_decompress(argv[1], argv[2]);
-
+    FILE *report = checking ? stdout : lzw_message_stream(argv[arg + 1]);
+    if (!report_options.json) {
+        if (verify) {
+            fprintf(report, "Verified %s: %llu bytes, every checksum matches.\n", argv[arg],
+                    (unsigned long long)totals.output_bytes);
+        } else if (original_file != NULL) {
+            fprintf(report, "Tested %s: %llu bytes, identical to %s.\n", argv[arg],
+                    (unsigned long long)totals.output_bytes, original_file);
+        } else {
+            fprintf(report, "Decompression complete.\n");
+        }
+    }
+    if (report_options.stats || report_options.json) {
+        const char *operation = verify ? "verify" : original_file != NULL ? "test" : "decompress";
+        lzw_report(report, operation, totals.output_bytes, totals.input_bytes, &totals, &report_options);
+    }
     return 0;
 }
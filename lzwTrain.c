@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lzw.h"
+#include "lzw_io.h"
+
+#define DEFAULT_DICT_KIB 16
+
+// Read a whole sample into memory. Returns -1 if it cannot be read.
+static int read_file(const char *path, unsigned char **data, size_t *size) {
+    LzwReader in;
+    LzwWriter out;
+    if (lzw_reader_open_path(&in, path, LZW_IO_BUFFER_SIZE, 0) != 0) {
+        return -1;
+    }
+    if (lzw_writer_open_memory(&out, LZW_IO_BUFFER_SIZE) != 0) {
+        lzw_reader_close(&in);
+        return -1;
+    }
+    while (lzw_reader_fill(&in) > 0) {
+        lzw_writer_write(&out, in.buffer + in.pos, in.len - in.pos);
+        in.pos = in.len;
+    }
+    int failed = in.failed || out.failed;
+    lzw_reader_close(&in);
+    if (failed) {
+        lzw_writer_close(&out);
+        return -1;
+    }
+    *data = out.buffer;
+    *size = out.len;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    size_t dict_kib = DEFAULT_DICT_KIB;
+    int symbol_bits = 8;
+
+    // Parse options
+    int arg = 1;
+    while (arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0') {
+        if (strcmp(argv[arg], "-k") == 0 && arg + 1 < argc) {
+            dict_kib = (size_t)atoi(argv[arg + 1]);
+            arg += 2;
+        } else if (strcmp(argv[arg], "--symbol-bits") == 0 && arg + 1 < argc) {
+            symbol_bits = atoi(argv[arg + 1]);
+            arg += 2;
+        } else {
+            break;
+        }
+    }
+
+    if (argc - arg < 2 || dict_kib == 0 || dict_kib > LZW_MAX_DICTIONARY_BYTES >> 10 ||
+        (symbol_bits != 8 && symbol_bits != 16)) {
+        printf("Usage: %s [-k dict_kib] [--symbol-bits 8|16] <dictionary_file> <sample_file>...\n", argv[0]);
+        printf("  Build a dictionary for imageCompression -D from samples of typical input,\n");
+        printf("  such as a few of the tiles it is meant for.\n");
+        printf("  -k dict_kib    dictionary size in KiB (1-%d, default %d)\n", LZW_MAX_DICTIONARY_BYTES >> 10,
+               DEFAULT_DICT_KIB);
+        printf("  --symbol-bits n\n");
+        printf("                 symbol width of the inputs it will compress (default 8)\n");
+        return 1;
+    }
+
+    const char *dictionary_file = argv[arg];
+    size_t count = (size_t)(argc - arg - 1);
+    unsigned char **samples = calloc(count, sizeof(unsigned char *));
+    size_t *sizes = calloc(count, sizeof(size_t));
+    if (samples == NULL || sizes == NULL) {
+        fprintf(stderr, "Error: %s\n", lzw_strerror(LZW_ERR_MEMORY));
+        return 1;
+    }
+    uint64_t total = 0;
+    int status = LZW_OK;
+    for (size_t i = 0; i < count && status == LZW_OK; i++) {
+        if (read_file(argv[arg + 1 + i], &samples[i], &sizes[i]) != 0) {
+            fprintf(stderr, "Error: Cannot read %s.\n", argv[arg + 1 + i]);
+            status = LZW_ERR_IO;
+        }
+        total += sizes[i];
+    }
+
+    LzwDictionary *dictionary = NULL;
+    if (status == LZW_OK) {
+        status = lzw_dictionary_train(&dictionary, (const unsigned char *const *)samples, sizes, count,
+                                      dict_kib << 10, symbol_bits);
+        if (status == LZW_ERR_FORMAT) {
+            fprintf(stderr, "Error: The samples are too short to train on.\n");
+        } else if (status != LZW_OK) {
+            fprintf(stderr, "Error: %s\n", lzw_strerror(status));
+        }
+    }
+    if (status == LZW_OK && (status = lzw_dictionary_save(dictionary, dictionary_file)) != LZW_OK) {
+        fprintf(stderr, "Error: Cannot write %s.\n", dictionary_file);
+    }
+    if (status == LZW_OK) {
+        printf("Dictionary %08x: %zu bytes from %zu samples of %llu bytes\n", lzw_dictionary_id(dictionary),
+               lzw_dictionary_size(dictionary), count, (unsigned long long)total);
+    }
+
+    lzw_dictionary_free(dictionary);
+    for (size_t i = 0; i < count; i++) {
+        free(samples[i]);
+    }
+    free(samples);
+    free(sizes);
+    return status == LZW_OK ? 0 : 1;
+}
@@ -0,0 +1,97 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "lzw_arena.h"
+
+struct LzwArenaChunk {
+    LzwArenaChunk *next;
+};
+
+static size_t align_up(size_t n) {
+    return (n + LZW_ARENA_ALIGN - 1) & ~(size_t)(LZW_ARENA_ALIGN - 1);
+}
+
+// malloc only promises alignment for standard types, so over-allocate and
+// align by hand; the pointer malloc returned is kept just in front
+static void *aligned_alloc_block(size_t size) {
+    unsigned char *raw = malloc(size + LZW_ARENA_ALIGN + sizeof(void *));
+    if (raw == NULL) {
+        return NULL;
+    }
+    uintptr_t p = ((uintptr_t)(raw + sizeof(void *)) + LZW_ARENA_ALIGN - 1) & ~(uintptr_t)(LZW_ARENA_ALIGN - 1);
+    ((void **)p)[-1] = raw;
+    return (void *)p;
+}
+
+static void aligned_free_block(void *p) {
+    if (p != NULL) {
+        free(((void **)p)[-1]);
+    }
+}
+
+int lzw_arena_init(LzwArena *arena, size_t capacity) {
+    arena->capacity = align_up(capacity);
+    arena->base = arena->capacity > 0 ? aligned_alloc_block(arena->capacity) : NULL;
+    arena->used = 0;
+    arena->overflow = NULL;
+    arena->overflow_size = 0;
+    if (arena->capacity > 0 && arena->base == NULL) {
+        arena->capacity = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static void free_overflow(LzwArena *arena) {
+    while (arena->overflow != NULL) {
+        LzwArenaChunk *next = arena->overflow->next;
+        aligned_free_block(arena->overflow);
+        arena->overflow = next;
+    }
+}
+
+void lzw_arena_free(LzwArena *arena) {
+    free_overflow(arena);
+    aligned_free_block(arena->base);
+    arena->base = NULL;
+    arena->capacity = 0;
+    arena->used = 0;
+    arena->overflow_size = 0;
+}
+
+void *lzw_arena_alloc(LzwArena *arena, size_t size) {
+    size = align_up(size);
+    if (size <= arena->capacity - arena->used) {
+        void *p = arena->base + arena->used;
+        arena->used += size;
+        return p;
+    }
+
+    // The chunk header takes one aligned unit in front of the allocation
+    unsigned char *chunk = aligned_alloc_block(LZW_ARENA_ALIGN + size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    ((LzwArenaChunk *)chunk)->next = arena->overflow;
+    arena->overflow = (LzwArenaChunk *)chunk;
+    arena->overflow_size += size;
+    return chunk + LZW_ARENA_ALIGN;
+}
+
+void lzw_arena_reset(LzwArena *arena) {
+    arena->used = 0;
+    if (arena->overflow == NULL) {
+        return;
+    }
+
+    // Grow to the peak just seen so the same allocations fit next time. If
+    // that fails the old buffer stays and overflow chunks are used again.
+    size_t capacity = arena->capacity + arena->overflow_size;
+    free_overflow(arena);
+    arena->overflow_size = 0;
+    unsigned char *base = aligned_alloc_block(capacity);
+    if (base != NULL) {
+        aligned_free_block(arena->base);
+        arena->base = base;
+        arena->capacity = capacity;
+    }
+}
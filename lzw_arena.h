@@ -0,0 +1,37 @@
+#ifndef LZW_ARENA_H
+#define LZW_ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator owning the dictionary memory of one worker. Allocations are
+// carved out of a single buffer and released all at once by rewinding, so
+// switching a worker between dictionary layouts costs no malloc or free.
+//
+// An allocation that does not fit still succeeds, from a separate overflow
+// chunk. The next reset frees the overflow and grows the buffer to cover
+// it, so after the first few blocks every allocation is a pointer bump.
+
+#define LZW_ARENA_ALIGN 64      // a cache line, so tables never share one
+
+typedef struct LzwArenaChunk LzwArenaChunk;
+
+typedef struct {
+    unsigned char *base;
+    size_t capacity;
+    size_t used;
+    LzwArenaChunk *overflow;    // allocations made since the buffer filled
+    size_t overflow_size;       // bytes the buffer lacked for them
+} LzwArena;
+
+// Reserve capacity bytes up front. Returns -1 if they cannot be allocated;
+// a zero-filled LzwArena is also a valid empty arena.
+int lzw_arena_init(LzwArena *arena, size_t capacity);
+void lzw_arena_free(LzwArena *arena);
+
+// size bytes aligned to LZW_ARENA_ALIGN, or NULL if memory runs out
+void *lzw_arena_alloc(LzwArena *arena, size_t size);
+
+// Release every allocation at once, keeping the memory for the next ones
+void lzw_arena_reset(LzwArena *arena);
+
+#endif
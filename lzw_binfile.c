@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lzw_binfile.h"
+#include "lzw_container.h"
+
+// Anything larger is taken as a corrupt length rather than allocated
+#define MAX_NAME_LENGTH 4096
+#define MAX_KEYS (1 << 20)
+
+size_t lzw_dtype_size(const char *dtype) {
+    // Byte order and kind prefixes such as "<U5" or "|S3"
+    if (*dtype == '<' || *dtype == '>' || *dtype == '|' || *dtype == '=') {
+        dtype++;
+    }
+    if (strcmp(dtype, "bool") == 0) {
+        return 1;
+    }
+    if ((dtype[0] == 'S' || dtype[0] == 'U') && dtype[1] >= '0' && dtype[1] <= '9') {
+        size_t n = strtoul(dtype + 1, NULL, 10);
+        return dtype[0] == 'U' ? 4 * n : n;
+    }
+
+    // Named types end in their width in bits: int8, uint16, float32, complex64
+    static const char *const kinds[] = {"uint", "int", "float", "complex"};
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        size_t n = strlen(kinds[i]);
+        if (strncmp(dtype, kinds[i], n) == 0) {
+            char *end;
+            unsigned long bits = strtoul(dtype + n, &end, 10);
+            if (*end != '\0' || bits == 0 || bits % 8 != 0) {
+                return 0;
+            }
+            return bits / 8;
+        }
+    }
+    return 0;
+}
+
+int lzw_dtype_is_integer(const char *dtype) {
+    if (*dtype == '<' || *dtype == '>' || *dtype == '|' || *dtype == '=') {
+        dtype++;
+    }
+    return strcmp(dtype, "bool") == 0 || strncmp(dtype, "int", 3) == 0 || strncmp(dtype, "uint", 4) == 0;
+}
+
+// Copy a length-prefixed string at *pos, returning 1 if it runs past len and
+// -2 if it cannot be allocated
+static int read_string(const unsigned char *data, size_t len, size_t *pos, char **out) {
+    if (len - *pos < 4) {
+        return 1;
+    }
+    uint32_t n = lzw_get_u32(data + *pos);
+    if (n > MAX_NAME_LENGTH) {
+        return -1;
+    }
+    if (len - *pos - 4 < n) {
+        return 1;
+    }
+    *out = malloc((size_t)n + 1);
+    if (*out == NULL) {
+        return -2;
+    }
+    memcpy(*out, data + *pos + 4, n);
+    (*out)[n] = '\0';
+    *pos += 4 + (size_t)n;
+    return 0;
+}
+
+static int parse_array(const unsigned char *data, size_t len, size_t *pos, LzwBinArray *array) {
+    int status = read_string(data, len, pos, &array->name);
+    if (status != 0) {
+        return status;
+    }
+
+    if (len - *pos < 4) {
+        return 1;
+    }
+    uint32_t ndim = lzw_get_u32(data + *pos);
+    if (ndim > LZW_BIN_MAX_DIMS) {
+        return -1;
+    }
+    if ((len - *pos - 4) / 4 < ndim) {
+        return 1;
+    }
+    array->ndim = (int)ndim;
+    *pos += 4;
+    for (uint32_t i = 0; i < ndim; i++) {
+        array->shape[i] = lzw_get_u32(data + *pos);
+        *pos += 4;
+    }
+
+    status = read_string(data, len, pos, &array->dtype);
+    if (status != 0) {
+        return status;
+    }
+    array->item_size = lzw_dtype_size(array->dtype);
+    if (array->item_size == 0) {
+        return -1;
+    }
+
+    // A 0-d array still holds one element
+    uint64_t size = array->item_size;
+    for (int i = 0; i < array->ndim; i++) {
+        if (array->shape[i] != 0 && size > UINT64_MAX / array->shape[i]) {
+            return -1;
+        }
+        size *= array->shape[i];
+    }
+    array->size = size;
+    return 0;
+}
+
+int lzw_binfile_parse(const unsigned char *data, size_t len, LzwBinFile *file) {
+    memset(file, 0, sizeof(*file));
+    if (len < 4) {
+        return 1;
+    }
+    uint32_t count = lzw_get_u32(data);
+    if (count > MAX_KEYS) {
+        return -1;
+    }
+    file->arrays = calloc(count ? count : 1, sizeof(LzwBinArray));
+    if (file->arrays == NULL) {
+        return -2;
+    }
+    file->count = count;
+
+    size_t pos = 4;
+    for (uint32_t i = 0; i < count; i++) {
+        int status = parse_array(data, len, &pos, &file->arrays[i]);
+        if (status != 0) {
+            lzw_binfile_free(file);
+            return status;
+        }
+    }
+    file->header_size = pos;
+
+    uint64_t offset = pos;
+    for (uint32_t i = 0; i < count; i++) {
+        file->arrays[i].offset = offset;
+        offset += file->arrays[i].size;
+    }
+    file->total_size = offset;
+    return 0;
+}
+
+void lzw_binfile_free(LzwBinFile *file) {
+    for (uint32_t i = 0; i < file->count; i++) {
+        free(file->arrays[i].name);
+        free(file->arrays[i].dtype);
+    }
+    free(file->arrays);
+    memset(file, 0, sizeof(*file));
+}
+
+const LzwBinArray *lzw_binfile_find(const LzwBinFile *file, const char *name) {
+    for (uint32_t i = 0; i < file->count; i++) {
+        if (strcmp(file->arrays[i].name, name) == 0) {
+            return &file->arrays[i];
+        }
+    }
+    return NULL;
+}
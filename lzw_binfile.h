@@ -0,0 +1,51 @@
+#ifndef LZW_BINFILE_H
+#define LZW_BINFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Layout of the .bin files written by npz_to_bin.py, integers are native
+// (little-endian) u32:
+//
+//   header   num_keys, then per key: key_length, key name, ndim,
+//            ndim dimensions, dtype_length, dtype name
+//   data     every array's bytes, in key order, back to back
+//
+// An array's data therefore starts at the header size plus the sizes of the
+// arrays before it.
+
+#define LZW_BIN_MAX_DIMS 32
+
+typedef struct {
+    char *name;
+    char *dtype;                // numpy dtype string, e.g. "uint16"
+    int ndim;
+    uint32_t shape[LZW_BIN_MAX_DIMS];
+    size_t item_size;
+    uint64_t offset;            // of the array data from the start of the file
+    uint64_t size;              // bytes of array data
+} LzwBinArray;
+
+typedef struct {
+    uint32_t count;
+    LzwBinArray *arrays;
+    uint64_t header_size;
+    uint64_t total_size;        // header plus all array data
+} LzwBinFile;
+
+// Parse the header at the start of data. Returns 0 on success, 1 if len
+// bytes end before the header does, -1 if it is not a valid header and -2 if
+// memory runs out.
+int lzw_binfile_parse(const unsigned char *data, size_t len, LzwBinFile *file);
+void lzw_binfile_free(LzwBinFile *file);
+
+// Returns the array named name, or NULL
+const LzwBinArray *lzw_binfile_find(const LzwBinFile *file, const char *name);
+
+// Bytes per element of a numpy dtype string, 0 if it is not understood
+size_t lzw_dtype_size(const char *dtype);
+
+// Returns 1 for integer and bool dtypes, whose elements can be differenced
+int lzw_dtype_is_integer(const char *dtype);
+
+#endif
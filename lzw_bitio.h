@@ -0,0 +1,141 @@
+#ifndef LZW_BITIO_H
+#define LZW_BITIO_H
+
+#include <stdint.h>
+#include <string.h>
+#include "lzw_io.h"
+
+// Codes are packed least significant bit first into little-endian 32-bit
+// words, so a code may straddle a word boundary.
+
+typedef struct {
+    LzwWriter *out;
+    uint64_t bits;      // pending bits, oldest in the low end
+    int count;          // number of valid bits in `bits`, always < 32 between calls
+    LzwWriter *record;  // if not NULL, takes an LzwBitItem per write instead of out
+} BitWriter;
+
+// One bit_write as recorded, for a later stage to code the values again
+typedef struct {
+    uint32_t value;
+    uint32_t width;
+} LzwBitItem;
+
+typedef struct {
+    LzwReader *in;
+    uint64_t bits;      // buffered bits, next code in the low end
+    int count;          // number of valid bits in `bits`
+} BitReader;
+
+// Smallest width in bits that can hold every value below limit
+static inline int lzw_code_width(int limit) {
+    int width = 1;
+    while ((1 << width) < limit) {
+        width++;
+    }
+    return width;
+}
+
+static inline void bit_writer_init(BitWriter *writer, LzwWriter *out) {
+    writer->out = out;
+    writer->bits = 0;
+    writer->count = 0;
+    writer->record = NULL;
+}
+
+// Append the low `width` bits of value, width <= 32
+static inline void bit_write(BitWriter *writer, uint32_t value, int width) {
+    if (writer->record != NULL) {
+        LzwWriter *record = writer->record;
+        if (record->capacity - record->len < sizeof(LzwBitItem)) {
+            lzw_writer_drain(record);
+        }
+        LzwBitItem item = {value, (uint32_t)width};
+        memcpy(record->buffer + record->len, &item, sizeof(item));
+        record->len += sizeof(item);
+        return;
+    }
+    writer->bits |= (uint64_t)value << writer->count;
+    writer->count += width;
+    if (writer->count >= 32) {
+        LzwWriter *out = writer->out;
+        if (out->capacity - out->len < 4) {
+            lzw_writer_drain(out);
+        }
+        unsigned char *word = out->buffer + out->len;
+        word[0] = (unsigned char)writer->bits;
+        word[1] = (unsigned char)(writer->bits >> 8);
+        word[2] = (unsigned char)(writer->bits >> 16);
+        word[3] = (unsigned char)(writer->bits >> 24);
+        out->len += 4;
+        writer->bits >>= 32;
+        writer->count -= 32;
+    }
+}
+
+// Write out any partial word, padding the last byte with zero bits
+static inline void bit_writer_flush(BitWriter *writer) {
+    while (writer->count > 0) {
+        unsigned char byte = (unsigned char)writer->bits;
+        lzw_writer_write(writer->out, &byte, 1);
+        writer->bits >>= 8;
+        writer->count -= 8;
+    }
+    writer->bits = 0;
+    writer->count = 0;
+}
+
+static inline void bit_reader_init(BitReader *reader, LzwReader *in) {
+    reader->in = in;
+    reader->bits = 0;
+    reader->count = 0;
+}
+
+// Top up the buffer, a whole word at a time, if it holds fewer than width
+// bits
+static inline void bit_refill(BitReader *reader, int width) {
+    if (reader->count < width) {
+        // Top up the input only when less than a word is left in it
+        LzwReader *in = reader->in;
+        if (in->len - in->pos < 4) {
+            lzw_reader_fill(in);
+        }
+        size_t n = in->len - in->pos;
+        if (n > 4) {
+            n = 4;
+        }
+        const unsigned char *word = in->buffer + in->pos;
+        for (size_t i = 0; i < n; i++) {
+            reader->bits |= (uint64_t)word[i] << (reader->count + 8 * (int)i);
+        }
+        in->pos += n;
+        reader->count += 8 * (int)n;
+    }
+}
+
+// Read a `width`-bit value, width <= 32. Returns 0 once the input runs out.
+static inline int bit_read(BitReader *reader, int width, uint32_t *value) {
+    bit_refill(reader, width);
+    if (reader->count < width) {
+        return 0;
+    }
+    *value = (uint32_t)(reader->bits & ((1ULL << width) - 1));
+    reader->bits >>= width;
+    reader->count -= width;
+    return 1;
+}
+
+// The next `width` bits without taking them, zeros past the end of the
+// input; reader->count says how many are real
+static inline uint32_t bit_peek(BitReader *reader, int width) {
+    bit_refill(reader, width);
+    return (uint32_t)(reader->bits & ((1ULL << width) - 1));
+}
+
+// Take `width` bits already seen through bit_peek
+static inline void bit_skip(BitReader *reader, int width) {
+    reader->bits >>= width;
+    reader->count -= width;
+}
+
+#endif
@@ -0,0 +1,157 @@
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <pthread.h>
+#include "lzw_checksum.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <nmmintrin.h>
+#define HAVE_SSE42_CRC 1
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#define ADLER_MOD 65521u
+
+// Largest n such that 255 * n * (n + 1) / 2 + (n + 1) * (ADLER_MOD - 1)
+// fits in 32 bits, so the modulo can be deferred for a whole run
+#define ADLER_NMAX 5552
+
+uint32_t lzw_adler32(uint32_t adler, const void *data, size_t len) {
+    const unsigned char *p = data;
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+
+    while (len > 0) {
+        size_t n = len < ADLER_NMAX ? len : ADLER_NMAX;
+        len -= n;
+        while (n--) {
+            a += *p++;
+            b += a;
+        }
+        a %= ADLER_MOD;
+        b %= ADLER_MOD;
+    }
+    return (b << 16) | a;
+}
+
+// The Castagnoli polynomial, bit-reversed as the CRC is computed LSB first
+#define CRC32C_POLY 0x82F63B78u
+
+// Slicing-by-8 tables for processors without CRC instructions:
+// crc_table[k][b] is the CRC of byte b followed by k zero bytes
+static uint32_t crc_table[8][256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+static void crc_table_init(void) {
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t crc = b;
+        for (int i = 0; i < 8; i++) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        crc_table[0][b] = crc;
+    }
+    for (uint32_t b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t prev = crc_table[k - 1][b];
+            crc_table[k][b] = (prev >> 8) ^ crc_table[0][prev & 0xFF];
+        }
+    }
+}
+
+static uint32_t crc32c_table(uint32_t crc, const unsigned char *p, size_t len) {
+    pthread_once(&crc_table_once, crc_table_init);
+    while (len >= 8) {
+        uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        crc = crc_table[7][lo & 0xFF] ^ crc_table[6][(lo >> 8) & 0xFF] ^ crc_table[5][(lo >> 16) & 0xFF] ^
+              crc_table[4][lo >> 24] ^ crc_table[3][p[4]] ^ crc_table[2][p[5]] ^ crc_table[1][p[6]] ^
+              crc_table[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *p++) & 0xFF];
+    }
+    return crc;
+}
+
+#if defined(HAVE_SSE42_CRC)
+// Built for SSE4.2 on its own, so the rest of the library still runs on
+// any x86 and this is only called after checking the processor
+__attribute__((target("sse4.2"))) static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len) {
+#if defined(__x86_64__)
+    uint64_t crc64 = crc;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc64 = _mm_crc32_u64(crc64, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = (uint32_t)crc64;
+#endif
+    while (len >= 4) {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = _mm_crc32_u32(crc, v);
+        p += 4;
+        len -= 4;
+    }
+    while (len--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#elif defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_arm(uint32_t crc, const unsigned char *p, size_t len) {
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        crc = __crc32cd(crc, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+uint32_t lzw_crc32c(uint32_t crc, const void *data, size_t len) {
+    const unsigned char *p = data;
+    crc = ~crc;
+#if defined(HAVE_SSE42_CRC)
+    if (__builtin_cpu_supports("sse4.2")) {
+        return ~crc32c_sse42(crc, p, len);
+    }
+#elif defined(__ARM_FEATURE_CRC32)
+    return ~crc32c_arm(crc, p, len);
+#endif
+    return ~crc32c_table(crc, p, len);
+}
+
+// a * b modulo the polynomial, with bit 31 as x^0
+static uint32_t multiply_mod(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t bit = 1u << 31; bit != 0; bit >>= 1) {
+        if (a & bit) {
+            product ^= b;
+        }
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+    }
+    return product;
+}
+
+uint32_t lzw_crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b) {
+    // Appending len_b bytes multiplies A's CRC by x^(8 len_b); build that
+    // power from x^8 by repeated squaring
+    uint32_t shift = 1u << 31;
+    uint32_t power = 1u << 23;
+    for (; len_b != 0; len_b >>= 1) {
+        if (len_b & 1) {
+            shift = multiply_mod(power, shift);
+        }
+        power = multiply_mod(power, power);
+    }
+    return multiply_mod(shift, crc_a) ^ crc_b;
+}
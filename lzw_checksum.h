@@ -0,0 +1,21 @@
+#ifndef LZW_CHECKSUM_H
+#define LZW_CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LZW_ADLER32_INIT 1u
+#define LZW_CRC32C_INIT 0u
+
+// Continue an Adler-32 checksum over len more bytes
+uint32_t lzw_adler32(uint32_t adler, const void *data, size_t len);
+
+// Continue a CRC-32C (Castagnoli) over len more bytes. Uses the SSE4.2 or
+// ARMv8 CRC instructions where the processor has them.
+uint32_t lzw_crc32c(uint32_t crc, const void *data, size_t len);
+
+// The CRC-32C of A followed by B, given the CRC-32C of each and B's length,
+// so checksums of pieces coded apart can be joined in order
+uint32_t lzw_crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b);
+
+#endif
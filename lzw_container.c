@@ -0,0 +1,300 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "lzw_container.h"
+#include "lzw_checksum.h"
+
+int lzw_index_push(LzwIndex *index, const LzwBlockInfo *block) {
+    if (index->count == index->capacity) {
+        uint64_t capacity = index->capacity ? 2 * index->capacity : 64;
+        LzwBlockInfo *blocks = realloc(index->blocks, capacity * sizeof(LzwBlockInfo));
+        if (blocks == NULL) {
+            return -1;
+        }
+        index->blocks = blocks;
+        index->capacity = capacity;
+    }
+    index->blocks[index->count++] = *block;
+    return 0;
+}
+
+void lzw_index_free(LzwIndex *index) {
+    free(index->blocks);
+    index->blocks = NULL;
+    index->count = 0;
+    index->capacity = 0;
+}
+
+void lzw_write_file_header(LzwWriter *out, const LzwFileHeader *header) {
+    unsigned char data[LZW_FILE_HEADER_SIZE];
+    memcpy(data, LZW_MAGIC, 4);
+    lzw_put_u16(data + 4, (uint16_t)header->version);
+    data[6] = (unsigned char)header->max_code_bits;
+    data[7] = (unsigned char)header->flags;
+    lzw_put_u32(data + 8, header->block_size);
+    lzw_put_u32(data + 12, header->dictionary_id);
+    lzw_writer_write(out, data, sizeof(data));
+}
+
+int lzw_parse_file_header(const unsigned char *data, LzwFileHeader *header) {
+    if (memcmp(data, LZW_MAGIC, 4) != 0) {
+        return -1;
+    }
+    header->version = lzw_get_u16(data + 4);
+    header->max_code_bits = data[6];
+    header->flags = data[7];
+    header->block_size = lzw_get_u32(data + 8);
+    header->dictionary_id = header->version > 3 ? lzw_get_u32(data + 12) : 0;
+    return header->version >= LZW_MIN_FORMAT_VERSION && header->version <= LZW_FORMAT_VERSION ? 0 : -1;
+}
+
+void lzw_write_block_header(LzwWriter *out, const LzwBlockInfo *block) {
+    unsigned char data[LZW_BLOCK_HEADER_SIZE];
+    lzw_put_u32(data, block->compressed_size);
+    lzw_put_u32(data + 4, block->uncompressed_size);
+    lzw_put_u32(data + 8, block->checksum);
+    data[12] = (unsigned char)block->filter.type;
+    data[13] = (unsigned char)block->filter.item_size;
+    data[14] = (unsigned char)block->symbol_bits;
+    data[15] = (unsigned char)(block->entropy << 4 | block->growth);
+    lzw_put_u32(data + 16, block->filter.row_length);
+    lzw_writer_write(out, data, sizeof(data));
+}
+
+void lzw_parse_block_header(const unsigned char *data, LzwBlockInfo *block) {
+    block->offset = 0;
+    block->compressed_size = lzw_get_u32(data);
+    block->uncompressed_size = lzw_get_u32(data + 4);
+    block->checksum = lzw_get_u32(data + 8);
+    block->filter.type = data[12];
+    block->filter.item_size = data[13];
+    block->filter.row_length = lzw_get_u32(data + 16);
+    block->symbol_bits = data[14];
+    block->growth = data[15] & 15;
+    block->entropy = data[15] >> 4;
+}
+
+int lzw_is_end_marker(const LzwBlockInfo *block) {
+    return block->compressed_size == 0 && block->uncompressed_size == 0 && block->checksum == 0 &&
+           block->filter.type == 0 && block->filter.item_size == 0 && block->filter.row_length == 0 &&
+           block->symbol_bits == 0 && block->growth == 0 && block->entropy == 0;
+}
+
+void lzw_write_index(LzwWriter *out, const LzwBlockInfo *blocks, uint64_t count, uint64_t end_offset,
+                     uint32_t content_checksum) {
+    LzwBlockInfo end_marker = {0, 0, 0, 0, {0, 0, 0}, 0, 0, 0};
+    lzw_write_block_header(out, &end_marker);
+
+    uint32_t index_checksum = LZW_CRC32C_INIT;
+    for (uint64_t i = 0; i < count; i++) {
+        unsigned char entry[LZW_INDEX_ENTRY_SIZE];
+        lzw_put_u64(entry, blocks[i].offset);
+        lzw_put_u32(entry + 8, blocks[i].compressed_size);
+        lzw_put_u32(entry + 12, blocks[i].uncompressed_size);
+        lzw_put_u32(entry + 16, blocks[i].checksum);
+        index_checksum = lzw_crc32c(index_checksum, entry, sizeof(entry));
+        lzw_writer_write(out, entry, sizeof(entry));
+    }
+
+    unsigned char trailer[LZW_TRAILER_SIZE];
+    lzw_put_u64(trailer, end_offset + LZW_BLOCK_HEADER_SIZE);
+    lzw_put_u64(trailer + 8, count);
+    lzw_put_u32(trailer + 16, index_checksum);
+    lzw_put_u32(trailer + 20, content_checksum);
+    memcpy(trailer + 24, LZW_INDEX_MAGIC, 4);
+    lzw_writer_write(out, trailer, sizeof(trailer));
+}
+
+int lzw_parse_trailer(const unsigned char *data, int version, LzwTrailer *trailer) {
+    size_t size = lzw_trailer_size(version);
+    if (memcmp(data + size - 4, LZW_INDEX_MAGIC, 4) != 0) {
+        return -1;
+    }
+    trailer->index_offset = lzw_get_u64(data);
+    trailer->block_count = lzw_get_u64(data + 8);
+    trailer->index_checksum = lzw_get_u32(data + 16);
+    trailer->content_checksum = version >= 5 ? lzw_get_u32(data + 20) : 0;
+    return 0;
+}
+
+static int read_at(FILE *file, uint64_t offset, void *data, size_t size) {
+    if (fseeko(file, (off_t)offset, SEEK_SET) != 0) {
+        return -1;
+    }
+    return fread(data, 1, size, file) == size ? 0 : -1;
+}
+
+int lzw_read_index(FILE *file, uint64_t file_size, const LzwFileHeader *header, LzwIndex *index,
+                   LzwTrailer *trailer) {
+    // The trailer ends the file and locates the index in front of it
+    int version = header->version;
+    size_t trailer_size = lzw_trailer_size(version);
+    unsigned char trailer_data[LZW_TRAILER_SIZE];
+    uint64_t first_end = LZW_FILE_HEADER_SIZE + LZW_BLOCK_HEADER_SIZE;
+    if (file_size < first_end + trailer_size ||
+        read_at(file, file_size - trailer_size, trailer_data, trailer_size) != 0 ||
+        lzw_parse_trailer(trailer_data, version, trailer) != 0 ||
+        trailer->index_offset < first_end || trailer->index_offset > file_size - trailer_size ||
+        (file_size - trailer_size - trailer->index_offset) != trailer->block_count * LZW_INDEX_ENTRY_SIZE) {
+        return -1;
+    }
+
+    uint64_t count = trailer->block_count;
+    size_t index_size = (size_t)count * LZW_INDEX_ENTRY_SIZE;
+    unsigned char *index_data = malloc(index_size + 1);
+    index->blocks = malloc(((size_t)count + 1) * sizeof(LzwBlockInfo));
+    if (index_data == NULL || index->blocks == NULL) {
+        free(index_data);
+        return -2;
+    }
+    index->capacity = count + 1;
+    if (read_at(file, trailer->index_offset, index_data, index_size) != 0 ||
+        lzw_checksum_update(version, lzw_checksum_init(version), index_data, index_size) != trailer->index_checksum) {
+        free(index_data);
+        return -1;
+    }
+
+    // Every block must lie between the file header and the end marker
+    uint64_t end_marker = trailer->index_offset - LZW_BLOCK_HEADER_SIZE;
+    size_t max_compressed = 3 * (size_t)header->block_size + 64;
+    for (uint64_t i = 0; i < count; i++) {
+        const unsigned char *entry = index_data + i * LZW_INDEX_ENTRY_SIZE;
+        LzwBlockInfo *info = &index->blocks[i];
+        memset(info, 0, sizeof(*info));
+        info->offset = lzw_get_u64(entry);
+        info->compressed_size = lzw_get_u32(entry + 8);
+        info->uncompressed_size = lzw_get_u32(entry + 12);
+        info->checksum = lzw_get_u32(entry + 16);
+        if (info->compressed_size == 0 || info->compressed_size > max_compressed ||
+            info->uncompressed_size == 0 || info->uncompressed_size > header->block_size ||
+            info->offset < LZW_FILE_HEADER_SIZE ||
+            info->offset + LZW_BLOCK_HEADER_SIZE + info->compressed_size > end_marker) {
+            free(index_data);
+            return -3;
+        }
+        index->count = i + 1;
+    }
+    free(index_data);
+    return 0;
+}
+
+void lzw_write_members(LzwWriter *out, const LzwMember *members, size_t count, uint64_t table_offset) {
+    uint64_t entries_size = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t name_length = strlen(members[i].name);
+        entries_size += LZW_MEMBER_ENTRY_SIZE + (name_length < UINT16_MAX ? name_length : UINT16_MAX);
+    }
+    unsigned char header[LZW_MEMBERS_HEADER_SIZE];
+    memcpy(header, LZW_MEMBERS_MAGIC, 4);
+    lzw_put_u32(header + 4, (uint32_t)count);
+    lzw_put_u64(header + 8, entries_size + LZW_MEMBERS_TRAILER_SIZE);
+    lzw_writer_write(out, header, sizeof(header));
+
+    uint32_t checksum = LZW_CRC32C_INIT;
+    for (size_t i = 0; i < count; i++) {
+        size_t name_length = strlen(members[i].name);
+        if (name_length > UINT16_MAX) {
+            name_length = UINT16_MAX;
+        }
+        unsigned char entry[LZW_MEMBER_ENTRY_SIZE];
+        lzw_put_u64(entry, members[i].offset);
+        lzw_put_u64(entry + 8, members[i].length);
+        lzw_put_u64(entry + 16, members[i].size);
+        lzw_put_u16(entry + 24, (uint16_t)name_length);
+        checksum = lzw_crc32c(checksum, entry, sizeof(entry));
+        checksum = lzw_crc32c(checksum, members[i].name, name_length);
+        lzw_writer_write(out, entry, sizeof(entry));
+        lzw_writer_write(out, members[i].name, name_length);
+    }
+
+    unsigned char trailer[LZW_MEMBERS_TRAILER_SIZE];
+    lzw_put_u64(trailer, table_offset);
+    lzw_put_u32(trailer + 8, checksum);
+    memcpy(trailer + 12, LZW_MEMBERS_MAGIC, 4);
+    lzw_writer_write(out, trailer, sizeof(trailer));
+}
+
+int64_t lzw_parse_members_header(const unsigned char *data) {
+    if (memcmp(data, LZW_MEMBERS_MAGIC, 4) != 0) {
+        return -1;
+    }
+    uint64_t table_size = lzw_get_u64(data + 8);
+    return table_size >= LZW_MEMBERS_TRAILER_SIZE && table_size <= INT64_MAX ? (int64_t)table_size : -1;
+}
+
+int lzw_read_members(FILE *file, uint64_t file_size, LzwMember **members, size_t *count) {
+    // The trailer ends the file and locates the table header
+    unsigned char trailer[LZW_MEMBERS_TRAILER_SIZE];
+    unsigned char header[LZW_MEMBERS_HEADER_SIZE];
+    *members = NULL;
+    *count = 0;
+    if (file_size < LZW_MEMBERS_HEADER_SIZE + LZW_MEMBERS_TRAILER_SIZE ||
+        read_at(file, file_size - LZW_MEMBERS_TRAILER_SIZE, trailer, sizeof(trailer)) != 0 ||
+        memcmp(trailer + 12, LZW_MEMBERS_MAGIC, 4) != 0) {
+        return -1;
+    }
+    uint64_t table_offset = lzw_get_u64(trailer);
+    if (table_offset > file_size - LZW_MEMBERS_HEADER_SIZE - LZW_MEMBERS_TRAILER_SIZE ||
+        read_at(file, table_offset, header, sizeof(header)) != 0 ||
+        lzw_parse_members_header(header) < 0 ||
+        table_offset + LZW_MEMBERS_HEADER_SIZE + (uint64_t)lzw_parse_members_header(header) != file_size) {
+        return -1;
+    }
+    uint32_t member_count = lzw_get_u32(header + 4);
+    size_t entries_size = (size_t)(file_size - table_offset - LZW_MEMBERS_HEADER_SIZE - LZW_MEMBERS_TRAILER_SIZE);
+    if (entries_size / LZW_MEMBER_ENTRY_SIZE < member_count) {
+        return -1;
+    }
+
+    // The names go after the members; with their terminators they take less
+    // room than the entries they come from
+    unsigned char *entries = malloc(entries_size + 1);
+    LzwMember *list = malloc((size_t)member_count * sizeof(LzwMember) + entries_size + 1);
+    if (entries == NULL || list == NULL) {
+        free(entries);
+        free(list);
+        return -2;
+    }
+    if (read_at(file, table_offset + LZW_MEMBERS_HEADER_SIZE, entries, entries_size) != 0 ||
+        lzw_crc32c(LZW_CRC32C_INIT, entries, entries_size) != lzw_get_u32(trailer + 8)) {
+        free(entries);
+        free(list);
+        return -1;
+    }
+    char *names = (char *)(list + member_count);
+    size_t pos = 0;
+    for (uint32_t i = 0; i < member_count; i++) {
+        if (entries_size - pos < LZW_MEMBER_ENTRY_SIZE) {
+            break;
+        }
+        const unsigned char *entry = entries + pos;
+        size_t name_length = lzw_get_u16(entry + 24);
+        LzwMember *member = &list[i];
+        member->offset = lzw_get_u64(entry);
+        member->length = lzw_get_u64(entry + 8);
+        member->size = lzw_get_u64(entry + 16);
+        pos += LZW_MEMBER_ENTRY_SIZE;
+        if (entries_size - pos < name_length || member->offset > table_offset ||
+            member->length > table_offset - member->offset) {
+            pos = entries_size + 1;
+            break;
+        }
+        memcpy(names, entries + pos, name_length);
+        names[name_length] = '\0';
+        member->name = names;
+        names += name_length + 1;
+        pos += name_length;
+        *count = i + 1;
+    }
+    free(entries);
+    if (pos != entries_size || *count != member_count) {
+        free(list);
+        *count = 0;
+        return -1;
+    }
+    *members = list;
+    return 0;
+}
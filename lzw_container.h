@@ -0,0 +1,203 @@
+#ifndef LZW_CONTAINER_H
+#define LZW_CONTAINER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "lzw.h"
+#include "lzw_io.h"
+#include "lzw_filter.h"
+#include "lzw_checksum.h"
+
+// Compressed file layout, all integers little-endian:
+//
+//   file header   "LZWC", u16 version, u8 max_code_bits, u8 flags,
+//                 u32 block_size, u32 dictionary_id
+//   blocks        u32 compressed_size, u32 uncompressed_size, u32 checksum,
+//                 u8 filter, u8 item_size, u8 symbol_bits, u8 coding,
+//                 u32 row_length,
+//                 then compressed_size bytes of code stream
+//   end marker    a block header of all zeros
+//   block index   per block: u64 offset, u32 compressed_size,
+//                 u32 uncompressed_size, u32 checksum
+//   trailer       u64 index_offset, u64 block_count, u32 index_checksum,
+//                 u32 content_checksum, "LZWI"
+//
+// Every block is coded with a fresh dictionary and can be decoded on its own.
+// A nonzero dictionary_id names the lzw_dict.h dictionary that primes every
+// block of its symbol width.
+// Blocks hold block_size bytes except where the flags say they are cut
+// short, e.g. at the end of each array of an npz_to_bin.py file.
+// The coding field holds the LZW_GROWTH_* rule the block's dictionary
+// follows in its low 4 bits, and how its codes are stored, LZW_ENTROPY_*, in
+// the high 4.
+// The filter fields describe the pre-filter applied before coding, see
+// lzw_filter.h. The checksum is CRC-32C of the unfiltered block, and the
+// content checksum CRC-32C of every block in turn, that is of the original
+// input. The index checksum is CRC-32C of the index entries. The index
+// repeats the block headers so a reader can find any block from the trailer
+// alone.
+//
+// Before version 6 the coding field is always 0, LZW codes packed, and
+// before 7 it has no entropy bits. Version 3 and 4 files
+// use Adler-32 for the block and index checksums and
+// have no content checksum.
+
+// An archive from lzw_compress_batch is a run of containers, one per file,
+// followed by a member table:
+//
+//   table header  "LZWM", u32 member_count, u64 table_size, the bytes of
+//                 members and table trailer that follow
+//   members       per member: u64 offset, u64 length, u64 size,
+//                 u16 name_length, then the name
+//   table trailer u64 table_offset, u32 checksum, "LZWM"
+//
+// offset and length locate the member's container and size is what it
+// decodes to. The checksum is CRC-32C of the members. The table header
+// takes the place of a file header, so a plain decoder skips the table and
+// restores the members one after another.
+
+// File header flags
+#define LZW_FLAG_BIN_LAYOUT 0x01    // blocks never straddle npz_to_bin.py arrays
+
+#define LZW_MAGIC "LZWC"
+#define LZW_INDEX_MAGIC "LZWI"
+#define LZW_MEMBERS_MAGIC "LZWM"
+
+#define LZW_FILE_HEADER_SIZE 16
+#define LZW_BLOCK_HEADER_SIZE 20
+#define LZW_INDEX_ENTRY_SIZE 20
+#define LZW_TRAILER_SIZE 28
+#define LZW_TRAILER_SIZE_V4 24  // before the content checksum
+#define LZW_MEMBERS_HEADER_SIZE 16
+#define LZW_MEMBER_ENTRY_SIZE 26    // before the name
+#define LZW_MEMBERS_TRAILER_SIZE 16
+
+#define LZW_DEFAULT_BLOCK_SIZE (4 << 20)
+#define LZW_MIN_BLOCK_SIZE 4096
+#define LZW_MAX_BLOCK_SIZE (1 << 30)
+
+typedef struct {
+    int version;
+    int max_code_bits;
+    int flags;
+    uint32_t block_size;
+    uint32_t dictionary_id;     // 0 for none
+} LzwFileHeader;
+
+typedef struct {
+    uint64_t offset;            // of the block header from the start of the file
+    uint32_t compressed_size;   // code stream bytes after the block header
+    uint32_t uncompressed_size;
+    uint32_t checksum;
+    LzwFilter filter;           // not repeated in the index
+    int symbol_bits;            // 8 or 16, not repeated in the index
+    int growth;                 // LZW_GROWTH_*, not repeated in the index
+    int entropy;                // LZW_ENTROPY_*, not repeated in the index
+} LzwBlockInfo;
+
+// Growable list of the blocks written so far
+typedef struct {
+    LzwBlockInfo *blocks;
+    uint64_t count;
+    uint64_t capacity;
+} LzwIndex;
+
+typedef struct {
+    uint64_t index_offset;
+    uint64_t block_count;
+    uint32_t index_checksum;
+    uint32_t content_checksum;  // 0 before version 5
+} LzwTrailer;
+
+static inline size_t lzw_trailer_size(int version) {
+    return version >= 5 ? LZW_TRAILER_SIZE : LZW_TRAILER_SIZE_V4;
+}
+
+// The block and index checksums of a given format version, started from
+// lzw_checksum_init and continued over any number of pieces
+static inline uint32_t lzw_checksum_init(int version) {
+    return version >= 5 ? LZW_CRC32C_INIT : LZW_ADLER32_INIT;
+}
+
+static inline uint32_t lzw_checksum_update(int version, uint32_t checksum, const void *data, size_t len) {
+    return version >= 5 ? lzw_crc32c(checksum, data, len) : lzw_adler32(checksum, data, len);
+}
+
+static inline void lzw_put_u16(unsigned char *p, uint16_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+}
+
+static inline void lzw_put_u32(unsigned char *p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static inline void lzw_put_u64(unsigned char *p, uint64_t v) {
+    lzw_put_u32(p, (uint32_t)v);
+    lzw_put_u32(p + 4, (uint32_t)(v >> 32));
+}
+
+static inline uint16_t lzw_get_u16(const unsigned char *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t lzw_get_u32(const unsigned char *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t lzw_get_u64(const unsigned char *p) {
+    return (uint64_t)lzw_get_u32(p) | ((uint64_t)lzw_get_u32(p + 4) << 32);
+}
+
+// Returns -1 if the index cannot grow
+int lzw_index_push(LzwIndex *index, const LzwBlockInfo *block);
+void lzw_index_free(LzwIndex *index);
+
+void lzw_write_file_header(LzwWriter *out, const LzwFileHeader *header);
+
+// Returns 0 on success, -1 if the magic or version does not match. Version
+// 3 headers read as having no dictionary.
+int lzw_parse_file_header(const unsigned char *data, LzwFileHeader *header);
+
+void lzw_write_block_header(LzwWriter *out, const LzwBlockInfo *block);
+void lzw_parse_block_header(const unsigned char *data, LzwBlockInfo *block);
+
+// Returns 1 for the all-zero header that ends the blocks
+int lzw_is_end_marker(const LzwBlockInfo *block);
+
+// Write the end marker, the index of count blocks and the trailer. end_offset
+// is the current output position, where the end marker starts.
+void lzw_write_index(LzwWriter *out, const LzwBlockInfo *blocks, uint64_t count, uint64_t end_offset,
+                     uint32_t content_checksum);
+
+// Parse the lzw_trailer_size(version) bytes at data. Returns 0 on success,
+// -1 if the magic does not match.
+int lzw_parse_trailer(const unsigned char *data, int version, LzwTrailer *trailer);
+
+// Read the trailer and block index at the end of file, which is file_size
+// bytes long and holds one container with this header, into an empty index.
+// Checks the index checksum and that every entry lies between the file
+// header and the end marker. Returns 0 on success, -1 if the trailer or
+// index is missing or inconsistent, -2 if memory runs out, and -3 if an
+// entry is invalid, with index->count set to its number.
+int lzw_read_index(FILE *file, uint64_t file_size, const LzwFileHeader *header, LzwIndex *index,
+                   LzwTrailer *trailer);
+
+// Write the member table of an archive whose containers end at table_offset.
+// Names longer than UINT16_MAX bytes are cut short.
+void lzw_write_members(LzwWriter *out, const LzwMember *members, size_t count, uint64_t table_offset);
+
+// Returns the size of the table header at data, or -1 if it is not one
+int64_t lzw_parse_members_header(const unsigned char *data);
+
+// Read the member table at the end of file, which is file_size bytes long,
+// as one allocation of *count members and their names. Checks the checksum
+// and that every container lies in front of the table. Returns 0 on
+// success, -1 if the table is missing or inconsistent, -2 if memory runs
+// out.
+int lzw_read_members(FILE *file, uint64_t file_size, LzwMember **members, size_t *count);
+
+#endif
@@ -0,0 +1,1329 @@
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lzw.h"
+#include "lzw_io.h"
+#include "lzw_bitio.h"
+#include "lzw_checksum.h"
+#include "lzw_container.h"
+#include "lzw_pool.h"
+#include "lzw_binfile.h"
+#include "lzw_arena.h"
+#include "lzw_stats.h"
+#include "lzw_pipe.h"
+#include "lzw_dict.h"
+#include "lzw_huffman.h"
+
+// Dictionary state reused from one block to the next. The dictionary is
+// carved from the worker's arena for the symbol width of the current block,
+// and kept while later blocks use the same width.
+typedef struct {
+    int max_dict_size;
+    LzwArena arena;
+    int symbol_bits;            // width the arena is laid out for, 0 for none
+    struct DictEntry8 *dictionary8;
+    struct DictEntry16 *dictionary16;
+    const LzwDictionary *primed;    // whose phrases the table holds, or NULL
+    uint32_t primed_codes;
+    LzwHuffman huffman;         // decode table of a Huffman-coded block
+} BlockDecoder;
+
+// Bytes past the end of a block that copy_match may overwrite
+#define COPY_SLACK 32
+
+// Host-order u16, which is little-endian everywhere this runs
+static inline void store_u16(unsigned char *p, uint16_t v) {
+    memcpy(p, &v, sizeof(v));
+}
+
+// Copy len bytes from src to dst, which lies after src and may overlap it,
+// giving the same result as copying a byte at a time. Copies go in 16 or
+// 32-byte steps and may write up to COPY_SLACK bytes past dst + len.
+static inline void copy_match(unsigned char *dst, const unsigned char *src, size_t len) {
+    // Close repeats write their period out whole, doubling the distance
+    // each time, until it is wide enough for full steps
+    size_t distance = (size_t)(dst - src);
+    while (distance < 16 && len > 0) {
+        size_t n = distance < len ? distance : len;
+        memcpy(dst, src, n);
+        dst += n;
+        len -= n;
+        distance *= 2;
+    }
+    if (distance >= 32) {
+        for (size_t i = 0; i < len; i += 32) {
+            memcpy(dst + i, src + i, 32);
+        }
+    } else {
+        for (size_t i = 0; i < len; i += 16) {
+            memcpy(dst + i, src + i, 16);
+        }
+    }
+}
+
+#define SYMBOL_BITS 8
+#include "lzw_decode_impl.h"
+#undef SYMBOL_BITS
+
+#define SYMBOL_BITS 16
+#include "lzw_decode_impl.h"
+#undef SYMBOL_BITS
+
+// Size the decoder for max_bits codes. Its arena is sized for 8-bit blocks
+// on the first call and reused after that.
+static int block_decoder_init(BlockDecoder *dec, int max_bits) {
+    dec->max_dict_size = 1 << max_bits;
+    dec->symbol_bits = 0;
+    dec->primed = NULL;
+    if (dec->arena.base == NULL) {
+        if (lzw_arena_init(&dec->arena, (size_t)dec->max_dict_size * sizeof(DictEntry8)) != 0) {
+            return -1;
+        }
+    }
+    return block_decoder_prepare8(dec);
+}
+
+static void block_decoder_free(BlockDecoder *dec) {
+    lzw_arena_free(&dec->arena);
+    dec->symbol_bits = 0;
+}
+
+// Decode with the container's dictionary, which only primes blocks of its
+// own symbol width. A Huffman-coded block starts with its table.
+static int decode_block(BlockDecoder *dec, const LzwBlockInfo *info, const LzwDictionary *dictionary,
+                        const unsigned char *data, size_t len, LzwWriter *out, size_t max_out, LzwStats *stats) {
+    int symbol_bits = info->symbol_bits;
+    const LzwDictionary *preset = dictionary != NULL && dictionary->symbol_bits == symbol_bits ? dictionary : NULL;
+    const LzwHuffman *huffman = NULL;
+    if (info->entropy == LZW_ENTROPY_HUFFMAN) {
+        size_t table_size = lzw_huffman_read_table(&dec->huffman, data, len, lzw_code_width(dec->max_dict_size));
+        if (table_size == 0) {
+            return LZW_ERR_CORRUPT;
+        }
+        data += table_size;
+        len -= table_size;
+        huffman = &dec->huffman;
+    }
+    int status;
+    if (symbol_bits == 8) {
+        status = block_decoder_prepare8(dec) == 0
+                     ? decode_block8(dec, preset, info->growth, huffman, data, len, out, max_out, stats)
+                     : LZW_ERR_MEMORY;
+    } else {
+        status = block_decoder_prepare16(dec) == 0
+                     ? decode_block16(dec, preset, info->growth, huffman, data, len, out, max_out, stats)
+                     : LZW_ERR_MEMORY;
+    }
+    if (status == LZW_OK) {
+        stats->lzmw_blocks += info->growth == LZW_GROWTH_LZMW;
+        stats->lzap_blocks += info->growth == LZW_GROWTH_LZAP;
+        stats->huffman_blocks += huffman != NULL;
+    }
+    return status;
+}
+
+// The first error of a run, and a message saying what went wrong
+typedef struct {
+    int status;
+    char message[LZW_MESSAGE_SIZE];
+} ErrorState;
+
+static int fail(ErrorState *error, int status, const char *format, ...) {
+    if (error->status == LZW_OK) {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(error->message, sizeof(error->message), format, args);
+        va_end(args);
+        error->status = status;
+    }
+    return error->status;
+}
+
+// Allocate the buffers for unfiltering blocks of up to size bytes, once.
+// Returns -1 if memory runs out.
+static int filter_buffers(unsigned char **unfiltered, unsigned char **scratch, size_t size) {
+    if (*unfiltered == NULL) {
+        *unfiltered = malloc(size);
+        *scratch = malloc(size);
+        if (*unfiltered == NULL || *scratch == NULL) {
+            free(*unfiltered);
+            free(*scratch);
+            *unfiltered = NULL;
+            *scratch = NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Undo the block's pre-filter and check the result against its header,
+// whose checksum is the kind format version uses, leaving the block's bytes
+// at *result. Returns LZW_OK or LZW_ERR_CORRUPT.
+static int finish_block(const LzwBlockInfo *info, int version, const LzwWriter *decoded,
+                        unsigned char *unfiltered, unsigned char *scratch, const unsigned char **result) {
+    if (decoded->len != info->uncompressed_size) {
+        return LZW_ERR_CORRUPT;
+    }
+    *result = decoded->buffer;
+    if (info->filter.type != LZW_FILTER_NONE) {
+        lzw_filter_invert(&info->filter, decoded->buffer, unfiltered, scratch, decoded->len);
+        *result = unfiltered;
+    }
+    if (lzw_checksum_update(version, lzw_checksum_init(version), *result, decoded->len) != info->checksum) {
+        return LZW_ERR_CORRUPT;
+    }
+    return LZW_OK;
+}
+
+// Decode a block and verify it, returning what went wrong in *error and
+// adding its counts to stats
+static int decode_and_finish(BlockDecoder *dec, const LzwBlockInfo *info, int version,
+                             const LzwDictionary *dictionary, const unsigned char *payload, LzwWriter *output,
+                             unsigned char *unfiltered, unsigned char *scratch, const unsigned char **result,
+                             const char **error, LzwStats *stats) {
+    output->len = 0;
+    output->failed = 0;
+    double start = lzw_stats_clock();
+    int status = decode_block(dec, info, dictionary, payload, info->compressed_size, output, info->uncompressed_size,
+                              stats);
+    stats->coding_seconds += lzw_stats_clock() - start;
+    if (status == LZW_OK && output->failed) {
+        status = LZW_ERR_MEMORY;
+    }
+    if (status != LZW_OK) {
+        *error = status == LZW_ERR_MEMORY ? "Memory allocation failed decoding" : "Corrupt code stream";
+        return status;
+    }
+    status = finish_block(info, version, output, unfiltered, scratch, result);
+    if (status != LZW_OK) {
+        *error = "Checksum mismatch";
+    }
+    return status;
+}
+
+static int header_valid(const LzwFileHeader *header) {
+    return header->max_code_bits >= LZW_MIN_CODE_BITS && header->max_code_bits <= LZW_MAX_CODE_BITS &&
+           header->block_size >= LZW_MIN_BLOCK_SIZE && header->block_size <= LZW_MAX_BLOCK_SIZE;
+}
+
+// A container that names a dictionary can only be decoded with that one
+static int check_dictionary(const LzwFileHeader *header, const LzwDictionary *dictionary, ErrorState *error) {
+    if (header->dictionary_id == 0) {
+        return LZW_OK;
+    }
+    if (dictionary == NULL) {
+        return fail(error, LZW_ERR_PARAM, "The input was compressed with dictionary %08x; pass it to decompress.",
+                    header->dictionary_id);
+    }
+    if (dictionary->id != header->dictionary_id) {
+        return fail(error, LZW_ERR_PARAM, "The input needs dictionary %08x, not %08x.", header->dictionary_id,
+                    dictionary->id);
+    }
+    return LZW_OK;
+}
+
+// A block header the decoder can act on. Even incompressible data codes to
+// well under 3 bytes per input byte.
+static int block_header_valid(const LzwBlockInfo *info, const LzwFileHeader *header) {
+    size_t max_compressed = 3 * (size_t)header->block_size + 64;
+    return info->compressed_size > 0 && info->compressed_size <= max_compressed &&
+           info->uncompressed_size > 0 && info->uncompressed_size <= header->block_size &&
+           (info->filter.type == LZW_FILTER_NONE || lzw_filter_valid(&info->filter)) &&
+           (info->symbol_bits == 8 || (info->symbol_bits == 16 && header->max_code_bits >= LZW_MIN_CODE_BITS_16)) &&
+           info->growth >= LZW_GROWTH_LZW && info->growth <= LZW_GROWTH_LZAP &&
+           (info->entropy == LZW_ENTROPY_NONE || info->entropy == LZW_ENTROPY_HUFFMAN);
+}
+
+// One block in flight between the caller, a worker and the writer
+typedef struct {
+    LzwBlockInfo info;
+    int version;                    // of its container
+    const LzwDictionary *dictionary;    // of its container, or NULL
+    uint64_t number;                // within its container
+    const unsigned char *payload;   // into the caller's buffer, or a copy in `input`
+    unsigned char *input;
+    size_t input_size;
+    size_t filled;                  // payload bytes copied to input so far
+    int borrowed;                   // payload points into the caller's buffer
+    LzwWriter output;
+    unsigned char *unfiltered;      // the block with its filter undone
+    unsigned char *scratch;
+    const unsigned char *result;    // the finished block, in output or unfiltered
+    int status;
+    const char *error;              // what went wrong, if status is not LZW_OK
+    LzwStats stats;                 // of this block
+    BlockDecoder *decoders;         // one per worker
+    LzwTask task;
+} DecodeJob;
+
+static void decompress_job(void *arg, int worker) {
+    DecodeJob *job = arg;
+    memset(&job->stats, 0, sizeof(job->stats));
+    job->status = decode_and_finish(&job->decoders[worker], &job->info, job->version, job->dictionary, job->payload,
+                                    &job->output, job->unfiltered, job->scratch, &job->result, &job->error,
+                                    &job->stats);
+}
+
+// Where the decoder is in the container it is reading
+enum {
+    STAGE_HEADER,       // file header, or the start of another container
+    STAGE_BLOCK,        // block header or end marker
+    STAGE_PAYLOAD,      // a block's code stream
+    STAGE_INDEX,        // index entries
+    STAGE_TRAILER,
+    STAGE_MEMBERS       // an archive's member table, skipped
+};
+
+struct LzwDecoder {
+    int threads;
+    LzwPool *pool;
+    BlockDecoder *decoders;     // one per worker
+    int decoder_bits;           // max_code_bits the decoders are set up for
+    const LzwDictionary *dictionary;    // from the params, for containers that name one
+    DecodeJob *jobs;            // ring of job_count slots
+    int job_count;
+    size_t filter_size;         // block size the filter buffers are allocated for
+    uint64_t submitted;         // jobs handed to the pool
+    uint64_t written;           // jobs written out, oldest first
+    uint64_t borrowed;          // one past the newest job holding caller memory
+
+    LzwWriteFn write;           // the caller's output
+    void *context;
+    LzwCallbackSink sink;       // times write
+    LzwWriter out;
+    uint64_t input_total;
+    LzwStats stats;
+
+    int stage;
+    LzwWriter pending;          // the part of a header or trailer that has arrived
+    LzwFileHeader header;
+    uint64_t block_count;       // blocks so far in this container
+    uint64_t index_left;        // index or member table bytes still to come
+    uint32_t index_checksum;
+    uint32_t content_checksum;  // of the blocks written so far, from version 5
+    uint64_t containers;        // containers completed
+
+    ErrorState error;
+};
+
+// Hands output to the caller, timing how long it takes
+static int timed_write(void *context, const void *data, size_t len) {
+    LzwDecoder *dec = context;
+    double start = lzw_stats_clock();
+    int result = dec->write(dec->context, data, len);
+    dec->stats.io_seconds += lzw_stats_clock() - start;
+    return result;
+}
+
+int lzw_decoder_create(LzwDecoder **decoder, const LzwParams *params, LzwWriteFn write, void *context) {
+    LzwDecoder *dec = calloc(1, sizeof(LzwDecoder));
+    *decoder = dec;
+    if (dec == NULL) {
+        return LZW_ERR_MEMORY;
+    }
+    dec->write = write;
+    dec->context = context;
+    dec->sink.write = timed_write;
+    dec->sink.context = dec;
+    dec->dictionary = params->dictionary;
+
+    // Each worker owns a dictionary, each job its decoded block. The number
+    // of jobs caps how many blocks are held in memory at once.
+    dec->threads = params->threads > 0 ? params->threads : lzw_cpu_count();
+    dec->job_count = params->max_inflight > 0 ? params->max_inflight : (dec->threads > 1 ? 2 * dec->threads : 1);
+    dec->pool = lzw_pool_create(dec->threads);
+    dec->decoders = calloc((size_t)dec->threads, sizeof(BlockDecoder));
+    dec->jobs = calloc((size_t)dec->job_count, sizeof(DecodeJob));
+    if (dec->pool == NULL || dec->decoders == NULL || dec->jobs == NULL ||
+        lzw_writer_open_callback(&dec->out, &dec->sink, params->io_buffer_size) != 0 ||
+        lzw_writer_open_memory(&dec->pending, LZW_TRAILER_SIZE) != 0) {
+        return fail(&dec->error, LZW_ERR_MEMORY, "Memory allocation failed for decompression jobs.");
+    }
+    for (int i = 0; i < dec->job_count; i++) {
+        if (lzw_writer_open_memory(&dec->jobs[i].output, LZW_MIN_BLOCK_SIZE) != 0) {
+            return fail(&dec->error, LZW_ERR_MEMORY, "Memory allocation failed for decompression jobs.");
+        }
+        dec->jobs[i].decoders = dec->decoders;
+    }
+    return LZW_OK;
+}
+
+void lzw_decoder_destroy(LzwDecoder *dec) {
+    if (dec == NULL) {
+        return;
+    }
+    // Waits for any jobs an error left running
+    if (dec->pool != NULL) {
+        lzw_pool_destroy(dec->pool);
+    }
+    if (dec->decoders != NULL) {
+        for (int i = 0; i < dec->threads; i++) {
+            block_decoder_free(&dec->decoders[i]);
+        }
+    }
+    if (dec->jobs != NULL) {
+        for (int i = 0; i < dec->job_count; i++) {
+            lzw_writer_close(&dec->jobs[i].output);
+            free(dec->jobs[i].input);
+            free(dec->jobs[i].unfiltered);
+            free(dec->jobs[i].scratch);
+        }
+    }
+    free(dec->decoders);
+    free(dec->jobs);
+    lzw_writer_close(&dec->pending);
+    lzw_writer_close(&dec->out);
+    free(dec);
+}
+
+const char *lzw_decoder_message(const LzwDecoder *dec) {
+    return dec->error.status != LZW_OK ? dec->error.message : "";
+}
+
+void lzw_decoder_totals(const LzwDecoder *dec, LzwTotals *totals) {
+    totals->input_bytes = dec->input_total;
+    totals->output_bytes = lzw_writer_tell(&dec->out);
+    totals->stats = dec->stats;
+    totals->stats.enabled = LZW_STATS_ENABLED;
+}
+
+// Wait for the oldest job and write its block out
+static int write_oldest(LzwDecoder *dec) {
+    DecodeJob *job = &dec->jobs[dec->written % dec->job_count];
+    lzw_pool_wait(dec->pool, &job->task);
+    dec->written++;
+    if (job->status != LZW_OK) {
+        return fail(&dec->error, job->status, "%s in block %llu.", job->error, (unsigned long long)job->number);
+    }
+    lzw_stats_add(&dec->stats, &job->stats);
+    if (job->version >= 5) {
+        dec->content_checksum = lzw_crc32c_combine(dec->content_checksum, job->info.checksum, job->output.len);
+    }
+    lzw_writer_write(&dec->out, job->result, job->output.len);
+    if (dec->out.failed) {
+        return fail(&dec->error, LZW_ERR_IO, "Cannot write output.");
+    }
+    return LZW_OK;
+}
+
+// Wait for and write every job up to, but not including, job number end
+static int write_until(LzwDecoder *dec, uint64_t end) {
+    while (dec->error.status == LZW_OK && dec->written < end) {
+        write_oldest(dec);
+    }
+    return dec->error.status;
+}
+
+// Gather a need byte unit from the input, straight from the caller's buffer
+// when it is all there. Returns 1 with *unit pointing at it once complete,
+// 0 after keeping what there is for the next call.
+static int take(LzwDecoder *dec, const unsigned char **data, size_t *len, size_t need, const unsigned char **unit) {
+    if (dec->pending.len == 0 && *len >= need) {
+        *unit = *data;
+        *data += need;
+        *len -= need;
+        return 1;
+    }
+    size_t n = need - dec->pending.len;
+    if (n > *len) {
+        n = *len;
+    }
+    lzw_writer_write(&dec->pending, *data, n);
+    *data += n;
+    *len -= n;
+    if (dec->pending.len < need) {
+        return 0;
+    }
+    *unit = dec->pending.buffer;
+    dec->pending.len = 0;
+    return 1;
+}
+
+static void begin_container(LzwDecoder *dec, const unsigned char *p) {
+    LzwFileHeader *header = &dec->header;
+    int64_t table_size = lzw_parse_members_header(p);
+    if (table_size >= 0 && dec->containers > 0) {
+        dec->index_left = (uint64_t)table_size;
+        dec->stage = STAGE_MEMBERS;
+        return;
+    }
+    if (lzw_parse_file_header(p, header) != 0) {
+        fail(&dec->error, LZW_ERR_FORMAT, "Input is not an LZW container of versions %d-%d.", LZW_MIN_FORMAT_VERSION,
+             LZW_FORMAT_VERSION);
+        return;
+    }
+    if (!header_valid(header)) {
+        fail(&dec->error, LZW_ERR_FORMAT, "Invalid dictionary size: %d bits or block size: %u bytes.",
+             header->max_code_bits, header->block_size);
+        return;
+    }
+
+    if (check_dictionary(header, dec->dictionary, &dec->error) != LZW_OK) {
+        return;
+    }
+
+    // Every job is idle between containers, so buffers can be resized
+    if (header->max_code_bits != dec->decoder_bits) {
+        dec->decoder_bits = 0;
+        for (int i = 0; i < dec->threads; i++) {
+            if (block_decoder_init(&dec->decoders[i], header->max_code_bits) != 0) {
+                fail(&dec->error, LZW_ERR_MEMORY, "Memory allocation failed for dictionary.");
+                return;
+            }
+        }
+        dec->decoder_bits = header->max_code_bits;
+    }
+    if (header->block_size > dec->filter_size) {
+        for (int i = 0; i < dec->job_count; i++) {
+            free(dec->jobs[i].unfiltered);
+            free(dec->jobs[i].scratch);
+            dec->jobs[i].unfiltered = NULL;
+            dec->jobs[i].scratch = NULL;
+        }
+        dec->filter_size = header->block_size;
+    }
+    dec->block_count = 0;
+    dec->content_checksum = LZW_CRC32C_INIT;
+    dec->stage = STAGE_BLOCK;
+}
+
+static void read_block_header(LzwDecoder *dec, const unsigned char *p) {
+    LzwBlockInfo info;
+    lzw_parse_block_header(p, &info);
+    if (lzw_is_end_marker(&info)) {
+        // Finish this container's blocks before the next can reconfigure them
+        if (write_until(dec, dec->submitted) == LZW_OK) {
+            dec->index_left = dec->block_count * LZW_INDEX_ENTRY_SIZE;
+            dec->index_checksum = lzw_checksum_init(dec->header.version);
+            dec->stage = dec->index_left > 0 ? STAGE_INDEX : STAGE_TRAILER;
+        }
+        return;
+    }
+    if (!block_header_valid(&info, &dec->header)) {
+        fail(&dec->error, LZW_ERR_CORRUPT, "Invalid header for block %llu.", (unsigned long long)dec->block_count);
+        return;
+    }
+
+    // Reuse the oldest job's slot once its block has been written
+    if (dec->submitted - dec->written == (uint64_t)dec->job_count && write_oldest(dec) != LZW_OK) {
+        return;
+    }
+    DecodeJob *job = &dec->jobs[dec->submitted % dec->job_count];
+    if (info.filter.type != LZW_FILTER_NONE &&
+        filter_buffers(&job->unfiltered, &job->scratch, dec->filter_size) != 0) {
+        fail(&dec->error, LZW_ERR_MEMORY, "Memory allocation failed for filter buffers.");
+        return;
+    }
+    job->info = info;
+    job->version = dec->header.version;
+    job->dictionary = dec->header.dictionary_id != 0 ? dec->dictionary : NULL;
+    job->number = dec->block_count;
+    job->filled = 0;
+    dec->stage = STAGE_PAYLOAD;
+}
+
+// Collect the current block's code stream and hand it to a worker. A stream
+// that arrives whole is decoded in place, otherwise the job takes a copy.
+static void read_payload(LzwDecoder *dec, const unsigned char **data, size_t *len) {
+    DecodeJob *job = &dec->jobs[dec->submitted % dec->job_count];
+    size_t size = job->info.compressed_size;
+    size_t n;
+    if (job->filled == 0 && *len >= size) {
+        job->payload = *data;
+        job->borrowed = 1;
+        n = size;
+    } else {
+        if (job->input_size < size) {
+            free(job->input);
+            job->input = malloc(size);
+            job->input_size = job->input != NULL ? size : 0;
+            if (job->input == NULL) {
+                fail(&dec->error, LZW_ERR_MEMORY, "Memory allocation failed for block buffer.");
+                return;
+            }
+        }
+        n = size - job->filled < *len ? size - job->filled : *len;
+        memcpy(job->input + job->filled, *data, n);
+        job->payload = job->input;
+        job->borrowed = 0;
+    }
+    job->filled += n;
+    *data += n;
+    *len -= n;
+    if (job->filled < size) {
+        return;
+    }
+
+    lzw_pool_submit(dec->pool, &job->task, decompress_job, job);
+    dec->submitted++;
+    if (job->borrowed) {
+        dec->borrowed = dec->submitted;
+    }
+    dec->block_count++;
+    dec->stage = STAGE_BLOCK;
+}
+
+// The index is only checked, since the blocks came in order anyway
+static void read_index(LzwDecoder *dec, const unsigned char **data, size_t *len) {
+    size_t n = dec->index_left < *len ? (size_t)dec->index_left : *len;
+    dec->index_checksum = lzw_checksum_update(dec->header.version, dec->index_checksum, *data, n);
+    dec->index_left -= n;
+    *data += n;
+    *len -= n;
+    if (dec->index_left == 0) {
+        dec->stage = STAGE_TRAILER;
+    }
+}
+
+static void skip_members(LzwDecoder *dec, const unsigned char **data, size_t *len) {
+    size_t n = dec->index_left < *len ? (size_t)dec->index_left : *len;
+    dec->index_left -= n;
+    *data += n;
+    *len -= n;
+    if (dec->index_left == 0) {
+        dec->stage = STAGE_HEADER;
+    }
+}
+
+// The index must list exactly the blocks that were decoded, and from
+// version 5 on, they must add up to the content the trailer records
+static void end_container(LzwDecoder *dec, const unsigned char *p) {
+    LzwTrailer trailer;
+    if (lzw_parse_trailer(p, dec->header.version, &trailer) != 0 || trailer.block_count != dec->block_count ||
+        trailer.index_checksum != dec->index_checksum) {
+        fail(&dec->error, LZW_ERR_CORRUPT, "Missing or inconsistent block index.");
+        return;
+    }
+    if (dec->header.version >= 5 && trailer.content_checksum != dec->content_checksum) {
+        fail(&dec->error, LZW_ERR_CORRUPT, "Checksum mismatch over the whole file.");
+        return;
+    }
+    dec->containers++;
+    dec->stage = STAGE_HEADER;
+}
+
+int lzw_decoder_decode(LzwDecoder *dec, const void *data, size_t len) {
+    if (dec->error.status != LZW_OK) {
+        return dec->error.status;
+    }
+    dec->input_total += len;
+
+    const unsigned char *p = data;
+    const unsigned char *unit;
+    while (len > 0 && dec->error.status == LZW_OK) {
+        switch (dec->stage) {
+        case STAGE_HEADER:
+            if (take(dec, &p, &len, LZW_FILE_HEADER_SIZE, &unit)) {
+                begin_container(dec, unit);
+            }
+            break;
+        case STAGE_BLOCK:
+            if (take(dec, &p, &len, LZW_BLOCK_HEADER_SIZE, &unit)) {
+                read_block_header(dec, unit);
+            }
+            break;
+        case STAGE_PAYLOAD:
+            read_payload(dec, &p, &len);
+            break;
+        case STAGE_INDEX:
+            read_index(dec, &p, &len);
+            break;
+        case STAGE_TRAILER:
+            if (take(dec, &p, &len, lzw_trailer_size(dec->header.version), &unit)) {
+                end_container(dec, unit);
+            }
+            break;
+        case STAGE_MEMBERS:
+            skip_members(dec, &p, &len);
+            break;
+        }
+        if (dec->pending.failed) {
+            fail(&dec->error, LZW_ERR_MEMORY, "Memory allocation failed for block header.");
+        }
+    }
+
+    // Nothing may still point into the caller's buffer once this returns
+    return write_until(dec, dec->borrowed);
+}
+
+int lzw_decoder_finish(LzwDecoder *dec) {
+    if (write_until(dec, dec->submitted) != LZW_OK) {
+        return dec->error.status;
+    }
+    switch (dec->stage) {
+    case STAGE_HEADER:
+        if (dec->pending.len > 0 || dec->containers == 0) {
+            return fail(&dec->error, LZW_ERR_FORMAT, "Input is not an LZW container of versions %d-%d.",
+                        LZW_MIN_FORMAT_VERSION, LZW_FORMAT_VERSION);
+        }
+        break;
+    case STAGE_BLOCK:
+        return fail(&dec->error, LZW_ERR_CORRUPT, "Truncated file, no end marker after %llu blocks.",
+                    (unsigned long long)dec->block_count);
+    case STAGE_PAYLOAD:
+        return fail(&dec->error, LZW_ERR_CORRUPT, "Truncated file in block %llu.",
+                    (unsigned long long)dec->block_count);
+    case STAGE_MEMBERS:
+        return fail(&dec->error, LZW_ERR_CORRUPT, "Truncated member table.");
+    default:
+        return fail(&dec->error, LZW_ERR_CORRUPT, "Missing or inconsistent block index.");
+    }
+
+    // Ready for another stream
+    dec->containers = 0;
+    lzw_writer_drain(&dec->out);
+    if (dec->out.failed) {
+        return fail(&dec->error, LZW_ERR_IO, "Cannot write output.");
+    }
+    return LZW_OK;
+}
+
+int lzw_decoded_size(const void *data, size_t len, uint64_t *size) {
+    const unsigned char *bytes = data;
+    LzwFileHeader header;
+    LzwTrailer trailer;
+    if (len < LZW_FILE_HEADER_SIZE || lzw_parse_file_header(bytes, &header) != 0) {
+        return LZW_ERR_FORMAT;
+    }
+    size_t trailer_size = lzw_trailer_size(header.version);
+    if (len < LZW_FILE_HEADER_SIZE + trailer_size ||
+        lzw_parse_trailer(bytes + len - trailer_size, header.version, &trailer) != 0) {
+        return LZW_ERR_FORMAT;
+    }
+    // The index must end exactly where the trailer starts
+    uint64_t index_end = len - trailer_size;
+    if (trailer.index_offset < LZW_FILE_HEADER_SIZE || trailer.index_offset > index_end ||
+        (index_end - trailer.index_offset) % LZW_INDEX_ENTRY_SIZE != 0 ||
+        (index_end - trailer.index_offset) / LZW_INDEX_ENTRY_SIZE != trailer.block_count) {
+        return LZW_ERR_FORMAT;
+    }
+    const unsigned char *entry = bytes + trailer.index_offset;
+    *size = 0;
+    for (uint64_t i = 0; i < trailer.block_count; i++, entry += LZW_INDEX_ENTRY_SIZE) {
+        *size += lzw_get_u32(entry + 12);
+    }
+    return LZW_OK;
+}
+
+// Decode everything in, which read_stage_start has not been called on, into
+// write(context, ...), filling in totals
+static int decode_reader(LzwReader *in, const char *input_file, const LzwParams *params, LzwWriteFn write,
+                         void *context, LzwTotals *totals) {
+    // Reads run on a thread of their own. A mapped input arrives as one
+    // piece, so its blocks are decoded in place.
+    LzwDecoder *dec;
+    LzwReadStage reading;
+    if (lzw_read_stage_start(&reading, in) != 0) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot start the input thread.");
+        return LZW_ERR_MEMORY;
+    }
+    int status = lzw_decoder_create(&dec, params, write, context);
+    double read_seconds = 0;
+    while (status == LZW_OK) {
+        double start = lzw_stats_clock();
+        size_t len;
+        const unsigned char *data = lzw_read_stage_next(&reading, &len);
+        read_seconds += lzw_stats_clock() - start;
+        if (data == NULL) {
+            break;
+        }
+        status = lzw_decoder_decode(dec, data, len);
+    }
+    lzw_read_stage_finish(&reading);
+    if (status == LZW_OK && in->failed) {
+        status = fail(&dec->error, LZW_ERR_IO, "Cannot read %s.", input_file);
+    }
+    if (status == LZW_OK) {
+        status = lzw_decoder_finish(dec);
+    }
+
+    if (dec != NULL) {
+        lzw_decoder_totals(dec, totals);
+        totals->stats.io_seconds += read_seconds;
+        snprintf(totals->message, sizeof(totals->message), "%s", lzw_decoder_message(dec));
+    } else {
+        snprintf(totals->message, sizeof(totals->message), "%s", lzw_strerror(status));
+    }
+    lzw_decoder_destroy(dec);
+    return status;
+}
+
+int lzw_decompress(const char *input_file, const char *output_file, const LzwParams *params, LzwTotals *totals) {
+    LzwTotals local;
+    if (totals == NULL) {
+        totals = &local;
+    }
+    memset(totals, 0, sizeof(*totals));
+
+    LzwReader in;
+    if (lzw_reader_open_path(&in, input_file, params->io_buffer_size, params->use_mmap) != 0) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot open %s.", input_file);
+        return LZW_ERR_IO;
+    }
+    FILE *output = lzw_open_output(output_file);
+    if (output == NULL) {
+        lzw_reader_close(&in);
+        snprintf(totals->message, sizeof(totals->message), "Cannot open %s.", output_file);
+        return LZW_ERR_IO;
+    }
+
+    // Writes run on a thread of their own too
+    LzwWriteStage writing;
+    if (lzw_write_stage_start(&writing, output, params->io_buffer_size) != 0) {
+        lzw_reader_close(&in);
+        lzw_close_output(output);
+        snprintf(totals->message, sizeof(totals->message), "Cannot start the output thread.");
+        return LZW_ERR_MEMORY;
+    }
+    int status = decode_reader(&in, input_file, params, lzw_write_stage_write, &writing, totals);
+    lzw_reader_close(&in);
+    int write_failed = lzw_write_stage_finish(&writing) != 0;
+    if ((lzw_close_output(output) != 0 || write_failed) && status == LZW_OK) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot write %s.", output_file);
+        status = LZW_ERR_IO;
+    }
+    return status;
+}
+
+static int discard(void *context, const void *data, size_t len) {
+    (void)context;
+    (void)data;
+    (void)len;
+    return 0;
+}
+
+int lzw_verify(const char *input_file, const LzwParams *params, LzwTotals *totals) {
+    LzwTotals local;
+    if (totals == NULL) {
+        totals = &local;
+    }
+    memset(totals, 0, sizeof(*totals));
+
+    LzwReader in;
+    if (lzw_reader_open_path(&in, input_file, params->io_buffer_size, params->use_mmap) != 0) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot open %s.", input_file);
+        return LZW_ERR_IO;
+    }
+    int status = decode_reader(&in, input_file, params, discard, NULL, totals);
+    lzw_reader_close(&in);
+    return status;
+}
+
+// Checks decoded output against the original as it is written out
+typedef struct {
+    LzwReader *original;
+    int differs;
+    uint64_t differs_at;        // offset of the first byte that differs
+} Comparison;
+
+static int compare_original(void *context, const void *data, size_t len) {
+    Comparison *cmp = context;
+    LzwReader *in = cmp->original;
+    const unsigned char *bytes = data;
+    while (len > 0) {
+        if (in->pos == in->len && lzw_reader_fill(in) == 0) {
+            break;
+        }
+        size_t n = in->len - in->pos < len ? in->len - in->pos : len;
+        if (memcmp(in->buffer + in->pos, bytes, n) != 0) {
+            size_t i = 0;
+            while (in->buffer[in->pos + i] == bytes[i]) {
+                i++;
+            }
+            in->pos += i;
+            break;
+        }
+        in->pos += n;
+        bytes += n;
+        len -= n;
+    }
+    if (len > 0) {
+        // A difference, or the original ended
+        cmp->differs = 1;
+        cmp->differs_at = lzw_reader_tell(in);
+        return -1;
+    }
+    return 0;
+}
+
+int lzw_test(const char *input_file, const char *original_file, const LzwParams *params, LzwTotals *totals) {
+    LzwTotals local;
+    if (totals == NULL) {
+        totals = &local;
+    }
+    memset(totals, 0, sizeof(*totals));
+    if (strcmp(input_file, "-") == 0 && strcmp(original_file, "-") == 0) {
+        snprintf(totals->message, sizeof(totals->message), "Only one of the files can be stdin.");
+        return LZW_ERR_PARAM;
+    }
+
+    LzwReader in, original;
+    if (lzw_reader_open_path(&in, input_file, params->io_buffer_size, params->use_mmap) != 0) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot open %s.", input_file);
+        return LZW_ERR_IO;
+    }
+    if (lzw_reader_open_path(&original, original_file, params->io_buffer_size, params->use_mmap) != 0) {
+        lzw_reader_close(&in);
+        snprintf(totals->message, sizeof(totals->message), "Cannot open %s.", original_file);
+        return LZW_ERR_IO;
+    }
+    Comparison cmp = {&original, 0, 0};
+    int status = decode_reader(&in, input_file, params, compare_original, &cmp, totals);
+    if (status == LZW_OK && !original.failed && (original.pos < original.len || lzw_reader_fill(&original) > 0)) {
+        cmp.differs = 1;
+        cmp.differs_at = lzw_reader_tell(&original);
+    }
+    if (original.failed) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot read %s.", original_file);
+        status = LZW_ERR_IO;
+    } else if (cmp.differs) {
+        snprintf(totals->message, sizeof(totals->message), "The input does not match %s from byte %llu on.",
+                 original_file, (unsigned long long)cmp.differs_at);
+        status = LZW_ERR_MISMATCH;
+    }
+    lzw_reader_close(&original);
+    lzw_reader_close(&in);
+    return status;
+}
+
+// A compressed file opened for random access through its block index
+typedef struct {
+    FILE *file;
+    LzwFileHeader header;
+    LzwBlockInfo *blocks;
+    uint64_t *starts;           // uncompressed offset of each block
+    uint64_t count;
+    uint64_t total_size;        // uncompressed bytes in the whole file
+    BlockDecoder dec;
+    const LzwDictionary *dictionary;    // the one the header names, or NULL
+    LzwWriter block;            // the most recently decoded block, still filtered
+    const unsigned char *data;  // that block's bytes
+    uint64_t cached;            // its number, count if there is none
+    unsigned char *unfiltered;
+    unsigned char *scratch;
+    unsigned char *payload;     // block header and code stream being decoded
+    size_t payload_size;
+    uint64_t bytes_read;        // of the compressed file
+    LzwStats stats;
+    ErrorState error;
+} Archive;
+
+static int read_at(Archive *ar, uint64_t offset, void *data, size_t size) {
+    double start = lzw_stats_clock();
+    if (fseeko(ar->file, (off_t)offset, SEEK_SET) != 0) {
+        return -1;
+    }
+    size_t n = fread(data, 1, size, ar->file);
+    ar->bytes_read += n;
+    ar->stats.io_seconds += lzw_stats_clock() - start;
+    return n == size ? 0 : -1;
+}
+
+static void archive_close(Archive *ar) {
+    if (ar->file != NULL) {
+        fclose(ar->file);
+    }
+    free(ar->blocks);
+    free(ar->starts);
+    free(ar->payload);
+    free(ar->unfiltered);
+    free(ar->scratch);
+    block_decoder_free(&ar->dec);
+    lzw_writer_close(&ar->block);
+}
+
+// Open path and load its block index. Returns a status code, with the
+// reason the file cannot be read at random in ar->error.
+static int archive_open(Archive *ar, const char *path, const LzwDictionary *dictionary) {
+    memset(ar, 0, sizeof(*ar));
+    if (strcmp(path, "-") == 0) {
+        return fail(&ar->error, LZW_ERR_PARAM, "Extracting needs a seekable file, not stdin.");
+    }
+    ar->file = fopen(path, "rb");
+    if (ar->file == NULL) {
+        return fail(&ar->error, LZW_ERR_IO, "Cannot open %s.", path);
+    }
+
+    unsigned char header_data[LZW_FILE_HEADER_SIZE];
+    if (read_at(ar, 0, header_data, sizeof(header_data)) != 0 ||
+        lzw_parse_file_header(header_data, &ar->header) != 0) {
+        return fail(&ar->error, LZW_ERR_FORMAT, "%s is not an LZW container of versions %d-%d.", path,
+                    LZW_MIN_FORMAT_VERSION, LZW_FORMAT_VERSION);
+    }
+    if (!header_valid(&ar->header)) {
+        return fail(&ar->error, LZW_ERR_FORMAT, "Invalid dictionary size: %d bits or block size: %u bytes.",
+                    ar->header.max_code_bits, ar->header.block_size);
+    }
+    if (check_dictionary(&ar->header, dictionary, &ar->error) != LZW_OK) {
+        return ar->error.status;
+    }
+    ar->dictionary = ar->header.dictionary_id != 0 ? dictionary : NULL;
+
+    // The trailer ends the file and locates the index in front of it
+    if (fseeko(ar->file, 0, SEEK_END) != 0) {
+        return fail(&ar->error, LZW_ERR_PARAM, "%s is not seekable.", path);
+    }
+    uint64_t file_size = (uint64_t)ftello(ar->file);
+    LzwIndex index = {NULL, 0, 0};
+    LzwTrailer trailer;
+    double start = lzw_stats_clock();
+    int result = lzw_read_index(ar->file, file_size, &ar->header, &index, &trailer);
+    ar->stats.io_seconds += lzw_stats_clock() - start;
+    ar->blocks = index.blocks;
+    if (result == -2) {
+        return fail(&ar->error, LZW_ERR_MEMORY, "Memory allocation failed for block index.");
+    }
+    if (result == -3) {
+        return fail(&ar->error, LZW_ERR_CORRUPT, "Invalid index entry for block %llu.",
+                    (unsigned long long)index.count);
+    }
+    if (result != 0) {
+        return fail(&ar->error, LZW_ERR_CORRUPT, "Missing or inconsistent block index.");
+    }
+    ar->count = index.count;
+    ar->bytes_read += lzw_trailer_size(ar->header.version) + ar->count * LZW_INDEX_ENTRY_SIZE;
+
+    ar->starts = malloc(((size_t)ar->count + 1) * sizeof(uint64_t));
+    if (ar->starts == NULL) {
+        return fail(&ar->error, LZW_ERR_MEMORY, "Memory allocation failed for block index.");
+    }
+    uint64_t offset = 0;
+    for (uint64_t i = 0; i < ar->count; i++) {
+        ar->starts[i] = offset;
+        offset += ar->blocks[i].uncompressed_size;
+    }
+    ar->total_size = offset;
+
+    if (block_decoder_init(&ar->dec, ar->header.max_code_bits) != 0 ||
+        lzw_writer_open_memory(&ar->block, ar->header.block_size) != 0) {
+        return fail(&ar->error, LZW_ERR_MEMORY, "Memory allocation failed for dictionary.");
+    }
+    ar->cached = ar->count;
+    return LZW_OK;
+}
+
+// Decode block i into ar->block
+static int archive_load(Archive *ar, uint64_t i) {
+    if (ar->cached == i) {
+        return LZW_OK;
+    }
+    const LzwBlockInfo *info = &ar->blocks[i];
+    size_t size = LZW_BLOCK_HEADER_SIZE + (size_t)info->compressed_size;
+    if (ar->payload_size < size) {
+        free(ar->payload);
+        ar->payload = malloc(size);
+        ar->payload_size = ar->payload != NULL ? size : 0;
+        if (ar->payload == NULL) {
+            return fail(&ar->error, LZW_ERR_MEMORY, "Memory allocation failed for block buffer.");
+        }
+    }
+    if (read_at(ar, info->offset, ar->payload, size) != 0) {
+        return fail(&ar->error, LZW_ERR_CORRUPT, "Truncated file in block %llu.", (unsigned long long)i);
+    }
+
+    // The block header must agree with the index that pointed at it
+    LzwBlockInfo stored;
+    lzw_parse_block_header(ar->payload, &stored);
+    if (stored.compressed_size != info->compressed_size || stored.uncompressed_size != info->uncompressed_size ||
+        stored.checksum != info->checksum || !block_header_valid(&stored, &ar->header)) {
+        return fail(&ar->error, LZW_ERR_CORRUPT, "Block %llu does not match the index.", (unsigned long long)i);
+    }
+
+    ar->cached = ar->count;
+    if (stored.filter.type != LZW_FILTER_NONE &&
+        filter_buffers(&ar->unfiltered, &ar->scratch, ar->header.block_size) != 0) {
+        return fail(&ar->error, LZW_ERR_MEMORY, "Memory allocation failed for filter buffers.");
+    }
+    const char *error;
+    int status = decode_and_finish(&ar->dec, &stored, ar->header.version, ar->dictionary,
+                                   ar->payload + LZW_BLOCK_HEADER_SIZE, &ar->block, ar->unfiltered, ar->scratch,
+                                   &ar->data, &error, &ar->stats);
+    if (status != LZW_OK) {
+        return fail(&ar->error, status, "%s in block %llu.", error, (unsigned long long)i);
+    }
+    ar->cached = i;
+    return LZW_OK;
+}
+
+// Write bytes [offset, offset + length) of the original file to out,
+// decoding only the blocks that overlap them
+static int archive_read(Archive *ar, uint64_t offset, uint64_t length, LzwWriter *out) {
+    if (offset > ar->total_size || length > ar->total_size - offset) {
+        return fail(&ar->error, LZW_ERR_RANGE, "Range %llu:%llu is past the end of the %llu byte file.",
+                    (unsigned long long)offset, (unsigned long long)length, (unsigned long long)ar->total_size);
+    }
+
+    // Find the last block starting at or before offset
+    uint64_t lo = 0, hi = ar->count;
+    while (hi - lo > 1) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (ar->starts[mid] <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (uint64_t i = lo; length > 0; i++) {
+        if (archive_load(ar, i) != LZW_OK) {
+            return ar->error.status;
+        }
+        uint64_t skip = offset - ar->starts[i];
+        uint64_t n = ar->blocks[i].uncompressed_size - skip;
+        if (n > length) {
+            n = length;
+        }
+        lzw_writer_write(out, ar->data + skip, (size_t)n);
+        offset += n;
+        length -= n;
+    }
+    if (out->failed) {
+        return fail(&ar->error, LZW_ERR_IO, "Cannot write output.");
+    }
+    return LZW_OK;
+}
+
+// Parse the npz_to_bin.py header at the start of the original file,
+// decoding more of it until the whole header is in hand
+static int archive_read_binfile(Archive *ar, LzwBinFile *bin) {
+    LzwWriter head;
+    if (lzw_writer_open_memory(&head, 4096) != 0) {
+        return fail(&ar->error, LZW_ERR_MEMORY, "Memory allocation failed for array list.");
+    }
+    uint64_t want = 4096;
+    int status;
+    for (;;) {
+        if (want > ar->total_size) {
+            want = ar->total_size;
+        }
+        head.len = 0;
+        if (archive_read(ar, 0, want, &head) != LZW_OK) {
+            lzw_writer_close(&head);
+            return ar->error.status;
+        }
+        status = lzw_binfile_parse(head.buffer, head.len, bin);
+        if (status != 1 || want == ar->total_size) {
+            break;
+        }
+        want *= 2;
+    }
+    lzw_writer_close(&head);
+    if (status == -2) {
+        return fail(&ar->error, LZW_ERR_MEMORY, "Memory allocation failed for array list.");
+    }
+    if (status != 0) {
+        return fail(&ar->error, LZW_ERR_FORMAT, "The compressed file does not hold an npz_to_bin.py header.");
+    }
+    return LZW_OK;
+}
+
+// Open input_file for random access and output_file for writing
+static int open_extract(Archive *ar, const char *input_file, const char *output_file,
+                        FILE **output, LzwWriter *out, const LzwParams *params) {
+    memset(out, 0, sizeof(*out));
+    *output = NULL;
+    if (archive_open(ar, input_file, params->dictionary) != LZW_OK) {
+        return ar->error.status;
+    }
+    *output = lzw_open_output(output_file);
+    if (*output == NULL) {
+        return fail(&ar->error, LZW_ERR_IO, "Cannot open %s.", output_file);
+    }
+    if (lzw_writer_open_file(out, *output, params->io_buffer_size) != 0) {
+        return fail(&ar->error, LZW_ERR_MEMORY, "Memory allocation failed for output buffer.");
+    }
+    return LZW_OK;
+}
+
+static int close_extract(Archive *ar, const char *output_file, FILE *output, LzwWriter *out, LzwTotals *totals) {
+    LzwTotals local;
+    if (totals == NULL) {
+        totals = &local;
+    }
+    totals->input_bytes = ar->bytes_read;
+    totals->output_bytes = lzw_writer_tell(out);
+    totals->stats = ar->stats;
+    totals->stats.enabled = LZW_STATS_ENABLED;
+    lzw_writer_close(out);
+    if (output != NULL && (lzw_close_output(output) != 0 || out->failed)) {
+        fail(&ar->error, LZW_ERR_IO, "Cannot write %s.", output_file);
+    }
+    snprintf(totals->message, sizeof(totals->message), "%s", ar->error.status != LZW_OK ? ar->error.message : "");
+    archive_close(ar);
+    return ar->error.status;
+}
+
+int lzw_decompress_range(const char *input_file, const char *output_file,
+                         uint64_t offset, uint64_t length, const LzwParams *params, LzwTotals *totals) {
+    Archive ar;
+    FILE *output;
+    LzwWriter out;
+    if (open_extract(&ar, input_file, output_file, &output, &out, params) == LZW_OK) {
+        archive_read(&ar, offset, length, &out);
+    }
+    return close_extract(&ar, output_file, output, &out, totals);
+}
+
+int lzw_decompress_key(const char *input_file, const char *output_file,
+                       const char *key, const LzwParams *params, LzwTotals *totals) {
+    Archive ar;
+    FILE *output;
+    LzwWriter out;
+    LzwBinFile bin;
+    if (open_extract(&ar, input_file, output_file, &output, &out, params) == LZW_OK &&
+        archive_read_binfile(&ar, &bin) == LZW_OK) {
+        const LzwBinArray *array = lzw_binfile_find(&bin, key);
+        if (array == NULL) {
+            fail(&ar.error, LZW_ERR_RANGE, "No array named '%s'.", key);
+        } else {
+            archive_read(&ar, array->offset, array->size, &out);
+        }
+        lzw_binfile_free(&bin);
+    }
+    return close_extract(&ar, output_file, output, &out, totals);
+}
+
+// Open archive_file and read its member table. Returns a status code, with
+// the reason in error.
+static int open_members(const char *archive_file, FILE **file, LzwMember **members, size_t *count,
+                        ErrorState *error) {
+    *members = NULL;
+    *count = 0;
+    *file = NULL;
+    if (strcmp(archive_file, "-") == 0) {
+        return fail(error, LZW_ERR_PARAM, "Reading members needs a seekable file, not stdin.");
+    }
+    *file = fopen(archive_file, "rb");
+    if (*file == NULL) {
+        return fail(error, LZW_ERR_IO, "Cannot open %s.", archive_file);
+    }
+    if (fseeko(*file, 0, SEEK_END) != 0) {
+        return fail(error, LZW_ERR_PARAM, "%s is not seekable.", archive_file);
+    }
+    int result = lzw_read_members(*file, (uint64_t)ftello(*file), members, count);
+    if (result == -2) {
+        return fail(error, LZW_ERR_MEMORY, "Memory allocation failed for member table.");
+    }
+    if (result != 0) {
+        return fail(error, LZW_ERR_FORMAT, "%s is not an archive with a valid member table.", archive_file);
+    }
+    return LZW_OK;
+}
+
+int lzw_archive_members(const char *archive_file, LzwMember **members, size_t *count, LzwTotals *totals) {
+    LzwTotals local;
+    if (totals == NULL) {
+        totals = &local;
+    }
+    memset(totals, 0, sizeof(*totals));
+    ErrorState error = {LZW_OK, ""};
+    FILE *file;
+    int status = open_members(archive_file, &file, members, count, &error);
+    if (file != NULL) {
+        fclose(file);
+    }
+    snprintf(totals->message, sizeof(totals->message), "%s", error.message);
+    return status;
+}
+
+// Decode the member's container, and nothing after it, into
+// write(context, ...), filling in totals
+static int decode_member(FILE *file, const LzwMember *member, const char *archive_file, const LzwParams *params,
+                         LzwWriteFn write, void *context, LzwTotals *totals) {
+    size_t buffer_size = params->io_buffer_size > LZW_IO_MIN_BUFFER_SIZE ? params->io_buffer_size
+                                                                         : LZW_IO_MIN_BUFFER_SIZE;
+    unsigned char *buffer = malloc(buffer_size);
+    LzwDecoder *dec = NULL;
+    int status = buffer != NULL ? lzw_decoder_create(&dec, params, write, context) : LZW_ERR_MEMORY;
+    if (status == LZW_OK && fseeko(file, (off_t)member->offset, SEEK_SET) != 0) {
+        status = fail(&dec->error, LZW_ERR_IO, "Cannot read %s.", archive_file);
+    }
+    double read_seconds = 0;
+    uint64_t left = member->length;
+    while (status == LZW_OK && left > 0) {
+        double start = lzw_stats_clock();
+        size_t n = fread(buffer, 1, left < buffer_size ? (size_t)left : buffer_size, file);
+        read_seconds += lzw_stats_clock() - start;
+        if (n == 0) {
+            status = fail(&dec->error, LZW_ERR_IO, "Cannot read %s.", archive_file);
+            break;
+        }
+        left -= n;
+        status = lzw_decoder_decode(dec, buffer, n);
+    }
+    if (status == LZW_OK) {
+        status = lzw_decoder_finish(dec);
+    }
+
+    if (dec != NULL) {
+        lzw_decoder_totals(dec, totals);
+        totals->stats.io_seconds += read_seconds;
+        snprintf(totals->message, sizeof(totals->message), "%s", lzw_decoder_message(dec));
+    } else {
+        snprintf(totals->message, sizeof(totals->message), "%s", lzw_strerror(status));
+    }
+    lzw_decoder_destroy(dec);
+    free(buffer);
+    return status;
+}
+
+int lzw_decompress_member(const char *archive_file, const char *output_file, const char *name,
+                          const LzwParams *params, LzwTotals *totals) {
+    LzwTotals local;
+    if (totals == NULL) {
+        totals = &local;
+    }
+    memset(totals, 0, sizeof(*totals));
+
+    ErrorState error = {LZW_OK, ""};
+    FILE *file;
+    LzwMember *members;
+    size_t count;
+    const LzwMember *member = NULL;
+    if (open_members(archive_file, &file, &members, &count, &error) == LZW_OK) {
+        for (size_t i = 0; i < count && member == NULL; i++) {
+            if (strcmp(members[i].name, name) == 0) {
+                member = &members[i];
+            }
+        }
+        if (member == NULL) {
+            fail(&error, LZW_ERR_RANGE, "No member named '%s'.", name);
+        }
+    }
+    FILE *output = NULL;
+    if (error.status == LZW_OK && (output = lzw_open_output(output_file)) == NULL) {
+        fail(&error, LZW_ERR_IO, "Cannot open %s.", output_file);
+    }
+    if (error.status != LZW_OK) {
+        if (file != NULL) {
+            fclose(file);
+        }
+        free(members);
+        snprintf(totals->message, sizeof(totals->message), "%s", error.message);
+        return error.status;
+    }
+
+    // As in lzw_decompress, writes run on a thread of their own
+    LzwWriteStage writing;
+    int status;
+    if (lzw_write_stage_start(&writing, output, params->io_buffer_size) != 0) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot start the output thread.");
+        status = LZW_ERR_MEMORY;
+    } else {
+        status = decode_member(file, member, archive_file, params, lzw_write_stage_write, &writing, totals);
+        if (lzw_write_stage_finish(&writing) != 0 && status == LZW_OK) {
+            snprintf(totals->message, sizeof(totals->message), "Cannot write %s.", output_file);
+            status = LZW_ERR_IO;
+        }
+    }
+    if (lzw_close_output(output) != 0 && status == LZW_OK) {
+        snprintf(totals->message, sizeof(totals->message), "Cannot write %s.", output_file);
+        status = LZW_ERR_IO;
+    }
+    fclose(file);
+    free(members);
+    return status;
+}
@@ -0,0 +1,231 @@
+// Decoder core for one symbol width, the counterpart of lzw_encode_impl.h.
+// lzw_decode.c includes this once with SYMBOL_BITS set to 8 and once
+// with 16.
+//
+// Provides IMPL(DictEntry), IMPL(block_decoder_prepare) and
+// IMPL(decode_block), and expects BlockDecoder to have IMPL(dictionary)
+// members for both widths, an arena they are carved from, symbol_bits
+// recording which width the arena currently holds and primed recording the
+// dictionary its table holds, plus copy_match and COPY_SLACK from
+// lzw_decode.c.
+
+#if SYMBOL_BITS == 8
+#define IMPL(name) name##8
+#elif SYMBOL_BITS == 16
+#define IMPL(name) name##16
+#else
+#error "SYMBOL_BITS must be 8 or 16"
+#endif
+
+#define SYMBOL_BYTES (SYMBOL_BITS / 8)
+#define ROOT_COUNT (1 << SYMBOL_BITS)
+#define CODE_CLEAR ROOT_COUNT
+#define CODE_END (ROOT_COUNT + 1)
+#define CODE_RUN (ROOT_COUNT + 2)
+#define FIRST_CODE (ROOT_COUNT + 3)
+
+// A phrase is stored as where it already appears in the block's output.
+// Every entry is an earlier phrase plus the first symbol written after it,
+// so those bytes sit contiguously in the output and decoding a code is one
+// copy, however long the phrase.
+typedef struct IMPL(DictEntry) {
+    uint32_t offset;        // of the phrase's first byte in the block output
+    uint32_t length;        // phrase length in bytes
+} IMPL(DictEntry);
+
+// Lay the decoder's arena out for this width, unless the previous block
+// already used it. Returns -1 if memory runs out.
+static int IMPL(block_decoder_prepare)(BlockDecoder *dec) {
+    if (dec->symbol_bits == SYMBOL_BITS) {
+        return 0;
+    }
+
+    // Roots are never looked up, but keeping their slots lets codes index
+    // the table directly
+    lzw_arena_reset(&dec->arena);
+    dec->dictionary8 = NULL;
+    dec->dictionary16 = NULL;
+    dec->symbol_bits = 0;
+    dec->primed = NULL;
+    dec->IMPL(dictionary) = lzw_arena_alloc(&dec->arena, (size_t)dec->max_dict_size * sizeof(IMPL(DictEntry)));
+    if (dec->IMPL(dictionary) == NULL) {
+        return -1;
+    }
+    dec->symbol_bits = SYMBOL_BITS;
+    return 0;
+}
+
+// Decode one block's code stream into out, which must be an in-memory
+// writer and should receive at most max_out bytes, starting from the
+// phrases of preset unless it is NULL and growing the dictionary by the
+// LZW_GROWTH_* rule growth, reading codes through huffman unless that is
+// NULL. Returns LZW_OK, LZW_ERR_MEMORY if
+// out cannot hold the block, or LZW_ERR_CORRUPT if the stream is truncated,
+// holds an impossible code or decodes to too much. Adds its counts to stats
+// once the block is complete.
+static int IMPL(decode_block)(BlockDecoder *dec, const LzwDictionary *preset, int growth, const LzwHuffman *huffman,
+                              const unsigned char *data, size_t len, LzwWriter *out, size_t max_out,
+                              LzwStats *stats) {
+    IMPL(DictEntry) *dictionary = dec->IMPL(dictionary);
+    int max_dict_size = dec->max_dict_size;
+
+    // Primed phrases are offsets into the sample, which is copied in ahead
+    // of the block and moved out of the way at the end. Their entries are
+    // never overwritten, so the table keeps them from block to block.
+    uint32_t primed = preset != NULL ? lzw_dictionary_codes(preset, max_dict_size) : 0;
+    size_t primed_bytes = lzw_dictionary_extent(preset, primed);
+    if (primed > 0 && (dec->primed != preset || dec->primed_codes != primed)) {
+        for (uint32_t i = 0; i < primed; i++) {
+            dictionary[FIRST_CODE + i].offset = preset->phrases[i].offset;
+            dictionary[FIRST_CODE + i].length = preset->phrases[i].length;
+        }
+    }
+    dec->primed = primed > 0 ? preset : NULL;
+    dec->primed_codes = primed;
+    int first_code = FIRST_CODE + (int)primed;
+    int dict_size = first_code;
+
+    // Phrases are copied straight into the writer's buffer, with room for
+    // the wide copies to run past the end of the block
+    if (lzw_writer_reserve(out, primed_bytes + max_out + COPY_SLACK) != 0) {
+        return LZW_ERR_MEMORY;
+    }
+    unsigned char *base = out->buffer + out->len;
+    if (primed_bytes > 0) {
+        memcpy(base, preset->data, primed_bytes);
+    }
+    unsigned char *start = base + primed_bytes;
+    unsigned char *dst = start;
+    unsigned char *limit_end = start + max_out / SYMBOL_BYTES * SYMBOL_BYTES;
+
+    LzwReader in;
+    lzw_reader_open_memory(&in, data, len);
+    BitReader reader;
+    bit_reader_init(&reader, &in);
+    LzwStats counts;
+    memset(&counts, 0, sizeof(counts));
+
+    uint32_t code;
+    int prev_code = -1;     // -1 at the start and after a CLEAR or RUN
+    uint32_t prev_offset = 0, prev_length = 0;  // where the previous phrase was written
+
+    for (;;) {
+        // Mirror the encoder's width: once a phrase has been seen an LZW
+        // encoder has already added the entry this code will complete,
+        // unless it is full
+        int limit = (growth == LZW_GROWTH_LZW && prev_code >= 0 && dict_size < max_dict_size) ? dict_size + 1
+                                                                                                : dict_size;
+        int read = huffman != NULL ? lzw_huffman_read(&reader, huffman, &code)
+                                   : bit_read(&reader, lzw_code_width(limit), &code);
+        if (!read) {
+            return LZW_ERR_CORRUPT;
+        }
+        int curr_code = (int)code;
+        size_t room = (size_t)(limit_end - dst);
+
+        if (curr_code == CODE_END) {
+            size_t produced = (size_t)(dst - start);
+            if (primed_bytes > 0) {
+                memmove(base, start, produced);
+            }
+            out->len += produced;
+            LZW_COUNT((counts.blocks = 1, counts.symbols = (uint64_t)produced / SYMBOL_BYTES));
+            lzw_stats_add(stats, &counts);
+            return LZW_OK;
+        }
+        if (curr_code == CODE_CLEAR) {
+            LZW_COUNT(counts.clears++);
+            dict_size = first_code;
+            prev_code = -1;
+            continue;
+        }
+
+        const unsigned char *phrase = dst;
+        if (curr_code == CODE_RUN) {
+            // See lzw_encode_impl.h for the layout
+            uint32_t symbol, bits, extra = 0;
+            if (!bit_read(&reader, SYMBOL_BITS, &symbol) || !bit_read(&reader, 5, &bits) ||
+                (bits > 0 && !bit_read(&reader, (int)bits, &extra))) {
+                return LZW_ERR_CORRUPT;
+            }
+            size_t count = LZW_RUN_MIN + (size_t)extra;
+            if (bits > 30 || count > room / SYMBOL_BYTES) {
+                return LZW_ERR_CORRUPT;
+            }
+#if SYMBOL_BITS == 8
+            memset(dst, (int)symbol, count);
+#else
+            store_u16(dst, (uint16_t)symbol);
+            copy_match(dst + SYMBOL_BYTES, dst, (count - 1) * SYMBOL_BYTES);
+#endif
+            dst += count * SYMBOL_BYTES;
+            LZW_COUNT((counts.runs++, counts.run_symbols += count));
+        } else if (curr_code < ROOT_COUNT) {
+            if (room < SYMBOL_BYTES) {
+                return LZW_ERR_CORRUPT;
+            }
+#if SYMBOL_BITS == 8
+            *dst = (unsigned char)curr_code;
+#else
+            store_u16(dst, (uint16_t)curr_code);
+#endif
+            dst += SYMBOL_BYTES;
+        } else if (curr_code >= FIRST_CODE && curr_code < dict_size) {
+            // Sequence exists in the dictionary, earlier in the output
+            IMPL(DictEntry) entry = dictionary[curr_code];
+            if (entry.length > room) {
+                return LZW_ERR_CORRUPT;
+            }
+            copy_match(dst, base + entry.offset, entry.length);
+            dst += entry.length;
+        } else if (curr_code == dict_size && growth == LZW_GROWTH_LZW && prev_code >= 0 &&
+                   dict_size < max_dict_size) {
+            // Special case: curr_code is the previous phrase plus its own
+            // first symbol, a copy that overlaps its own output
+            size_t length = (size_t)prev_length + SYMBOL_BYTES;
+            if (length > room) {
+                return LZW_ERR_CORRUPT;
+            }
+            copy_match(dst, base + prev_offset, length);
+            dst += length;
+        } else {
+            return LZW_ERR_CORRUPT;
+        }
+
+        LZW_COUNT(counts.codes++);
+
+        // Add previous phrase plus the first symbol of this one, or all of
+        // it, or each prefix of it, to the dictionary; they are already next
+        // to each other in the output. Only LZW adds to the phrase before a
+        // RUN.
+        if (prev_code >= 0 && dict_size < max_dict_size && (growth == LZW_GROWTH_LZW || curr_code != CODE_RUN)) {
+            uint32_t length = growth == LZW_GROWTH_LZW ? SYMBOL_BYTES : (uint32_t)(dst - phrase);
+            uint32_t step = growth == LZW_GROWTH_LZAP ? SYMBOL_BYTES : length;
+            for (uint32_t n = step; n <= length && dict_size < max_dict_size; n += step) {
+                dictionary[dict_size].offset = prev_offset;
+                dictionary[dict_size].length = prev_length + n;
+                dict_size++;
+            }
+            if (dict_size == max_dict_size && counts.filled_blocks == 0) {
+                LZW_COUNT((counts.filled_blocks = 1, counts.fill_symbols = (uint64_t)(phrase - start) / SYMBOL_BYTES));
+            }
+        }
+
+        // A RUN leaves no phrase pending, whatever its length
+        if (curr_code == CODE_RUN) {
+            prev_code = -1;
+        } else {
+            prev_code = curr_code;
+            prev_offset = (uint32_t)(phrase - base);
+            prev_length = (uint32_t)(dst - phrase);
+        }
+    }
+}
+
+#undef IMPL
+#undef SYMBOL_BYTES
+#undef ROOT_COUNT
+#undef CODE_CLEAR
+#undef CODE_END
+#undef CODE_RUN
+#undef FIRST_CODE
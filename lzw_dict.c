@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lzw_dict.h"
+#include "lzw_checksum.h"
+#include "lzw_container.h"
+
+// Training scores stretches of TRAIN_SEGMENT bytes by how often their
+// TRAIN_KMER-byte substrings occur anywhere in the samples, counted in a
+// table of 2^TRAIN_HASH_BITS counters
+#define TRAIN_SEGMENT 1024
+#define TRAIN_KMER 8
+#define TRAIN_HASH_BITS 22
+
+static uint32_t load_symbol(const unsigned char *p, int symbol_bits) {
+    return symbol_bits == 8 ? p[0] : (uint32_t)lzw_get_u16(p);
+}
+
+static uint32_t dictionary_id(int symbol_bits, const unsigned char *data, size_t size) {
+    unsigned char width = (unsigned char)symbol_bits;
+    uint32_t id = lzw_adler32(lzw_adler32(LZW_ADLER32_INIT, &width, 1), data, size);
+    return id != 0 ? id : 1;
+}
+
+// Parse the sample as the coder would, recording every phrase it learns.
+// Returns -1 if memory runs out.
+static int build_phrases(LzwDictionary *dict) {
+    int symbol_bytes = dict->symbol_bits / 8;
+    size_t symbols = dict->size / (size_t)symbol_bytes;
+    uint32_t first_code = (1u << dict->symbol_bits) + 3;
+    uint32_t max_phrases = (1u << LZW_MAX_CODE_BITS) / 2;
+    if (symbols < max_phrases) {
+        max_phrases = (uint32_t)symbols;
+    }
+
+    // Open-addressed table of (prefix, symbol) + 1 keys, twice the phrases
+    int hash_bits = 1;
+    while ((1u << hash_bits) < 2 * max_phrases + 2) {
+        hash_bits++;
+    }
+    uint32_t mask = (1u << hash_bits) - 1;
+    uint64_t *keys = calloc((size_t)mask + 1, sizeof(uint64_t));
+    uint32_t *codes = malloc(((size_t)mask + 1) * sizeof(uint32_t));
+    dict->phrases = malloc(((size_t)max_phrases + 1) * sizeof(LzwPhrase));
+    if (keys == NULL || codes == NULL || dict->phrases == NULL) {
+        free(keys);
+        free(codes);
+        return -1;
+    }
+
+    uint32_t count = 0;
+    int64_t prefix = -1;
+    size_t start = 0;           // where the phrase matched so far begins
+    for (size_t i = 0; i < symbols; i++) {
+        size_t offset = i * (size_t)symbol_bytes;
+        uint32_t symbol = load_symbol(dict->data + offset, dict->symbol_bits);
+        if (prefix < 0) {
+            prefix = symbol;
+            start = offset;
+            continue;
+        }
+        uint64_t key = (((uint64_t)prefix << dict->symbol_bits) | symbol) + 1;
+        uint32_t slot = (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> (64 - hash_bits));
+        while (keys[slot] != 0 && keys[slot] != key) {
+            slot = (slot + 1) & mask;
+        }
+        if (keys[slot] == key) {
+            prefix = codes[slot];
+            continue;
+        }
+        if (count < max_phrases) {
+            LzwPhrase *phrase = &dict->phrases[count];
+            phrase->offset = (uint32_t)start;
+            phrase->length = (uint32_t)(offset + (size_t)symbol_bytes - start);
+            phrase->prefix = (uint32_t)prefix;
+            phrase->symbol = symbol;
+            keys[slot] = key;
+            codes[slot] = first_code + count;
+            count++;
+        }
+        prefix = symbol;
+        start = offset;
+    }
+    dict->phrase_count = count;
+    free(keys);
+    free(codes);
+    return 0;
+}
+
+// Take ownership of data and derive the rest of the dictionary from it
+static int dictionary_create(LzwDictionary **dictionary, unsigned char *data, size_t size, int symbol_bits) {
+    LzwDictionary *dict = calloc(1, sizeof(LzwDictionary));
+    *dictionary = dict;
+    if (dict == NULL) {
+        free(data);
+        return LZW_ERR_MEMORY;
+    }
+    dict->data = data;
+    dict->size = size;
+    dict->symbol_bits = symbol_bits;
+    dict->id = dictionary_id(symbol_bits, data, size);
+    if (build_phrases(dict) != 0) {
+        lzw_dictionary_free(dict);
+        *dictionary = NULL;
+        return LZW_ERR_MEMORY;
+    }
+    return LZW_OK;
+}
+
+void lzw_dictionary_free(LzwDictionary *dict) {
+    if (dict == NULL) {
+        return;
+    }
+    free(dict->data);
+    free(dict->phrases);
+    free(dict);
+}
+
+uint32_t lzw_dictionary_id(const LzwDictionary *dict) {
+    return dict->id;
+}
+
+size_t lzw_dictionary_size(const LzwDictionary *dict) {
+    return dict->size;
+}
+
+int lzw_dictionary_load(LzwDictionary **dictionary, const char *path) {
+    *dictionary = NULL;
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return LZW_ERR_IO;
+    }
+    unsigned char header[LZW_DICT_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, LZW_DICT_MAGIC, 4) != 0 ||
+        lzw_get_u16(header + 4) != LZW_DICT_VERSION || (header[6] != 8 && header[6] != 16)) {
+        fclose(file);
+        return LZW_ERR_FORMAT;
+    }
+    int symbol_bits = header[6];
+    uint32_t id = lzw_get_u32(header + 8);
+    size_t size = lzw_get_u32(header + 12);
+    if (size == 0 || size > LZW_MAX_DICTIONARY_BYTES) {
+        fclose(file);
+        return LZW_ERR_FORMAT;
+    }
+    unsigned char *data = malloc(size);
+    if (data == NULL) {
+        fclose(file);
+        return LZW_ERR_MEMORY;
+    }
+    size_t n = fread(data, 1, size, file);
+    fclose(file);
+    if (n != size || dictionary_id(symbol_bits, data, size) != id) {
+        free(data);
+        return LZW_ERR_FORMAT;
+    }
+    return dictionary_create(dictionary, data, size, symbol_bits);
+}
+
+int lzw_dictionary_save(const LzwDictionary *dict, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return LZW_ERR_IO;
+    }
+    unsigned char header[LZW_DICT_HEADER_SIZE];
+    memcpy(header, LZW_DICT_MAGIC, 4);
+    lzw_put_u16(header + 4, LZW_DICT_VERSION);
+    header[6] = (unsigned char)dict->symbol_bits;
+    header[7] = 0;
+    lzw_put_u32(header + 8, dict->id);
+    lzw_put_u32(header + 12, (uint32_t)dict->size);
+    int failed = fwrite(header, 1, sizeof(header), file) != sizeof(header) ||
+                 fwrite(dict->data, 1, dict->size, file) != dict->size;
+    failed |= fclose(file) != 0;
+    return failed ? LZW_ERR_IO : LZW_OK;
+}
+
+// A stretch of one sample that training may copy into the dictionary
+typedef struct {
+    const unsigned char *data;
+    uint64_t score;
+} Candidate;
+
+static uint32_t kmer_hash(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return (uint32_t)((v * 0x9E3779B97F4A7C15ull) >> (64 - TRAIN_HASH_BITS));
+}
+
+// Sum of how often the segment's substrings occur, each counted once per
+// position; content already taken counts 0
+static uint64_t segment_score(const unsigned char *segment, const uint32_t *counts, int step) {
+    uint64_t score = 0;
+    for (size_t i = 0; i + TRAIN_KMER <= TRAIN_SEGMENT; i += (size_t)step) {
+        uint32_t n = counts[kmer_hash(segment + i)];
+        score += n > 1 ? n - 1 : 0;
+    }
+    return score;
+}
+
+// Max-heap of candidates by score
+static void sift_down(Candidate *heap, size_t count, size_t i) {
+    for (;;) {
+        size_t best = i, left = 2 * i + 1, right = left + 1;
+        if (left < count && heap[left].score > heap[best].score) {
+            best = left;
+        }
+        if (right < count && heap[right].score > heap[best].score) {
+            best = right;
+        }
+        if (best == i) {
+            return;
+        }
+        Candidate swap = heap[i];
+        heap[i] = heap[best];
+        heap[best] = swap;
+        i = best;
+    }
+}
+
+int lzw_dictionary_train(LzwDictionary **dictionary, const unsigned char *const *samples, const size_t *sizes,
+                         size_t count, size_t max_size, int symbol_bits) {
+    *dictionary = NULL;
+    if ((symbol_bits != 8 && symbol_bits != 16) || max_size == 0) {
+        return LZW_ERR_PARAM;
+    }
+    if (max_size > LZW_MAX_DICTIONARY_BYTES) {
+        max_size = LZW_MAX_DICTIONARY_BYTES;
+    }
+    int step = symbol_bits / 8;
+
+    // Count every substring, then make each whole segment a candidate
+    size_t candidate_count = 0;
+    for (size_t s = 0; s < count; s++) {
+        candidate_count += sizes[s] / TRAIN_SEGMENT;
+    }
+    if (candidate_count == 0) {
+        return LZW_ERR_FORMAT;
+    }
+    uint32_t *counts = calloc((size_t)1 << TRAIN_HASH_BITS, sizeof(uint32_t));
+    Candidate *heap = malloc(candidate_count * sizeof(Candidate));
+    unsigned char *data = malloc(max_size);
+    if (counts == NULL || heap == NULL || data == NULL) {
+        free(counts);
+        free(heap);
+        free(data);
+        return LZW_ERR_MEMORY;
+    }
+    for (size_t s = 0; s < count; s++) {
+        for (size_t i = 0; i + TRAIN_KMER <= sizes[s]; i += (size_t)step) {
+            uint32_t *n = &counts[kmer_hash(samples[s] + i)];
+            *n += *n < UINT32_MAX;
+        }
+    }
+    size_t heap_count = 0;
+    for (size_t s = 0; s < count; s++) {
+        for (size_t i = 0; i + TRAIN_SEGMENT <= sizes[s]; i += TRAIN_SEGMENT) {
+            heap[heap_count].data = samples[s] + i;
+            heap[heap_count].score = segment_score(samples[s] + i, counts, step);
+            heap_count++;
+        }
+    }
+    for (size_t i = heap_count / 2; i-- > 0;) {
+        sift_down(heap, heap_count, i);
+    }
+
+    // Greedily take the best segment. Taking one makes its content worth
+    // nothing to the rest, so scores only fall, and a segment whose fresh
+    // score still beats every stale one is the true best.
+    size_t size = 0;
+    while (size < max_size && heap_count > 0 && heap[0].score > 0) {
+        Candidate top = heap[0];
+        top.score = segment_score(top.data, counts, step);
+        uint64_t next = heap_count > 1 ? heap[1].score : 0;
+        if (heap_count > 2 && heap[2].score > next) {
+            next = heap[2].score;
+        }
+        if (top.score < next) {
+            heap[0] = top;
+            sift_down(heap, heap_count, 0);
+            continue;
+        }
+        heap[0] = heap[--heap_count];
+        sift_down(heap, heap_count, 0);
+        if (top.score == 0) {
+            continue;
+        }
+        size_t n = max_size - size < TRAIN_SEGMENT ? (max_size - size) / (size_t)step * (size_t)step : TRAIN_SEGMENT;
+        memcpy(data + size, top.data, n);
+        size += n;
+        for (size_t i = 0; i + TRAIN_KMER <= TRAIN_SEGMENT; i += (size_t)step) {
+            counts[kmer_hash(top.data + i)] = 0;
+        }
+        if (n < TRAIN_SEGMENT) {
+            break;
+        }
+    }
+    free(counts);
+    free(heap);
+    if (size == 0) {
+        free(data);
+        return LZW_ERR_FORMAT;
+    }
+    return dictionary_create(dictionary, data, size, symbol_bits);
+}
@@ -0,0 +1,58 @@
+#ifndef LZW_DICT_H
+#define LZW_DICT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lzw.h"
+
+// Dictionary file layout, all integers little-endian:
+//
+//   "LZWD", u16 version, u8 symbol_bits, u8 reserved, u32 id, u32 size,
+//   then size bytes of sample data
+//
+// A dictionary is a sample of typical input. Coder and decoder both parse
+// it as LZW would, without emitting anything, and start each block with
+// the phrases that yields as if the block had already learned them. The id
+// is the Adler-32 of the symbol width and the sample, and never 0, which
+// container headers use for no dictionary.
+
+#define LZW_DICT_MAGIC "LZWD"
+#define LZW_DICT_VERSION 1
+#define LZW_DICT_HEADER_SIZE 16
+
+// The phrase with code first_code + i of the sample, which is an earlier
+// phrase or a root plus one symbol
+typedef struct {
+    uint32_t offset;            // of its first byte in the sample
+    uint32_t length;            // in bytes
+    uint32_t prefix;            // code of the phrase without its last symbol
+    uint32_t symbol;            // its last symbol
+} LzwPhrase;
+
+struct LzwDictionary {
+    uint32_t id;
+    int symbol_bits;            // only blocks of this width are primed
+    unsigned char *data;
+    size_t size;
+    LzwPhrase *phrases;         // in code order, ending later and later in data
+    uint32_t phrase_count;
+};
+
+// Phrases a block with room for max_dict_size codes starts with: at most
+// half the codes left after the roots, so the block still learns its own
+static inline uint32_t lzw_dictionary_codes(const LzwDictionary *dictionary, int max_dict_size) {
+    int first_code = (1 << dictionary->symbol_bits) + 3;
+    uint32_t room = max_dict_size > first_code ? (uint32_t)(max_dict_size - first_code) / 2 : 0;
+    return dictionary->phrase_count < room ? dictionary->phrase_count : room;
+}
+
+// Bytes at the start of the sample that the first codes phrases lie in
+static inline size_t lzw_dictionary_extent(const LzwDictionary *dictionary, uint32_t codes) {
+    if (codes == 0) {
+        return 0;
+    }
+    const LzwPhrase *last = &dictionary->phrases[codes - 1];
+    return (size_t)last->offset + last->length;
+}
+
+#endif
@@ -0,0 +1,517 @@
+// Encoder core for one symbol width. lzw.c includes this once with
+// SYMBOL_BITS set to 8 and once with 16, so each width gets its own table
+// layout and loop with the width fixed at compile time.
+//
+// Provides IMPL(DictBucket), IMPL(table_buckets), IMPL(dict_prime),
+// IMPL(encode_block) and IMPL(encode_block_grow), where IMPL appends the
+// symbol width to the name, and expects BlockEncoder to have a table named
+// IMPL(dictionary) plus node_codes and record, and Preset to describe a
+// primed table.
+//
+// Long runs of one symbol, such as no-data fill, bypass the dictionary: a
+// phrase that would start a run of at least LZW_RUN_MIN symbols is sent as
+//
+//   RUN code, the symbol (SYMBOL_BITS bits), n (5 bits), count - LZW_RUN_MIN (n bits)
+//
+// RUN stands where the next phrase's code would, so the decoder still adds
+// the previous phrase plus the run's symbol. No phrase is pending after it,
+// as after a CLEAR.
+//
+// A block primed from a dictionary starts, and starts over after a CLEAR,
+// with the dictionary's phrases as codes FIRST_CODE onwards.
+//
+// Under LZMW and LZAP growth the entries for the previous phrase are only
+// added once the phrase after it has been coded, so every code is already
+// known to the decoder and is written just wide enough for dict_size codes.
+// A RUN or CLEAR leaves no previous phrase to add to.
+
+#if SYMBOL_BITS == 8
+#define IMPL(name) name##8
+#define KEY_T uint32_t
+#define BUCKET_SLOTS 8
+#define LOAD_SYMBOL(p) ((int)*(p))
+#elif SYMBOL_BITS == 16
+#define IMPL(name) name##16
+#define KEY_T uint64_t
+#define BUCKET_SLOTS 5
+// Host-order u16, which is little-endian everywhere this runs
+#define LOAD_SYMBOL(p) ((int)load_u16(p))
+#else
+#error "SYMBOL_BITS must be 8 or 16"
+#endif
+
+#define SYMBOL_BYTES (SYMBOL_BITS / 8)
+#define ROOT_COUNT (1 << SYMBOL_BITS)
+#define CODE_CLEAR ROOT_COUNT
+#define CODE_END (ROOT_COUNT + 1)
+#define CODE_RUN (ROOT_COUNT + 2)
+#define FIRST_CODE (ROOT_COUNT + 3)
+
+// Hash table mapping (prefix_code, next_symbol) to a code. Each bucket is
+// one 64-byte cache line holding the keys of BUCKET_SLOTS phrases and then
+// their codes, so a lookup nearly always touches a single line; for 8-bit
+// symbols all eight keys are compared at once. Slots fill in order and a
+// full bucket overflows into the next.
+typedef struct IMPL(DictBucket) {
+    KEY_T key[BUCKET_SLOTS];        // (prefix_code << SYMBOL_BITS | next_symbol) + 1, 0 marks an empty slot
+    uint32_t code[BUCKET_SLOTS];
+} IMPL(DictBucket);
+
+// Buckets for twice as many slots as 2^max_bits codes. A fuller table
+// overflows buckets often enough to cost more than the extra lines.
+static inline size_t IMPL(table_buckets)(int max_bits) {
+    size_t slots = (size_t)2 << max_bits;
+    return (slots + BUCKET_SLOTS - 1) / BUCKET_SLOTS;
+}
+
+static inline KEY_T IMPL(dict_key)(int prefix, int symbol) {
+    return (((KEY_T)prefix << SYMBOL_BITS) | (KEY_T)symbol) + 1;
+}
+
+// The bucket key hashes to, by scaling a 32-bit hash to the bucket count
+static inline uint32_t IMPL(dict_bucket)(KEY_T key, uint32_t buckets) {
+#if SYMBOL_BITS == 8
+    uint32_t hash = key * 2654435761u;
+#else
+    uint32_t hash = (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32);
+#endif
+    return (uint32_t)(((uint64_t)hash * buckets) >> 32);
+}
+
+// Find key, returning its bucket and slot, or the bucket and empty slot
+// where it would be inserted. Slots fill in order, so the first slot that
+// holds either the key or nothing is the answer.
+static inline IMPL(DictBucket) *IMPL(dict_find)(IMPL(DictBucket) *table, uint32_t buckets, KEY_T key, int *slot) {
+    uint32_t b = IMPL(dict_bucket)(key, buckets);
+    for (;;) {
+        IMPL(DictBucket) *bucket = &table[b];
+#if SYMBOL_BITS == 8 && defined(__SSE2__)
+        __m128i want = _mm_set1_epi32((int)key), zero = _mm_setzero_si128();
+        __m128i lo = _mm_loadu_si128((const __m128i *)bucket->key);
+        __m128i hi = _mm_loadu_si128((const __m128i *)bucket->key + 1);
+        lo = _mm_or_si128(_mm_cmpeq_epi32(lo, want), _mm_cmpeq_epi32(lo, zero));
+        hi = _mm_or_si128(_mm_cmpeq_epi32(hi, want), _mm_cmpeq_epi32(hi, zero));
+        unsigned mask = (unsigned)_mm_movemask_ps(_mm_castsi128_ps(lo)) |
+                        (unsigned)_mm_movemask_ps(_mm_castsi128_ps(hi)) << 4;
+        if (mask != 0) {
+            *slot = __builtin_ctz(mask);
+            return bucket;
+        }
+#elif SYMBOL_BITS == 8 && defined(__ARM_NEON) && defined(__aarch64__)
+        uint32x4_t want = vdupq_n_u32(key);
+        uint32x4_t lo = vld1q_u32(bucket->key), hi = vld1q_u32(bucket->key + 4);
+        lo = vorrq_u32(vceqq_u32(lo, want), vceqzq_u32(lo));
+        hi = vorrq_u32(vceqq_u32(hi, want), vceqzq_u32(hi));
+        // One byte per slot, 0xFF where it matches
+        uint8x8_t bytes = vmovn_u16(vcombine_u16(vmovn_u32(lo), vmovn_u32(hi)));
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(bytes), 0);
+        if (mask != 0) {
+            *slot = __builtin_ctzll(mask) / 8;
+            return bucket;
+        }
+#else
+        // Branching on each slot lets the next lookups start while this
+        // line is still being fetched
+        for (int i = 0; i < BUCKET_SLOTS; i++) {
+            if (bucket->key[i] == key || bucket->key[i] == 0) {
+                *slot = i;
+                return bucket;
+            }
+        }
+#endif
+        b = b + 1 < buckets ? b + 1 : 0;
+    }
+}
+
+static inline void IMPL(dict_prefetch)(const IMPL(DictBucket) *table, uint32_t buckets, KEY_T key) {
+    __builtin_prefetch(&table[IMPL(dict_bucket)(key, buckets)]);
+}
+
+// Fill a table of buckets with the first codes phrases of dictionary, as a
+// block would have learned them from its sample
+static void IMPL(dict_prime)(IMPL(DictBucket) *table, uint32_t buckets, const LzwDictionary *dictionary,
+                             uint32_t codes) {
+    memset(table, 0, buckets * sizeof(IMPL(DictBucket)));
+    for (uint32_t i = 0; i < codes; i++) {
+        const LzwPhrase *phrase = &dictionary->phrases[i];
+        KEY_T key = IMPL(dict_key)((int)phrase->prefix, (int)phrase->symbol);
+        int slot;
+        IMPL(DictBucket) *bucket = IMPL(dict_find)(table, buckets, key, &slot);
+        bucket->key[slot] = key;
+        bucket->code[slot] = FIRST_CODE + i;
+    }
+}
+
+// Number of symbols from p on that equal the first one, stopping at end
+static inline size_t IMPL(run_length)(const unsigned char *p, const unsigned char *end) {
+    const unsigned char *q = p + SYMBOL_BYTES;
+#if defined(__SSE2__)
+#if SYMBOL_BITS == 8
+    const __m128i fill = _mm_set1_epi8((char)p[0]);
+#else
+    const __m128i fill = _mm_set1_epi16((short)load_u16(p));
+#endif
+    while (end - q >= 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)q);
+#if SYMBOL_BITS == 8
+        unsigned same = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, fill));
+#else
+        unsigned same = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(x, fill));
+#endif
+        if (same != 0xFFFF) {
+            q += __builtin_ctz(~same) & ~(SYMBOL_BYTES - 1);
+            return (size_t)(q - p) / SYMBOL_BYTES;
+        }
+        q += 16;
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    // q stays on the symbol grid, so comparing bytes against the repeated
+    // symbol works for either width
+    uint8x16_t fill = vld1q_dup_u8(p);
+#if SYMBOL_BITS == 16
+    fill = vreinterpretq_u8_u16(vdupq_n_u16(load_u16(p)));
+#endif
+    while (end - q >= 16 && vminvq_u8(vceqq_u8(vld1q_u8(q), fill)) == 0xFF) {
+        q += 16;
+    }
+#endif
+    while (q < end && LOAD_SYMBOL(q) == LOAD_SYMBOL(p)) {
+        q += SYMBOL_BYTES;
+    }
+    return (size_t)(q - p) / SYMBOL_BYTES;
+}
+
+static void IMPL(write_run)(BitWriter *writer, int symbol, size_t count, int width) {
+    uint32_t extra = (uint32_t)(count - LZW_RUN_MIN);
+    int bits = extra ? lzw_code_width((int)extra + 1) : 0;
+    bit_write(writer, CODE_RUN, width);
+    bit_write(writer, (uint32_t)symbol, SYMBOL_BITS);
+    bit_write(writer, (uint32_t)bits, 5);
+    if (bits > 0) {
+        bit_write(writer, extra, bits);
+    }
+}
+
+// Code len bytes, len / SYMBOL_BYTES symbols, with a fresh dictionary, or
+// one primed from preset unless that is NULL, finishing with END and padding
+// the last byte, or recording every write in enc->record if that is set.
+// Adds its counts to stats.
+static void IMPL(encode_block)(BlockEncoder *enc, const Preset *preset, const unsigned char *data, size_t len,
+                               LzwWriter *out, LzwStats *stats) {
+    IMPL(DictBucket) *dictionary = enc->IMPL(dictionary);
+    uint32_t buckets = (uint32_t)IMPL(table_buckets)(enc->max_bits);
+    int max_dict_size = 1 << enc->max_bits;
+    size_t table_size = buckets * sizeof(IMPL(DictBucket));
+    int first_code = preset != NULL ? FIRST_CODE + preset->codes : FIRST_CODE;
+
+    BitWriter writer;
+    bit_writer_init(&writer, out);
+    writer.record = enc->record;
+    LzwStats counts;
+    memset(&counts, 0, sizeof(counts));
+
+    // Initialize dictionary: single symbols are implicit root codes, only
+    // learned phrases live in the hash table
+    if (preset != NULL) {
+        memcpy(dictionary, preset->table, table_size);
+    } else {
+        memset(dictionary, 0, table_size);
+    }
+    int dict_size = first_code;
+
+    // Codes are written just wide enough for every code the decoder can
+    // know about, growing a bit each time dict_size crosses a power of two
+    int width = lzw_code_width(dict_size);
+
+    // Symbols read and bits written in the current ratio window, and the
+    // best window seen since the dictionary filled
+    uint64_t window_in = 0, window_bits = 0;
+    uint64_t best_in = 0, best_bits = 0;
+
+    int prefix = -1;        // code of the longest phrase matched so far, -1 for none
+    const unsigned char *p = data;
+    const unsigned char *end = data + len / SYMBOL_BYTES * SYMBOL_BYTES;
+    // Last place a run of LZW_RUN_MIN symbols can start
+    size_t symbols = len / SYMBOL_BYTES;
+    const unsigned char *run_end = symbols >= LZW_RUN_MIN ? end - (LZW_RUN_MIN - 1) * SYMBOL_BYTES : data;
+
+    while (p < end) {
+        int current = LOAD_SYMBOL(p);
+
+        if (prefix < 0) {
+            // Start a phrase here, unless a run does
+            if (p < run_end && LOAD_SYMBOL(p + SYMBOL_BYTES) == current) {
+                size_t count = IMPL(run_length)(p, end);
+                if (count >= LZW_RUN_MIN) {
+                    IMPL(write_run)(&writer, current, count, width);
+                    LZW_COUNT((counts.codes++, counts.runs++, counts.run_symbols += count));
+                    p += count * SYMBOL_BYTES;
+                    continue;
+                }
+            }
+            prefix = current;
+            p += SYMBOL_BYTES;
+            window_in++;
+            continue;
+        }
+
+        KEY_T key = IMPL(dict_key)(prefix, current);
+        int slot;
+        IMPL(DictBucket) *bucket = IMPL(dict_find)(dictionary, buckets, key, &slot);
+
+        if (bucket->key[slot] == key) {
+            // Sequence exists, extend it
+            LZW_COUNT(counts.hits++);
+            prefix = (int)bucket->code[slot];
+            p += SYMBOL_BYTES;
+            window_in++;
+            continue;
+        }
+
+        // The next phrase starts from current, and usually extends it with
+        // the symbol after; fetch that line while this code is written
+        if (p + SYMBOL_BYTES < end) {
+            IMPL(dict_prefetch)(dictionary, buckets, IMPL(dict_key)(current, LOAD_SYMBOL(p + SYMBOL_BYTES)));
+        }
+
+        // Sequence doesn't exist, write code for existing sequence
+        bit_write(&writer, (uint32_t)prefix, width);
+        window_bits += width;
+        LZW_COUNT((counts.misses++, counts.codes++));
+
+        if (dict_size < max_dict_size) {
+            // Add new sequence to dictionary
+            bucket->key[slot] = key;
+            bucket->code[slot] = (uint32_t)dict_size;
+            dict_size++;
+            if ((1 << width) < dict_size) {
+                width++;
+            }
+            if (dict_size == max_dict_size && counts.filled_blocks == 0) {
+                LZW_COUNT((counts.filled_blocks = 1, counts.fill_symbols = (uint64_t)(p - data) / SYMBOL_BYTES));
+            }
+            window_in = 0;
+            window_bits = 0;
+        } else if (window_in >= RESET_WINDOW) {
+            // The dictionary is frozen; start over if it stopped paying off
+            if (best_in == 0 || window_bits * best_in < best_bits * window_in) {
+                best_in = window_in;
+                best_bits = window_bits;
+            } else if (window_bits * best_in * RESET_TOLERANCE >
+                       best_bits * window_in * (RESET_TOLERANCE + 1)) {
+                bit_write(&writer, CODE_CLEAR, width);
+                LZW_COUNT(counts.clears++);
+                if (preset != NULL) {
+                    memcpy(dictionary, preset->table, table_size);
+                } else {
+                    memset(dictionary, 0, table_size);
+                }
+                dict_size = first_code;
+                width = lzw_code_width(dict_size);
+                best_in = 0;
+                best_bits = 0;
+            }
+            window_in = 0;
+            window_bits = 0;
+        }
+
+        // Restart from the symbol that ended the match
+        prefix = -1;
+    }
+
+    // Write remaining sequence
+    if (prefix >= 0) {
+        bit_write(&writer, (uint32_t)prefix, width);
+        LZW_COUNT(counts.codes++);
+    }
+
+    // The decoder completes one more entry after the last code, so END is
+    // written at the width the next code would have had
+    int end_limit = (prefix >= 0 && dict_size < max_dict_size) ? dict_size + 1 : dict_size;
+    bit_write(&writer, CODE_END, lzw_code_width(end_limit));
+    bit_writer_flush(&writer);
+    LZW_COUNT((counts.blocks = 1, counts.symbols = (uint64_t)(end - data) / SYMBOL_BYTES));
+    lzw_stats_add(stats, &counts);
+}
+
+// Marks a trie node that lies on the way to LZMW entries but is not one
+#define NO_CODE UINT32_MAX
+
+// Code a block as IMPL(encode_block) does, but growing the dictionary by
+// LZMW or LZAP rules; see lzw.h.
+//
+// The table is a trie of (node, next_symbol) keys. An LZAP entry extends
+// one that already exists by a symbol, so every node is a code and nodes
+// are numbered by their codes, as in LZW. An LZMW entry skips the prefixes
+// between the previous phrase and itself, so the trie gets nodes for them
+// that are not codes, numbered from first_code in a space of their own and
+// mapped to codes by node_codes. Matching walks as far as the trie goes and
+// backs up to the last node that is a code. A table out of nodes is
+// cleared.
+static void IMPL(encode_block_grow)(BlockEncoder *enc, const Preset *preset, int growth, const unsigned char *data,
+                                    size_t len, LzwWriter *out, LzwStats *stats) {
+    IMPL(DictBucket) *dictionary = enc->IMPL(dictionary);
+    uint32_t *node_codes = growth == LZW_GROWTH_LZMW ? enc->node_codes : NULL;
+    uint32_t buckets = (uint32_t)IMPL(table_buckets)(enc->max_bits);
+    int max_dict_size = 1 << enc->max_bits;
+    size_t table_size = buckets * sizeof(IMPL(DictBucket));
+    int first_code = preset != NULL ? FIRST_CODE + preset->codes : FIRST_CODE;
+
+    BitWriter writer;
+    bit_writer_init(&writer, out);
+    writer.record = enc->record;
+    LzwStats counts;
+    memset(&counts, 0, sizeof(counts));
+
+    if (preset != NULL) {
+        memcpy(dictionary, preset->table, table_size);
+    } else {
+        memset(dictionary, 0, table_size);
+    }
+    int dict_size = first_code;
+    uint32_t node_count = (uint32_t)first_code;    // LZMW nodes, below max_dict_size
+    int width = lzw_code_width(dict_size);
+    uint64_t window_in = 0, window_bits = 0;
+    uint64_t best_in = 0, best_bits = 0;
+
+    int prev_code = -1;         // the phrase before, -1 for none
+    uint32_t prev_node = 0;
+    const unsigned char *p = data;
+    const unsigned char *end = data + len / SYMBOL_BYTES * SYMBOL_BYTES;
+    size_t symbols = len / SYMBOL_BYTES;
+    const unsigned char *run_end = symbols >= LZW_RUN_MIN ? end - (LZW_RUN_MIN - 1) * SYMBOL_BYTES : data;
+
+    while (p < end) {
+        int current = LOAD_SYMBOL(p);
+        if (p < run_end && LOAD_SYMBOL(p + SYMBOL_BYTES) == current) {
+            size_t count = IMPL(run_length)(p, end);
+            if (count >= LZW_RUN_MIN) {
+                IMPL(write_run)(&writer, current, count, width);
+                LZW_COUNT((counts.codes++, counts.runs++, counts.run_symbols += count));
+                p += count * SYMBOL_BYTES;
+                prev_code = -1;
+                continue;
+            }
+        }
+
+        // Longest phrase from p that is a code
+        uint32_t node = (uint32_t)current, code_node = node;
+        int code = current;
+        const unsigned char *q = p + SYMBOL_BYTES, *code_end = q;
+        while (q < end) {
+            KEY_T key = IMPL(dict_key)((int)node, LOAD_SYMBOL(q));
+            int slot;
+            IMPL(DictBucket) *bucket = IMPL(dict_find)(dictionary, buckets, key, &slot);
+            if (bucket->key[slot] != key) {
+                break;
+            }
+            LZW_COUNT(counts.hits++);
+            node = bucket->code[slot];
+            q += SYMBOL_BYTES;
+            uint32_t node_code = node_codes == NULL || node < (uint32_t)first_code ? node : node_codes[node];
+            if (node_code != NO_CODE) {
+                code = (int)node_code;
+                code_node = node;
+                code_end = q;
+            }
+        }
+        bit_write(&writer, (uint32_t)code, width);
+        window_bits += width;
+        window_in += (uint64_t)(code_end - p) / SYMBOL_BYTES;
+        LZW_COUNT((counts.misses++, counts.codes++));
+
+        // Extend the previous phrase's node by this phrase's symbols
+        int added = 0, out_of_nodes = 0;
+        if (prev_code >= 0 && dict_size < max_dict_size) {
+            uint32_t at = prev_node;
+            for (const unsigned char *s = p; s < code_end && dict_size < max_dict_size; s += SYMBOL_BYTES) {
+                KEY_T key = IMPL(dict_key)((int)at, LOAD_SYMBOL(s));
+                int slot;
+                IMPL(DictBucket) *bucket = IMPL(dict_find)(dictionary, buckets, key, &slot);
+                if (bucket->key[slot] == key) {
+                    at = bucket->code[slot];
+                } else if (node_codes == NULL) {
+                    bucket->key[slot] = key;
+                    bucket->code[slot] = (uint32_t)dict_size;
+                    at = (uint32_t)dict_size;
+                } else if (node_count < (uint32_t)max_dict_size) {
+                    bucket->key[slot] = key;
+                    bucket->code[slot] = node_count;
+                    node_codes[node_count] = NO_CODE;
+                    at = node_count++;
+                } else {
+                    out_of_nodes = 1;
+                    break;
+                }
+                // An LZAP prefix that is already a code still takes one,
+                // never used, as the decoder cannot tell
+                if (node_codes == NULL) {
+                    dict_size++;
+                }
+            }
+            if (node_codes != NULL) {
+                if (!out_of_nodes && at >= (uint32_t)first_code && node_codes[at] == NO_CODE) {
+                    node_codes[at] = (uint32_t)dict_size;
+                }
+                dict_size++;
+            }
+            width = lzw_code_width(dict_size);
+            added = 1;
+            if (dict_size == max_dict_size && counts.filled_blocks == 0) {
+                LZW_COUNT((counts.filled_blocks = 1, counts.fill_symbols = (uint64_t)(code_end - data) / SYMBOL_BYTES));
+            }
+        }
+
+        // Start over when the trie is out of nodes, or when the frozen
+        // dictionary stopped paying off
+        int clear = out_of_nodes;
+        if (added) {
+            window_in = 0;
+            window_bits = 0;
+        } else if (dict_size == max_dict_size && window_in >= RESET_WINDOW) {
+            if (best_in == 0 || window_bits * best_in < best_bits * window_in) {
+                best_in = window_in;
+                best_bits = window_bits;
+            } else if (window_bits * best_in * RESET_TOLERANCE > best_bits * window_in * (RESET_TOLERANCE + 1)) {
+                clear = 1;
+            }
+            window_in = 0;
+            window_bits = 0;
+        }
+        prev_code = code;
+        prev_node = code_node;
+        if (clear) {
+            bit_write(&writer, CODE_CLEAR, width);
+            LZW_COUNT(counts.clears++);
+            if (preset != NULL) {
+                memcpy(dictionary, preset->table, table_size);
+            } else {
+                memset(dictionary, 0, table_size);
+            }
+            dict_size = first_code;
+            node_count = (uint32_t)first_code;
+            width = lzw_code_width(dict_size);
+            best_in = 0;
+            best_bits = 0;
+            prev_code = -1;
+        }
+        p = code_end;
+    }
+
+    bit_write(&writer, CODE_END, width);
+    bit_writer_flush(&writer);
+    LZW_COUNT((counts.blocks = 1, counts.symbols = (uint64_t)(end - data) / SYMBOL_BYTES));
+    lzw_stats_add(stats, &counts);
+}
+
+#undef NO_CODE
+#undef IMPL
+#undef KEY_T
+#undef BUCKET_SLOTS
+#undef LOAD_SYMBOL
+#undef SYMBOL_BYTES
+#undef ROOT_COUNT
+#undef CODE_CLEAR
+#undef CODE_END
+#undef CODE_RUN
+#undef FIRST_CODE
@@ -0,0 +1,336 @@
+#include <string.h>
+#include "lzw_filter.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+int lzw_filter_valid(const LzwFilter *filter) {
+    int size = filter->item_size;
+    if (filter->type & ~(LZW_FILTER_DELTA | LZW_FILTER_UP | LZW_FILTER_PLANES)) {
+        return 0;
+    }
+    if ((filter->type & LZW_FILTER_DELTA) && (filter->type & LZW_FILTER_UP)) {
+        return 0;
+    }
+    if (size != 1 && size != 2 && size != 4 && size != 8) {
+        return 0;
+    }
+    return !(filter->type & LZW_FILTER_UP) || filter->row_length > 0;
+}
+
+// Elements are loaded into the low bytes of a u64, so storing the low size
+// bytes back wraps the arithmetic at the element width
+static inline uint64_t load_item(const unsigned char *p, int size) {
+    uint64_t v = 0;
+    memcpy(&v, p, (size_t)size);
+    return v;
+}
+
+static inline void store_item(unsigned char *p, uint64_t v, int size) {
+    memcpy(p, &v, (size_t)size);
+}
+
+// out[b] = in[b] - in[b - dist] element-wise over bytes [0, body), where the
+// first dist bytes have no neighbour and are copied
+static void predict(const unsigned char *in, unsigned char *out, size_t body, size_t dist, int size) {
+    size_t b = dist < body ? dist : body;
+    memcpy(out, in, b);
+
+#if defined(__SSE2__)
+    for (; b + 16 <= body; b += 16) {
+        __m128i cur = _mm_loadu_si128((const __m128i *)(in + b));
+        __m128i prev = _mm_loadu_si128((const __m128i *)(in + b - dist));
+        __m128i d;
+        switch (size) {
+        case 1: d = _mm_sub_epi8(cur, prev); break;
+        case 2: d = _mm_sub_epi16(cur, prev); break;
+        case 4: d = _mm_sub_epi32(cur, prev); break;
+        default: d = _mm_sub_epi64(cur, prev); break;
+        }
+        _mm_storeu_si128((__m128i *)(out + b), d);
+    }
+#elif defined(__ARM_NEON)
+    for (; b + 16 <= body; b += 16) {
+        uint8x16_t cur = vld1q_u8(in + b);
+        uint8x16_t prev = vld1q_u8(in + b - dist);
+        uint8x16_t d;
+        switch (size) {
+        case 1: d = vsubq_u8(cur, prev); break;
+        case 2: d = vreinterpretq_u8_u16(vsubq_u16(vreinterpretq_u16_u8(cur), vreinterpretq_u16_u8(prev))); break;
+        case 4: d = vreinterpretq_u8_u32(vsubq_u32(vreinterpretq_u32_u8(cur), vreinterpretq_u32_u8(prev))); break;
+        default: d = vreinterpretq_u8_u64(vsubq_u64(vreinterpretq_u64_u8(cur), vreinterpretq_u64_u8(prev))); break;
+        }
+        vst1q_u8(out + b, d);
+    }
+#endif
+
+    for (; b < body; b += (size_t)size) {
+        store_item(out + b, load_item(in + b, size) - load_item(in + b - dist, size), size);
+    }
+}
+
+#if defined(__SSE2__)
+// Running sum of the elements of x, lowest lane first. Shifts of 16 bytes
+// or more produce zero, so every width can use all four steps.
+#define PREFIX_SUM_SSE2(add, size, x)                       \
+    do {                                                    \
+        x = add(x, _mm_slli_si128(x, (size)));              \
+        x = add(x, _mm_slli_si128(x, 2 * (size)));          \
+        x = add(x, _mm_slli_si128(x, 4 * (size)));          \
+        x = add(x, _mm_slli_si128(x, 8 * (size)));          \
+    } while (0)
+
+// Copy the top element of x to every lane
+static inline __m128i broadcast_last(__m128i x, int size) {
+    switch (size) {
+    case 1:
+        x = _mm_unpackhi_epi8(x, x);
+        /* fall through */
+    case 2:
+        x = _mm_shufflehi_epi16(x, 0xFF);
+        /* fall through */
+    case 4:
+        return _mm_shuffle_epi32(x, 0xFF);
+    default:
+        return _mm_unpackhi_epi64(x, x);
+    }
+}
+
+// Undo a previous-element delta from byte b on, b being at least 16.
+// Returns where the vector loop stopped.
+static size_t unpredict_delta_simd(const unsigned char *in, unsigned char *out, size_t b, size_t body, int size) {
+    __m128i carry = broadcast_last(_mm_loadu_si128((const __m128i *)(out + b - 16)), size);
+    for (; b + 16 <= body; b += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(in + b));
+        switch (size) {
+        case 1: PREFIX_SUM_SSE2(_mm_add_epi8, 1, x); x = _mm_add_epi8(x, carry); break;
+        case 2: PREFIX_SUM_SSE2(_mm_add_epi16, 2, x); x = _mm_add_epi16(x, carry); break;
+        case 4: PREFIX_SUM_SSE2(_mm_add_epi32, 4, x); x = _mm_add_epi32(x, carry); break;
+        default: PREFIX_SUM_SSE2(_mm_add_epi64, 8, x); x = _mm_add_epi64(x, carry); break;
+        }
+        _mm_storeu_si128((__m128i *)(out + b), x);
+        carry = broadcast_last(x, size);
+    }
+    return b;
+}
+#elif defined(__ARM_NEON)
+static size_t unpredict_delta_simd(const unsigned char *in, unsigned char *out, size_t b, size_t body, int size) {
+    const uint8x16_t zero = vdupq_n_u8(0);
+    if (size == 1) {
+        uint8x16_t carry = vdupq_n_u8(out[b - 1]);
+        for (; b + 16 <= body; b += 16) {
+            uint8x16_t x = vld1q_u8(in + b);
+            x = vaddq_u8(x, vextq_u8(zero, x, 15));
+            x = vaddq_u8(x, vextq_u8(zero, x, 14));
+            x = vaddq_u8(x, vextq_u8(zero, x, 12));
+            x = vaddq_u8(x, vextq_u8(zero, x, 8));
+            x = vaddq_u8(x, carry);
+            vst1q_u8(out + b, x);
+            carry = vdupq_n_u8(vgetq_lane_u8(x, 15));
+        }
+    } else if (size == 2) {
+        uint16x8_t carry = vdupq_n_u16((uint16_t)load_item(out + b - 2, 2));
+        for (; b + 16 <= body; b += 16) {
+            uint8x16_t x = vld1q_u8(in + b);
+            #define ADD16(v, s) vreinterpretq_u8_u16(vaddq_u16(vreinterpretq_u16_u8(v), vreinterpretq_u16_u8(s)))
+            x = ADD16(x, vextq_u8(zero, x, 14));
+            x = ADD16(x, vextq_u8(zero, x, 12));
+            x = ADD16(x, vextq_u8(zero, x, 8));
+            #undef ADD16
+            uint16x8_t sum = vaddq_u16(vreinterpretq_u16_u8(x), carry);
+            vst1q_u16((uint16_t *)(out + b), sum);
+            carry = vdupq_n_u16(vgetq_lane_u16(sum, 7));
+        }
+    } else if (size == 4) {
+        uint32x4_t carry = vdupq_n_u32((uint32_t)load_item(out + b - 4, 4));
+        for (; b + 16 <= body; b += 16) {
+            uint8x16_t x = vld1q_u8(in + b);
+            #define ADD32(v, s) vreinterpretq_u8_u32(vaddq_u32(vreinterpretq_u32_u8(v), vreinterpretq_u32_u8(s)))
+            x = ADD32(x, vextq_u8(zero, x, 12));
+            x = ADD32(x, vextq_u8(zero, x, 8));
+            #undef ADD32
+            uint32x4_t sum = vaddq_u32(vreinterpretq_u32_u8(x), carry);
+            vst1q_u32((uint32_t *)(out + b), sum);
+            carry = vdupq_n_u32(vgetq_lane_u32(sum, 3));
+        }
+    }
+    return b;
+}
+#endif
+
+// Invert predict: out[b] = in[b] + out[b - dist]
+static void unpredict(const unsigned char *in, unsigned char *out, size_t body, size_t dist, int size) {
+    size_t b = dist < body ? dist : body;
+    memcpy(out, in, b);
+
+#if defined(__SSE2__) || defined(__ARM_NEON)
+    if (dist >= 16) {
+        // Every neighbour a vector needs is at least a vector behind it
+        for (; b + 16 <= body; b += 16) {
+#if defined(__SSE2__)
+            __m128i cur = _mm_loadu_si128((const __m128i *)(in + b));
+            __m128i prev = _mm_loadu_si128((const __m128i *)(out + b - dist));
+            __m128i s;
+            switch (size) {
+            case 1: s = _mm_add_epi8(cur, prev); break;
+            case 2: s = _mm_add_epi16(cur, prev); break;
+            case 4: s = _mm_add_epi32(cur, prev); break;
+            default: s = _mm_add_epi64(cur, prev); break;
+            }
+            _mm_storeu_si128((__m128i *)(out + b), s);
+#else
+            uint8x16_t cur = vld1q_u8(in + b);
+            uint8x16_t prev = vld1q_u8(out + b - dist);
+            uint8x16_t s;
+            switch (size) {
+            case 1: s = vaddq_u8(cur, prev); break;
+            case 2: s = vreinterpretq_u8_u16(vaddq_u16(vreinterpretq_u16_u8(cur), vreinterpretq_u16_u8(prev))); break;
+            case 4: s = vreinterpretq_u8_u32(vaddq_u32(vreinterpretq_u32_u8(cur), vreinterpretq_u32_u8(prev))); break;
+            default: s = vreinterpretq_u8_u64(vaddq_u64(vreinterpretq_u64_u8(cur), vreinterpretq_u64_u8(prev))); break;
+            }
+            vst1q_u8(out + b, s);
+#endif
+        }
+    } else if (dist == (size_t)size) {
+        // A running sum; the scalar loop supplies the first vector's carry
+        for (; b < 16 && b < body; b += (size_t)size) {
+            store_item(out + b, load_item(in + b, size) + load_item(out + b - dist, size), size);
+        }
+        if (b >= 16) {
+            b = unpredict_delta_simd(in, out, b, body, size);
+        }
+    }
+#endif
+
+    for (; b < body; b += (size_t)size) {
+        store_item(out + b, load_item(in + b, size) + load_item(out + b - dist, size), size);
+    }
+}
+
+// Gather byte k of each of the n elements into plane k
+static void split_planes(const unsigned char *in, unsigned char *out, size_t n, int size) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    if (size == 2) {
+        const __m128i low = _mm_set1_epi16(0x00FF);
+        for (; i + 16 <= n; i += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(in + 2 * i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(in + 2 * i + 16));
+            __m128i lo = _mm_packus_epi16(_mm_and_si128(a, low), _mm_and_si128(b, low));
+            __m128i hi = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+            _mm_storeu_si128((__m128i *)(out + i), lo);
+            _mm_storeu_si128((__m128i *)(out + n + i), hi);
+        }
+    }
+#elif defined(__ARM_NEON)
+    if (size == 2) {
+        for (; i + 16 <= n; i += 16) {
+            uint8x16x2_t v = vld2q_u8(in + 2 * i);
+            vst1q_u8(out + i, v.val[0]);
+            vst1q_u8(out + n + i, v.val[1]);
+        }
+    } else if (size == 4) {
+        for (; i + 16 <= n; i += 16) {
+            uint8x16x4_t v = vld4q_u8(in + 4 * i);
+            for (int k = 0; k < 4; k++) {
+                vst1q_u8(out + k * n + i, v.val[k]);
+            }
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        for (int k = 0; k < size; k++) {
+            out[(size_t)k * n + i] = in[i * (size_t)size + (size_t)k];
+        }
+    }
+}
+
+static void merge_planes(const unsigned char *in, unsigned char *out, size_t n, int size) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    if (size == 2) {
+        for (; i + 16 <= n; i += 16) {
+            __m128i lo = _mm_loadu_si128((const __m128i *)(in + i));
+            __m128i hi = _mm_loadu_si128((const __m128i *)(in + n + i));
+            _mm_storeu_si128((__m128i *)(out + 2 * i), _mm_unpacklo_epi8(lo, hi));
+            _mm_storeu_si128((__m128i *)(out + 2 * i + 16), _mm_unpackhi_epi8(lo, hi));
+        }
+    }
+#elif defined(__ARM_NEON)
+    if (size == 2) {
+        for (; i + 16 <= n; i += 16) {
+            uint8x16x2_t v;
+            v.val[0] = vld1q_u8(in + i);
+            v.val[1] = vld1q_u8(in + n + i);
+            vst2q_u8(out + 2 * i, v);
+        }
+    } else if (size == 4) {
+        for (; i + 16 <= n; i += 16) {
+            uint8x16x4_t v;
+            for (int k = 0; k < 4; k++) {
+                v.val[k] = vld1q_u8(in + k * n + i);
+            }
+            vst4q_u8(out + 4 * i, v);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        for (int k = 0; k < size; k++) {
+            out[i * (size_t)size + (size_t)k] = in[(size_t)k * n + i];
+        }
+    }
+}
+
+static size_t predict_distance(const LzwFilter *filter) {
+    if (filter->type & LZW_FILTER_UP) {
+        return (size_t)filter->row_length * (size_t)filter->item_size;
+    }
+    return filter->type & LZW_FILTER_DELTA ? (size_t)filter->item_size : 0;
+}
+
+void lzw_filter_apply(const LzwFilter *filter, const unsigned char *in, unsigned char *out,
+                      unsigned char *scratch, size_t len) {
+    int size = filter->item_size;
+    size_t n = len / (size_t)size;
+    size_t body = n * (size_t)size;
+    size_t dist = predict_distance(filter);
+    int planes = (filter->type & LZW_FILTER_PLANES) && size > 1;
+
+    const unsigned char *src = in;
+    if (dist > 0) {
+        unsigned char *dst = planes ? scratch : out;
+        predict(in, dst, body, dist, size);
+        src = dst;
+    }
+    if (planes) {
+        split_planes(src, out, n, size);
+    } else if (src != out) {
+        memcpy(out, src, body);
+    }
+    memcpy(out + body, in + body, len - body);
+}
+
+void lzw_filter_invert(const LzwFilter *filter, const unsigned char *in, unsigned char *out,
+                       unsigned char *scratch, size_t len) {
+    int size = filter->item_size;
+    size_t n = len / (size_t)size;
+    size_t body = n * (size_t)size;
+    size_t dist = predict_distance(filter);
+    int planes = (filter->type & LZW_FILTER_PLANES) && size > 1;
+
+    const unsigned char *src = in;
+    if (planes) {
+        unsigned char *dst = dist > 0 ? scratch : out;
+        merge_planes(in, dst, n, size);
+        src = dst;
+    }
+    if (dist > 0) {
+        unpredict(src, out, body, dist, size);
+    } else if (src != out) {
+        memcpy(out, src, body);
+    }
+    memcpy(out + body, in + body, len - body);
+}
@@ -0,0 +1,40 @@
+#ifndef LZW_FILTER_H
+#define LZW_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Reversible pre-filters for arrays of fixed-size elements, applied to a
+// block before it is coded. Elements are little-endian, as npz_to_bin.py
+// writes them. A trailing partial element is passed through unchanged.
+//
+// The prediction step runs first and replaces every element by its
+// difference from a neighbour, wrapping around at the element width. The
+// byte-plane step then stores byte 0 of every element, then byte 1, and so
+// on, so smooth high bytes form long runs instead of alternating with
+// noisy low bytes.
+
+#define LZW_FILTER_NONE 0
+#define LZW_FILTER_DELTA 0x01       // subtract the previous element
+#define LZW_FILTER_UP 0x02          // subtract the element one row above
+#define LZW_FILTER_PLANES 0x04      // split elements into byte planes
+
+typedef struct {
+    int type;                   // LZW_FILTER_* bits, at most one prediction
+    int item_size;              // bytes per element: 1, 2, 4 or 8
+    uint32_t row_length;        // elements per row, for LZW_FILTER_UP
+} LzwFilter;
+
+// Returns 1 if filter is a combination this version can invert
+int lzw_filter_valid(const LzwFilter *filter);
+
+// Filter len bytes of in into out. scratch must hold len bytes; in, out and
+// scratch must not overlap.
+void lzw_filter_apply(const LzwFilter *filter, const unsigned char *in, unsigned char *out,
+                      unsigned char *scratch, size_t len);
+
+// Undo lzw_filter_apply, with the same buffer rules
+void lzw_filter_invert(const LzwFilter *filter, const unsigned char *in, unsigned char *out,
+                       unsigned char *scratch, size_t len);
+
+#endif
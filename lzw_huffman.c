@@ -0,0 +1,275 @@
+#include <stdlib.h>
+#include <string.h>
+#include "lzw.h"
+#include "lzw_huffman.h"
+
+#define MAX_TOKENS LZW_TOKEN_COUNT(LZW_MAX_CODE_BITS)
+
+// Split a code into a token and extra bits, see lzw_huffman.h
+static inline uint32_t token_of(uint32_t code, int *extra) {
+    if (code < (2u << LZW_TOKEN_MANTISSA)) {
+        *extra = 0;
+        return code;
+    }
+    *extra = 31 - __builtin_clz(code) - LZW_TOKEN_MANTISSA;
+    return ((uint32_t)*extra << LZW_TOKEN_MANTISSA) + (1u << LZW_TOKEN_MANTISSA) +
+           ((code >> *extra) & ((1u << LZW_TOKEN_MANTISSA) - 1));
+}
+
+// What the item after one with this value is: 0 for a code, 1 to 3 for the
+// symbol, bit count and count that follow a RUN code
+static inline int next_stage(int stage, uint32_t value, uint32_t run) {
+    switch (stage) {
+    case 0:
+        return value == run;
+    case 1:
+        return 2;
+    case 2:
+        return value > 0 ? 3 : 0;
+    default:
+        return 0;
+    }
+}
+
+typedef struct {
+    uint32_t count;
+    uint32_t token;
+} TokenCount;
+
+static int by_count(const void *a, const void *b) {
+    const TokenCount *x = a, *y = b;
+    if (x->count != y->count) {
+        return x->count < y->count ? -1 : 1;
+    }
+    return x->token < y->token ? -1 : x->token > y->token;
+}
+
+// Replace counts sorted in ascending order, at least two, by the lengths of
+// an optimal prefix code for them, in place (Moffat and Katajainen)
+static void minimum_redundancy(uint32_t *a, int n) {
+    int root = 0, leaf = 2;
+    a[0] += a[1];
+    for (int next = 1; next < n - 1; next++) {
+        if (leaf >= n || a[root] < a[leaf]) {
+            a[next] = a[root];
+            a[root++] = (uint32_t)next;
+        } else {
+            a[next] = a[leaf++];
+        }
+        if (leaf >= n || (root < next && a[root] < a[leaf])) {
+            a[next] += a[root];
+            a[root++] = (uint32_t)next;
+        } else {
+            a[next] += a[leaf++];
+        }
+    }
+    a[n - 2] = 0;
+    for (int next = n - 3; next >= 0; next--) {
+        a[next] = a[a[next]] + 1;
+    }
+    int available = 1, used = 0, depth = 0;
+    root = n - 2;
+    int next = n - 1;
+    while (available > 0) {
+        while (root >= 0 && (int)a[root] == depth) {
+            used++;
+            root--;
+        }
+        while (available > used) {
+            a[next--] = (uint32_t)depth;
+            available--;
+        }
+        available = 2 * used;
+        depth++;
+        used = 0;
+    }
+}
+
+// Code lengths of at most LZW_HUFFMAN_MAX_BITS bits for the tokens counted,
+// 0 for the unused ones
+static void build_lengths(const uint32_t *counts, int tokens, unsigned char *lengths) {
+    TokenCount used[MAX_TOKENS];
+    uint32_t a[MAX_TOKENS];
+    int n = 0;
+    memset(lengths, 0, (size_t)tokens);
+    for (int t = 0; t < tokens; t++) {
+        if (counts[t] > 0) {
+            used[n].count = counts[t];
+            used[n].token = (uint32_t)t;
+            n++;
+        }
+    }
+    if (n < 2) {
+        if (n == 1) {
+            lengths[used[0].token] = 1;
+        }
+        return;
+    }
+    qsort(used, (size_t)n, sizeof(TokenCount), by_count);
+    for (int i = 0; i < n; i++) {
+        a[i] = used[i].count;
+    }
+    minimum_redundancy(a, n);
+
+    // Cut longer codes to the limit, then lengthen the codes nearest it
+    // until the lengths fit a prefix code again
+    int per_length[LZW_HUFFMAN_MAX_BITS + 1] = {0};
+    for (int i = 0; i < n; i++) {
+        per_length[a[i] < LZW_HUFFMAN_MAX_BITS ? a[i] : LZW_HUFFMAN_MAX_BITS]++;
+    }
+    uint32_t total = 0;
+    for (int l = 1; l <= LZW_HUFFMAN_MAX_BITS; l++) {
+        total += (uint32_t)per_length[l] << (LZW_HUFFMAN_MAX_BITS - l);
+    }
+    while (total > 1u << LZW_HUFFMAN_MAX_BITS) {
+        per_length[LZW_HUFFMAN_MAX_BITS]--;
+        for (int l = LZW_HUFFMAN_MAX_BITS - 1; l > 0; l--) {
+            if (per_length[l] > 0) {
+                per_length[l]--;
+                per_length[l + 1] += 2;
+                break;
+            }
+        }
+        total--;
+    }
+
+    // The most frequent tokens take the shortest codes
+    int j = n;
+    for (int l = 1; l <= LZW_HUFFMAN_MAX_BITS; l++) {
+        for (int k = 0; k < per_length[l]; k++) {
+            lengths[used[--j].token] = (unsigned char)l;
+        }
+    }
+}
+
+static uint32_t reverse_bits(uint32_t code, int length) {
+    uint32_t reversed = 0;
+    for (int i = 0; i < length; i++) {
+        reversed = (reversed << 1) | ((code >> i) & 1);
+    }
+    return reversed;
+}
+
+// Canonical codes for the lengths, bit-reversed to be written least
+// significant bit first. Returns -1 if the lengths are too many for a
+// prefix code.
+static int canonical_codes(const unsigned char *lengths, int tokens, uint32_t *codes) {
+    int per_length[LZW_HUFFMAN_MAX_BITS + 1] = {0};
+    for (int t = 0; t < tokens; t++) {
+        per_length[lengths[t]]++;
+    }
+    uint32_t next[LZW_HUFFMAN_MAX_BITS + 1];
+    uint32_t code = 0;
+    int left = 1;
+    for (int l = 1; l <= LZW_HUFFMAN_MAX_BITS; l++) {
+        code = (code + (uint32_t)(l > 1 ? per_length[l - 1] : 0)) << 1;
+        next[l] = code;
+        left = 2 * left - per_length[l];
+        if (left < 0) {
+            return -1;
+        }
+    }
+    for (int t = 0; t < tokens; t++) {
+        codes[t] = lengths[t] > 0 ? reverse_bits(next[lengths[t]]++, lengths[t]) : 0;
+    }
+    return 0;
+}
+
+size_t lzw_huffman_read_table(LzwHuffman *huffman, const unsigned char *data, size_t len, int max_code_bits) {
+    if (len < 2) {
+        return 0;
+    }
+    int tokens = data[0] | data[1] << 8;
+    size_t size = 2 + ((size_t)tokens + 1) / 2;
+    if (tokens == 0 || tokens > LZW_TOKEN_COUNT(max_code_bits) || size > len) {
+        return 0;
+    }
+    unsigned char lengths[MAX_TOKENS];
+    uint32_t codes[MAX_TOKENS];
+    for (int t = 0; t < tokens; t++) {
+        lengths[t] = (data[2 + t / 2] >> (4 * (t & 1))) & 15;
+        if (lengths[t] > LZW_HUFFMAN_MAX_BITS) {
+            return 0;
+        }
+    }
+    if (canonical_codes(lengths, tokens, codes) != 0) {
+        return 0;
+    }
+    memset(huffman->decode, 0, sizeof(huffman->decode));
+    for (int t = 0; t < tokens; t++) {
+        uint16_t entry = (uint16_t)(t << 4 | lengths[t]);
+        for (uint32_t i = codes[t]; lengths[t] > 0 && i < (1u << LZW_HUFFMAN_MAX_BITS); i += 1u << lengths[t]) {
+            huffman->decode[i] = entry;
+        }
+    }
+    return size;
+}
+
+int lzw_huffman_write(const LzwBitItem *items, size_t count, uint32_t run, int max_code_bits, LzwWriter *out) {
+    int tokens = LZW_TOKEN_COUNT(max_code_bits);
+    uint32_t counts[MAX_TOKENS] = {0};
+    uint64_t packed_bits = 0, plain_bits = 0;
+    int stage = 0;
+    for (size_t i = 0; i < count; i++) {
+        packed_bits += items[i].width;
+        if (stage == 0) {
+            int extra;
+            counts[token_of(items[i].value, &extra)]++;
+            plain_bits += (uint64_t)extra;
+        } else {
+            plain_bits += items[i].width;
+        }
+        stage = next_stage(stage, items[i].value, run);
+    }
+
+    unsigned char lengths[MAX_TOKENS];
+    uint32_t codes[MAX_TOKENS];
+    build_lengths(counts, tokens, lengths);
+    canonical_codes(lengths, tokens, codes);
+    int used = tokens;
+    while (used > 0 && lengths[used - 1] == 0) {
+        used--;
+    }
+    uint64_t coded_bits = plain_bits;
+    for (int t = 0; t < used; t++) {
+        coded_bits += (uint64_t)counts[t] * lengths[t];
+    }
+    size_t table_size = 2 + ((size_t)used + 1) / 2;
+
+    BitWriter writer;
+    if (used == 0 || table_size + (coded_bits + 7) / 8 >= (packed_bits + 7) / 8) {
+        bit_writer_init(&writer, out);
+        for (size_t i = 0; i < count; i++) {
+            bit_write(&writer, items[i].value, (int)items[i].width);
+        }
+        bit_writer_flush(&writer);
+        return 0;
+    }
+
+    unsigned char table[2 + (MAX_TOKENS + 1) / 2];
+    memset(table, 0, table_size);
+    table[0] = (unsigned char)used;
+    table[1] = (unsigned char)(used >> 8);
+    for (int t = 0; t < used; t++) {
+        table[2 + t / 2] |= (unsigned char)(lengths[t] << (4 * (t & 1)));
+    }
+    lzw_writer_write(out, table, table_size);
+    bit_writer_init(&writer, out);
+    stage = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t value = items[i].value;
+        if (stage == 0) {
+            int extra;
+            uint32_t token = token_of(value, &extra);
+            bit_write(&writer, codes[token], lengths[token]);
+            if (extra > 0) {
+                bit_write(&writer, value & ((1u << extra) - 1), extra);
+            }
+        } else {
+            bit_write(&writer, value, (int)items[i].width);
+        }
+        stage = next_stage(stage, value, run);
+    }
+    bit_writer_flush(&writer);
+    return 1;
+}
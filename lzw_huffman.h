@@ -0,0 +1,71 @@
+#ifndef LZW_HUFFMAN_H
+#define LZW_HUFFMAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "lzw_io.h"
+#include "lzw_bitio.h"
+
+// Optional second stage that Huffman-codes a block's code stream, whose
+// codes are far from equally likely: roots and young entries come up much
+// more often than the rest.
+//
+// Each code becomes a token and extra bits. Codes below
+// 2^(LZW_TOKEN_MANTISSA + 1) are tokens of their own; a larger one keeps its
+// top LZW_TOKEN_MANTISSA + 1 bits in the token and sends the rest as they
+// are. A coded block starts with a table:
+//
+//   u16 token_count, then a 4-bit code length per token, low nibble first,
+//   0 for an unused token, padded to a whole byte
+//
+// and goes on with the stream as the packed coder writes it, each code
+// replaced by its canonical Huffman code, least significant bit first, and
+// its extra bits. The payload of a RUN code stays packed.
+
+#define LZW_TOKEN_MANTISSA 4
+#define LZW_HUFFMAN_MAX_BITS 12
+
+// Tokens needed for every code of max_code_bits bits
+#define LZW_TOKEN_COUNT(max_code_bits) \
+    ((((max_code_bits) - 1 - LZW_TOKEN_MANTISSA) << LZW_TOKEN_MANTISSA) + (2 << LZW_TOKEN_MANTISSA))
+
+// Decode table indexed by the next LZW_HUFFMAN_MAX_BITS bits of the stream:
+// token << 4 | code length, or 0 where no code starts with those bits
+typedef struct {
+    uint16_t decode[1 << LZW_HUFFMAN_MAX_BITS];
+} LzwHuffman;
+
+// Read the table at the start of a coded block of max_code_bits codes.
+// Returns the bytes it takes, or 0 if it is truncated or impossible.
+size_t lzw_huffman_read_table(LzwHuffman *huffman, const unsigned char *data, size_t len, int max_code_bits);
+
+// Read one code. Returns 0 once the input runs out or on bits that start no
+// code.
+static inline int lzw_huffman_read(BitReader *reader, const LzwHuffman *huffman, uint32_t *code) {
+    uint32_t entry = huffman->decode[bit_peek(reader, LZW_HUFFMAN_MAX_BITS)];
+    int length = (int)(entry & 15);
+    if (length == 0 || length > reader->count) {
+        return 0;
+    }
+    bit_skip(reader, length);
+    uint32_t token = entry >> 4;
+    if (token < (2u << LZW_TOKEN_MANTISSA)) {
+        *code = token;
+        return 1;
+    }
+    int extra = (int)(token >> LZW_TOKEN_MANTISSA) - 1;
+    uint32_t low;
+    if (!bit_read(reader, extra, &low)) {
+        return 0;
+    }
+    *code = ((token & ((1u << LZW_TOKEN_MANTISSA) - 1)) | (1u << LZW_TOKEN_MANTISSA)) << extra | low;
+    return 1;
+}
+
+// Write a block from the bit_write calls recorded in items: Huffman-coded
+// if that is smaller, otherwise packed exactly as recorded. run is the RUN
+// code of the block's symbol width, whose payload stays packed. Returns 1 if
+// the block was Huffman-coded, 0 if it was packed.
+int lzw_huffman_write(const LzwBitItem *items, size_t count, uint32_t run, int max_code_bits, LzwWriter *out);
+
+#endif
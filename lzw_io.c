@@ -0,0 +1,307 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lzw_io.h"
+
+static size_t file_fill(LzwReader *reader) {
+    FILE *file = reader->source;
+    size_t n = fread(reader->buffer + reader->len, 1, reader->capacity - reader->len, file);
+    if (n == 0 && ferror(file)) {
+        reader->failed = 1;
+    }
+    return n;
+}
+
+// On failure the buffered bytes are dropped and the writer is marked
+// failed, so callers can keep writing and check once at the end
+static void memory_grow(LzwWriter *writer) {
+    size_t capacity = writer->capacity * 2;
+    unsigned char *buffer = realloc(writer->buffer, capacity);
+    if (buffer == NULL) {
+        writer->failed = 1;
+        writer->len = 0;
+        return;
+    }
+    writer->buffer = buffer;
+    writer->capacity = capacity;
+}
+
+static void file_drain(LzwWriter *writer) {
+    FILE *file = writer->sink;
+    if (!writer->failed && fwrite(writer->buffer, 1, writer->len, file) != writer->len) {
+        writer->failed = 1;
+    }
+    writer->offset += writer->len;
+    writer->len = 0;
+}
+
+static void callback_drain(LzwWriter *writer) {
+    LzwCallbackSink *sink = writer->sink;
+    if (!writer->failed && sink->write(sink->context, writer->buffer, writer->len) != 0) {
+        writer->failed = 1;
+    }
+    writer->offset += writer->len;
+    writer->len = 0;
+}
+
+int lzw_reader_open_file(LzwReader *reader, FILE *file, size_t buffer_size) {
+    if (buffer_size < LZW_IO_MIN_BUFFER_SIZE) {
+        buffer_size = LZW_IO_MIN_BUFFER_SIZE;
+    }
+    reader->buffer = malloc(buffer_size);
+    if (reader->buffer == NULL) {
+        return -1;
+    }
+    reader->capacity = buffer_size;
+    reader->pos = 0;
+    reader->len = 0;
+    reader->eof = 0;
+    reader->offset = 0;
+    reader->fill = file_fill;
+    reader->source = file;
+    reader->owns_source = 0;
+    reader->owns_buffer = 1;
+    reader->mapped = 0;
+    reader->failed = 0;
+    return 0;
+}
+
+// The whole file is in the buffer from the start, there is nothing to add
+static size_t mapped_fill(LzwReader *reader) {
+    (void)reader;
+    return 0;
+}
+
+// Map a regular file read-only. Returns 0 if the file cannot be mapped.
+static int map_file(LzwReader *reader, FILE *file) {
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+        return 0;
+    }
+    size_t size = (size_t)st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+
+    // The matcher walks the mapping front to back exactly once
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(map, size, MADV_HUGEPAGE);
+#endif
+
+    reader->buffer = map;
+    reader->capacity = size;
+    reader->pos = 0;
+    reader->len = size;
+    reader->eof = 1;
+    reader->offset = 0;
+    reader->fill = mapped_fill;
+    reader->source = file;
+    reader->owns_buffer = 0;
+    reader->mapped = 1;
+    reader->failed = 0;
+    return 1;
+}
+
+int lzw_reader_open_path(LzwReader *reader, const char *path, size_t buffer_size, int use_mmap) {
+    if (strcmp(path, "-") == 0) {
+        return lzw_reader_open_file(reader, stdin, buffer_size);
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    if ((!use_mmap || !map_file(reader, file)) && lzw_reader_open_file(reader, file, buffer_size) != 0) {
+        fclose(file);
+        return -1;
+    }
+    reader->owns_source = 1;
+    return 0;
+}
+
+void lzw_reader_open_memory(LzwReader *reader, const void *data, size_t len) {
+    reader->buffer = (unsigned char *)data;
+    reader->capacity = len;
+    reader->pos = 0;
+    reader->len = len;
+    reader->eof = 1;
+    reader->offset = 0;
+    reader->fill = mapped_fill;
+    reader->source = NULL;
+    reader->owns_source = 0;
+    reader->owns_buffer = 0;
+    reader->mapped = 0;
+    reader->failed = 0;
+}
+
+void lzw_reader_close(LzwReader *reader) {
+    if (reader->mapped) {
+        munmap(reader->buffer, reader->capacity);
+    } else if (reader->owns_buffer) {
+        free(reader->buffer);
+    }
+    if (reader->owns_source) {
+        fclose(reader->source);
+    }
+    reader->buffer = NULL;
+}
+
+size_t lzw_reader_fill(LzwReader *reader) {
+    if (reader->eof) {
+        return reader->len - reader->pos;
+    }
+
+    // Keep any unread tail, it is usually a partial word
+    if (reader->pos > 0) {
+        memmove(reader->buffer, reader->buffer + reader->pos, reader->len - reader->pos);
+        reader->offset += reader->pos;
+        reader->len -= reader->pos;
+        reader->pos = 0;
+    }
+    while (!reader->eof && reader->len < reader->capacity) {
+        size_t n = reader->fill(reader);
+        if (n == 0) {
+            reader->eof = 1;
+        }
+        reader->len += n;
+    }
+    return reader->len - reader->pos;
+}
+
+size_t lzw_reader_read(LzwReader *reader, void *data, size_t size) {
+    size_t copied = 0;
+    while (copied < size) {
+        if (reader->pos == reader->len && lzw_reader_fill(reader) == 0) {
+            break;
+        }
+        size_t n = reader->len - reader->pos;
+        if (n > size - copied) {
+            n = size - copied;
+        }
+        memcpy((unsigned char *)data + copied, reader->buffer + reader->pos, n);
+        reader->pos += n;
+        copied += n;
+    }
+    return copied;
+}
+
+const unsigned char *lzw_reader_next(LzwReader *reader, size_t size, unsigned char *scratch) {
+    if (reader->len - reader->pos < size) {
+        lzw_reader_fill(reader);
+    }
+    if (reader->len - reader->pos >= size) {
+        const unsigned char *data = reader->buffer + reader->pos;
+        reader->pos += size;
+        return data;
+    }
+    if (reader->eof) {
+        return NULL;
+    }
+    return lzw_reader_read(reader, scratch, size) == size ? scratch : NULL;
+}
+
+static int writer_open(LzwWriter *writer, size_t buffer_size, void (*drain)(LzwWriter *writer), void *sink) {
+    if (buffer_size < LZW_IO_MIN_BUFFER_SIZE) {
+        buffer_size = LZW_IO_MIN_BUFFER_SIZE;
+    }
+    writer->buffer = malloc(buffer_size);
+    writer->capacity = buffer_size;
+    writer->len = 0;
+    writer->offset = 0;
+    writer->drain = drain;
+    writer->sink = sink;
+    writer->failed = 0;
+    return writer->buffer != NULL ? 0 : -1;
+}
+
+int lzw_writer_open_file(LzwWriter *writer, FILE *file, size_t buffer_size) {
+    return writer_open(writer, buffer_size, file_drain, file);
+}
+
+int lzw_writer_open_callback(LzwWriter *writer, LzwCallbackSink *sink, size_t buffer_size) {
+    return writer_open(writer, buffer_size, callback_drain, sink);
+}
+
+int lzw_writer_open_memory(LzwWriter *writer, size_t initial_size) {
+    return writer_open(writer, initial_size, memory_grow, NULL);
+}
+
+void lzw_writer_close(LzwWriter *writer) {
+    // In-memory writers have nowhere to drain to
+    if (writer->sink != NULL) {
+        lzw_writer_drain(writer);
+    }
+    free(writer->buffer);
+    writer->buffer = NULL;
+}
+
+int lzw_writer_reserve(LzwWriter *writer, size_t size) {
+    while (!writer->failed && writer->capacity - writer->len < size) {
+        memory_grow(writer);
+    }
+    return writer->failed ? -1 : 0;
+}
+
+void lzw_writer_write(LzwWriter *writer, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    while (size > 0) {
+        if (writer->len == writer->capacity) {
+            writer->drain(writer);
+        }
+        size_t n = writer->capacity - writer->len;
+        if (n > size) {
+            n = size;
+        }
+        memcpy(writer->buffer + writer->len, bytes, n);
+        writer->len += n;
+        bytes += n;
+        size -= n;
+    }
+}
+
+void lzw_writer_repeat(LzwWriter *writer, const void *item, size_t size, size_t count) {
+    while (count > 0) {
+        if (writer->capacity - writer->len < size) {
+            writer->drain(writer);
+        }
+        size_t n = (writer->capacity - writer->len) / size;
+        if (n > count) {
+            n = count;
+        }
+
+        // Fill straight into the buffer, doubling the copied span each pass
+        unsigned char *p = writer->buffer + writer->len;
+        size_t total = n * size;
+        if (size == 1) {
+            memset(p, *(const unsigned char *)item, total);
+        } else {
+            memcpy(p, item, size);
+            for (size_t done = size; done < total; done *= 2) {
+                memcpy(p + done, p, done < total - done ? done : total - done);
+            }
+        }
+        writer->len += total;
+        count -= n;
+    }
+}
+
+FILE *lzw_open_output(const char *path) {
+    if (strcmp(path, "-") == 0) {
+        return stdout;
+    }
+    return fopen(path, "wb");
+}
+
+int lzw_close_output(FILE *file) {
+    int failed = file == stdout ? fflush(file) != 0 || ferror(file) : fclose(file) != 0;
+    return failed ? -1 : 0;
+}
+
+FILE *lzw_message_stream(const char *output_path) {
+    return strcmp(output_path, "-") == 0 ? stderr : stdout;
+}
@@ -0,0 +1,125 @@
+#ifndef LZW_IO_H
+#define LZW_IO_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Default size of the reader and writer buffers. Smaller requests are
+// rounded up to the minimum so a buffer always holds a few words.
+#define LZW_IO_BUFFER_SIZE (1 << 20)
+#define LZW_IO_MIN_BUFFER_SIZE 4096
+
+// Block reader: the LZW core consumes buffer[pos..len) directly and calls
+// lzw_reader_fill when it runs dry. The fill hook decides where bytes come
+// from, so other sources only need to provide their own hook.
+typedef struct LzwReader LzwReader;
+struct LzwReader {
+    unsigned char *buffer;
+    size_t capacity;
+    size_t pos;             // next unread byte
+    size_t len;             // end of valid data
+    int eof;                // set once the source has no more data
+    uint64_t offset;        // stream position of buffer[0]
+
+    // Append up to capacity - len bytes at buffer + len, return the count
+    size_t (*fill)(LzwReader *reader);
+    void *source;
+
+    int owns_source;        // close the FILE when the reader is closed
+    int owns_buffer;        // free the buffer when the reader is closed
+    int mapped;             // buffer is a read-only mapping of the whole file
+    int failed;             // a read failed; the reader then behaves as at eof
+};
+
+// Block writer: callers append at buffer + len and drain when full. The
+// drain hook either hands len bytes to the sink and empties the buffer, or
+// for in-memory writers grows it; either way there is room afterwards.
+typedef struct LzwWriter LzwWriter;
+struct LzwWriter {
+    unsigned char *buffer;
+    size_t capacity;
+    size_t len;
+    uint64_t offset;        // bytes already handed to the sink
+
+    void (*drain)(LzwWriter *writer);
+    void *sink;
+    int failed;             // the sink refused data or the buffer could not grow
+};
+
+// Drains to a caller's function, which returns nonzero to report failure
+typedef struct {
+    int (*write)(void *context, const void *data, size_t len);
+    void *context;
+} LzwCallbackSink;
+
+// The open functions return 0 on success and -1 if the file cannot be opened
+// or the buffer cannot be allocated. Failed reads and writes afterwards set
+// the failed flag instead of returning errors from every call.
+int lzw_reader_open_file(LzwReader *reader, FILE *file, size_t buffer_size);
+
+// Open path for reading, "-" meaning stdin. With use_mmap set, regular files
+// are mapped and scanned in place; pipes, empty files and anything mmap
+// refuses fall back to buffered reads.
+int lzw_reader_open_path(LzwReader *reader, const char *path, size_t buffer_size, int use_mmap);
+
+// Read len bytes of caller-owned memory
+void lzw_reader_open_memory(LzwReader *reader, const void *data, size_t len);
+void lzw_reader_close(LzwReader *reader);
+
+// Move unread bytes to the front and refill. Returns the bytes now available.
+size_t lzw_reader_fill(LzwReader *reader);
+
+// Copy up to size bytes out of the reader. Returns the number copied.
+size_t lzw_reader_read(LzwReader *reader, void *data, size_t size);
+
+// Consume the next size bytes and return a pointer to them. They are used in
+// place when the buffer already holds them, otherwise copied into scratch,
+// which must have room for size bytes. Returns NULL if the input ends first.
+const unsigned char *lzw_reader_next(LzwReader *reader, size_t size, unsigned char *scratch);
+
+// Bytes consumed from the source so far
+static inline uint64_t lzw_reader_tell(const LzwReader *reader) {
+    return reader->offset + reader->pos;
+}
+
+int lzw_writer_open_file(LzwWriter *writer, FILE *file, size_t buffer_size);
+int lzw_writer_open_callback(LzwWriter *writer, LzwCallbackSink *sink, size_t buffer_size);
+
+// Collect output in a heap buffer that grows as needed. The bytes written
+// so far are buffer[0..len); set len to 0 to reuse the buffer.
+int lzw_writer_open_memory(LzwWriter *writer, size_t initial_size);
+void lzw_writer_close(LzwWriter *writer);
+
+// Grow an in-memory writer until size bytes fit after buffer + len, so a
+// caller can fill them directly and then advance len. Returns -1 and marks
+// the writer failed if the buffer cannot grow.
+int lzw_writer_reserve(LzwWriter *writer, size_t size);
+
+void lzw_writer_write(LzwWriter *writer, const void *data, size_t size);
+
+// Write count copies of the size-byte item, filling the buffer in place
+void lzw_writer_repeat(LzwWriter *writer, const void *item, size_t size, size_t count);
+
+// Bytes written so far, whether or not they have reached the sink
+static inline uint64_t lzw_writer_tell(const LzwWriter *writer) {
+    return writer->offset + writer->len;
+}
+
+// Open path for writing, "-" meaning stdout. Returns NULL on failure.
+FILE *lzw_open_output(const char *path);
+
+// Flush and close a file from lzw_open_output, leaving stdout open. Returns
+// -1 if any write failed, e.g. because a pipe closed.
+int lzw_close_output(FILE *file);
+
+// Where to report progress: stderr when the data itself goes to stdout
+FILE *lzw_message_stream(const char *output_path);
+
+static inline void lzw_writer_drain(LzwWriter *writer) {
+    if (writer->len > 0) {
+        writer->drain(writer);
+    }
+}
+
+#endif
@@ -0,0 +1,258 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "lzw_pipe.h"
+
+// Counters and flags are read and written with sequentially consistent
+// atomics. A sleeper raises sleepers before checking the ring once more, and
+// a side that has just moved its counter checks sleepers afterwards, so one
+// of the two always sees the other and no wake-up is lost.
+static unsigned load(const unsigned *p) {
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static int load_flag(const int *p) {
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+// Checks are short enough to retry a few times before sleeping
+#define RING_SPINS 64
+
+int lzw_ring_init(LzwRing *ring, unsigned slots, size_t slot_size) {
+    memset(ring, 0, sizeof(*ring));
+    ring->data = malloc(slots * slot_size);
+    ring->lengths = calloc(slots, sizeof(size_t));
+    if (ring->data == NULL || ring->lengths == NULL) {
+        free(ring->data);
+        free(ring->lengths);
+        return -1;
+    }
+    ring->slots = slots;
+    ring->slot_size = slot_size;
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->wake, NULL);
+    return 0;
+}
+
+void lzw_ring_free(LzwRing *ring) {
+    if (ring->data == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->wake);
+    free(ring->data);
+    free(ring->lengths);
+    ring->data = NULL;
+}
+
+static int can_acquire(LzwRing *ring) {
+    return load(&ring->head) - load(&ring->tail) < ring->slots || load_flag(&ring->cancelled);
+}
+
+static int can_peek(LzwRing *ring) {
+    return load(&ring->head) != load(&ring->tail) || load_flag(&ring->closed);
+}
+
+static void wait_until(LzwRing *ring, int (*ready)(LzwRing *ring)) {
+    for (int i = 0; i < RING_SPINS; i++) {
+        if (ready(ring)) {
+            return;
+        }
+    }
+    pthread_mutex_lock(&ring->lock);
+    __atomic_add_fetch(&ring->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (!ready(ring)) {
+        pthread_cond_wait(&ring->wake, &ring->lock);
+    }
+    __atomic_sub_fetch(&ring->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static void wake_other(LzwRing *ring) {
+    if (load_flag(&ring->sleepers) > 0) {
+        pthread_mutex_lock(&ring->lock);
+        pthread_cond_broadcast(&ring->wake);
+        pthread_mutex_unlock(&ring->lock);
+    }
+}
+
+unsigned char *lzw_ring_acquire(LzwRing *ring) {
+    wait_until(ring, can_acquire);
+    if (load_flag(&ring->cancelled)) {
+        return NULL;
+    }
+    return ring->data + (size_t)(ring->head % ring->slots) * ring->slot_size;
+}
+
+void lzw_ring_publish(LzwRing *ring, size_t len) {
+    ring->lengths[ring->head % ring->slots] = len;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_SEQ_CST);
+    wake_other(ring);
+}
+
+void lzw_ring_close(LzwRing *ring) {
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_SEQ_CST);
+    wake_other(ring);
+}
+
+const unsigned char *lzw_ring_peek(LzwRing *ring, size_t *len) {
+    wait_until(ring, can_peek);
+    if (load(&ring->head) == ring->tail) {
+        return NULL;
+    }
+    unsigned slot = ring->tail % ring->slots;
+    *len = ring->lengths[slot];
+    return ring->data + (size_t)slot * ring->slot_size;
+}
+
+void lzw_ring_release(LzwRing *ring) {
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_SEQ_CST);
+    wake_other(ring);
+}
+
+void lzw_ring_cancel(LzwRing *ring) {
+    __atomic_store_n(&ring->cancelled, 1, __ATOMIC_SEQ_CST);
+    wake_other(ring);
+}
+
+// Fill slots from the file until it ends or the consumer stops
+static void *read_main(void *arg) {
+    LzwReadStage *stage = arg;
+    FILE *file = stage->reader->source;
+    unsigned char *slot;
+    while ((slot = lzw_ring_acquire(&stage->ring)) != NULL) {
+        size_t n = fread(slot, 1, stage->ring.slot_size, file);
+        if (n > 0) {
+            lzw_ring_publish(&stage->ring, n);
+        }
+        if (n < stage->ring.slot_size) {
+            if (ferror(file)) {
+                __atomic_store_n(&stage->failed, 1, __ATOMIC_SEQ_CST);
+            }
+            break;
+        }
+    }
+    lzw_ring_close(&stage->ring);
+    return NULL;
+}
+
+int lzw_read_stage_start(LzwReadStage *stage, LzwReader *reader) {
+    memset(stage, 0, sizeof(*stage));
+    stage->reader = reader;
+    if (reader->eof) {
+        return 0;
+    }
+    if (lzw_ring_init(&stage->ring, LZW_STAGE_SLOTS, reader->capacity) != 0) {
+        return -1;
+    }
+    if (pthread_create(&stage->thread, NULL, read_main, stage) != 0) {
+        lzw_ring_free(&stage->ring);
+        return -1;
+    }
+    stage->threaded = 1;
+    return 0;
+}
+
+const unsigned char *lzw_read_stage_next(LzwReadStage *stage, size_t *len) {
+    if (!stage->threaded) {
+        LzwReader *reader = stage->reader;
+        if (stage->done || reader->len == reader->pos) {
+            return NULL;
+        }
+        stage->done = 1;
+        *len = reader->len - reader->pos;
+        return reader->buffer + reader->pos;
+    }
+    if (stage->holding) {
+        lzw_ring_release(&stage->ring);
+        stage->holding = 0;
+    }
+    const unsigned char *data = lzw_ring_peek(&stage->ring, len);
+    stage->holding = data != NULL;
+    return data;
+}
+
+int lzw_read_stage_finish(LzwReadStage *stage) {
+    if (stage->threaded) {
+        lzw_ring_cancel(&stage->ring);
+        pthread_join(stage->thread, NULL);
+        lzw_ring_free(&stage->ring);
+        stage->threaded = 0;
+        stage->done = 1;
+        if (stage->failed) {
+            stage->reader->failed = 1;
+        }
+    }
+    return stage->failed ? -1 : 0;
+}
+
+// Write slots out in order; after a failure, stop taking them
+static void *write_main(void *arg) {
+    LzwWriteStage *stage = arg;
+    const unsigned char *data;
+    size_t len;
+    while ((data = lzw_ring_peek(&stage->ring, &len)) != NULL) {
+        if (fwrite(data, 1, len, stage->file) != len) {
+            __atomic_store_n(&stage->failed, 1, __ATOMIC_SEQ_CST);
+            lzw_ring_cancel(&stage->ring);
+            break;
+        }
+        lzw_ring_release(&stage->ring);
+    }
+    return NULL;
+}
+
+int lzw_write_stage_start(LzwWriteStage *stage, FILE *file, size_t buffer_size) {
+    memset(stage, 0, sizeof(*stage));
+    stage->file = file;
+    if (buffer_size < LZW_IO_MIN_BUFFER_SIZE) {
+        buffer_size = LZW_IO_MIN_BUFFER_SIZE;
+    }
+    if (lzw_ring_init(&stage->ring, LZW_STAGE_SLOTS, buffer_size) != 0) {
+        return -1;
+    }
+    if (pthread_create(&stage->thread, NULL, write_main, stage) != 0) {
+        lzw_ring_free(&stage->ring);
+        return -1;
+    }
+    return 0;
+}
+
+int lzw_write_stage_write(void *context, const void *data, size_t len) {
+    LzwWriteStage *stage = context;
+    const unsigned char *bytes = data;
+    while (len > 0 && !load_flag(&stage->failed)) {
+        if (stage->slot == NULL) {
+            stage->slot = lzw_ring_acquire(&stage->ring);
+            stage->used = 0;
+            if (stage->slot == NULL) {
+                break;
+            }
+        }
+        size_t n = stage->ring.slot_size - stage->used;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(stage->slot + stage->used, bytes, n);
+        stage->used += n;
+        bytes += n;
+        len -= n;
+        if (stage->used == stage->ring.slot_size) {
+            lzw_ring_publish(&stage->ring, stage->used);
+            stage->slot = NULL;
+        }
+    }
+    return load_flag(&stage->failed) ? -1 : 0;
+}
+
+int lzw_write_stage_finish(LzwWriteStage *stage) {
+    if (stage->slot != NULL && stage->used > 0) {
+        lzw_ring_publish(&stage->ring, stage->used);
+    }
+    stage->slot = NULL;
+    lzw_ring_close(&stage->ring);
+    pthread_join(stage->thread, NULL);
+    lzw_ring_free(&stage->ring);
+    return stage->failed ? -1 : 0;
+}
@@ -0,0 +1,91 @@
+#ifndef LZW_PIPE_H
+#define LZW_PIPE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "lzw_io.h"
+
+// Bounded single-producer, single-consumer ring of buffers between two
+// threads. Each side owns one counter and publishes it with an atomic store,
+// so passing a slot takes no lock. A side only locks to sleep when the ring
+// is full or empty, and the other side only locks to wake it.
+typedef struct {
+    unsigned char *data;        // slots * slot_size bytes
+    size_t *lengths;            // bytes used in each slot
+    size_t slot_size;
+    unsigned slots;
+    unsigned head;              // slots published, written by the producer
+    unsigned tail;              // slots released, written by the consumer
+    int closed;                 // the producer has published its last slot
+    int cancelled;              // the consumer takes no more slots
+    int sleepers;               // sides waiting on wake
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} LzwRing;
+
+// Returns -1 if memory runs out
+int lzw_ring_init(LzwRing *ring, unsigned slots, size_t slot_size);
+void lzw_ring_free(LzwRing *ring);
+
+// Producer side: wait for an empty slot of slot_size bytes, NULL once the
+// consumer has cancelled; then publish len bytes of it. Close after the
+// last slot.
+unsigned char *lzw_ring_acquire(LzwRing *ring);
+void lzw_ring_publish(LzwRing *ring, size_t len);
+void lzw_ring_close(LzwRing *ring);
+
+// Consumer side: wait for the oldest published slot, NULL once the ring is
+// closed and empty; then release it for reuse. Cancel to stop early.
+const unsigned char *lzw_ring_peek(LzwRing *ring, size_t *len);
+void lzw_ring_release(LzwRing *ring);
+void lzw_ring_cancel(LzwRing *ring);
+
+#define LZW_STAGE_SLOTS 4
+
+// Input of the whole-file wrappers. A mapped or in-memory reader is handed
+// over as one piece; a file or pipe is read ahead on its own thread, so the
+// coder never waits for a read that could have been started earlier.
+typedef struct {
+    LzwReader *reader;
+    LzwRing ring;
+    pthread_t thread;
+    int threaded;
+    int holding;                // the consumer has a slot to release
+    int done;                   // an unthreaded reader has been handed over
+    int failed;                 // a read failed
+} LzwReadStage;
+
+// Returns -1 if the buffers or the thread cannot be set up
+int lzw_read_stage_start(LzwReadStage *stage, LzwReader *reader);
+
+// The next piece of input, NULL at the end. It stays valid until the next
+// call.
+const unsigned char *lzw_read_stage_next(LzwReadStage *stage, size_t *len);
+
+// Stop reading, even before the end. Returns -1 if a read failed.
+int lzw_read_stage_finish(LzwReadStage *stage);
+
+// Output of the whole-file wrappers: lzw_write_stage_write copies output
+// into buffers that a thread writes to file, so the coder runs on while a
+// write is in progress
+typedef struct {
+    FILE *file;
+    LzwRing ring;
+    pthread_t thread;
+    unsigned char *slot;        // being filled, or NULL
+    size_t used;
+    int failed;                 // a write failed, later output is dropped
+} LzwWriteStage;
+
+int lzw_write_stage_start(LzwWriteStage *stage, FILE *file, size_t buffer_size);
+
+// An LzwWriteFn taking the stage as context. Returns -1 once a write has
+// failed.
+int lzw_write_stage_write(void *stage, const void *data, size_t len);
+
+// Hand over what is left and wait for it to be written. Returns -1 if any
+// write failed.
+int lzw_write_stage_finish(LzwWriteStage *stage);
+
+#endif
@@ -0,0 +1,210 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "lzw_pool.h"
+
+// A worker's own queue holds the tasks it submitted itself, such as the
+// blocks of a file it is compressing. Other workers steal from it when they
+// run out of work.
+typedef struct {
+    LzwPool *pool;
+    int index;
+    LzwTask *head, *tail;
+} Worker;
+
+struct LzwPool {
+    int threads;
+    pthread_t *handles;
+    Worker *workers;
+    pthread_key_t self;             // the calling thread's Worker, NULL outside the pool
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;      // signalled when a task is queued or on shutdown
+    pthread_cond_t work_done;       // broadcast whenever a task finishes
+    LzwTask *head, *tail;           // FIFO of tasks submitted from outside the pool
+    int stopping;
+};
+
+static void push(LzwTask **head, LzwTask **tail, LzwTask *task) {
+    if (*tail != NULL) {
+        (*tail)->next = task;
+    } else {
+        *head = task;
+    }
+    *tail = task;
+}
+
+static LzwTask *pop(LzwTask **head, LzwTask **tail) {
+    LzwTask *task = *head;
+    if (task != NULL) {
+        *head = task->next;
+        if (*head == NULL) {
+            *tail = NULL;
+        }
+    }
+    return task;
+}
+
+// The oldest task from the worker's own queue, or else one stolen from the
+// other workers'. Called with the lock held.
+static LzwTask *take_queued(LzwPool *pool, Worker *worker) {
+    LzwTask *task = pop(&worker->head, &worker->tail);
+    for (int i = 1; task == NULL && i < pool->threads; i++) {
+        Worker *victim = &pool->workers[(worker->index + i) % pool->threads];
+        task = pop(&victim->head, &victim->tail);
+    }
+    return task;
+}
+
+// Run task on worker, dropping the lock meanwhile
+static void run_task(LzwPool *pool, Worker *worker, LzwTask *task) {
+    pthread_mutex_unlock(&pool->lock);
+    task->run(task->arg, worker->index);
+    pthread_mutex_lock(&pool->lock);
+    task->done = 1;
+    pthread_cond_broadcast(&pool->work_done);
+}
+
+static void *worker_main(void *arg) {
+    Worker *worker = arg;
+    LzwPool *pool = worker->pool;
+    pthread_setspecific(pool->self, worker);
+
+    // Work queued inside the pool comes first, so that files already
+    // started finish before new ones are taken on
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        LzwTask *task = take_queued(pool, worker);
+        if (task == NULL) {
+            task = pop(&pool->head, &pool->tail);
+        }
+        if (task != NULL) {
+            run_task(pool, worker, task);
+        } else if (pool->stopping) {
+            break;
+        } else {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+LzwPool *lzw_pool_create(int threads) {
+    LzwPool *pool = calloc(1, sizeof(LzwPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->threads = threads > 1 ? threads : 1;
+    if (threads <= 1) {
+        return pool;
+    }
+
+    pool->handles = malloc((size_t)threads * sizeof(pthread_t));
+    pool->workers = malloc((size_t)threads * sizeof(Worker));
+    if (pool->handles == NULL || pool->workers == NULL) {
+        free(pool->handles);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+    if (pthread_key_create(&pool->self, NULL) != 0) {
+        free(pool->handles);
+        free(pool->workers);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    // Every queue exists before the first worker may steal from it
+    for (int i = 0; i < threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        pool->workers[i].head = NULL;
+        pool->workers[i].tail = NULL;
+    }
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&pool->handles[i], NULL, worker_main, &pool->workers[i]) != 0) {
+            // Stop the workers already running
+            pool->threads = i;
+            lzw_pool_destroy(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void lzw_pool_destroy(LzwPool *pool) {
+    if (pool->handles != NULL) {
+        pthread_mutex_lock(&pool->lock);
+        pool->stopping = 1;
+        pthread_cond_broadcast(&pool->work_ready);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (int i = 0; i < pool->threads; i++) {
+            pthread_join(pool->handles[i], NULL);
+        }
+        pthread_key_delete(pool->self);
+        pthread_mutex_destroy(&pool->lock);
+        pthread_cond_destroy(&pool->work_ready);
+        pthread_cond_destroy(&pool->work_done);
+        free(pool->handles);
+        free(pool->workers);
+    }
+    free(pool);
+}
+
+int lzw_pool_threads(const LzwPool *pool) {
+    return pool->threads;
+}
+
+void lzw_pool_submit(LzwPool *pool, LzwTask *task, void (*run)(void *arg, int worker), void *arg) {
+    task->run = run;
+    task->arg = arg;
+    task->next = NULL;
+    task->done = 0;
+
+    if (pool->handles == NULL) {
+        run(arg, 0);
+        task->done = 1;
+        return;
+    }
+
+    Worker *worker = pthread_getspecific(pool->self);
+    pthread_mutex_lock(&pool->lock);
+    if (worker != NULL) {
+        push(&worker->head, &worker->tail, task);
+    } else {
+        push(&pool->head, &pool->tail, task);
+    }
+    pthread_cond_signal(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void lzw_pool_wait(LzwPool *pool, LzwTask *task) {
+    if (pool->handles == NULL) {
+        return;
+    }
+    // A worker waiting inside a task helps with queued tasks meanwhile. It
+    // never starts one submitted from outside, which could be another file
+    // wanting the state the waiting task holds.
+    Worker *worker = pthread_getspecific(pool->self);
+    pthread_mutex_lock(&pool->lock);
+    while (!task->done) {
+        LzwTask *other = worker != NULL ? take_queued(pool, worker) : NULL;
+        if (other != NULL) {
+            run_task(pool, worker, other);
+        } else {
+            pthread_cond_wait(&pool->work_done, &pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int lzw_cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
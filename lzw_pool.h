@@ -0,0 +1,46 @@
+#ifndef LZW_POOL_H
+#define LZW_POOL_H
+
+// Fixed-size work-stealing thread pool. Tasks are owned by the caller; each
+// runs on one worker, identified by an index in [0, threads) so callers can
+// keep per-worker state such as dictionaries.
+//
+// Tasks submitted from outside the pool run in submission order. A task
+// may itself submit tasks, e.g. a file submitting its blocks: those go to
+// the worker's own queue, and idle workers steal from it. A worker waiting
+// for such a task runs queued ones in the meantime, so tasks that wait
+// never leave a thread idle. Tasks from outside are started only by idle
+// workers, and only once no queued task is left.
+
+typedef struct LzwPool LzwPool;
+
+typedef struct LzwTask LzwTask;
+struct LzwTask {
+    void (*run)(void *arg, int worker);
+    void *arg;
+
+    // Owned by the pool
+    int done;
+    LzwTask *next;
+};
+
+// Start a pool of threads workers. With threads <= 1 no threads are started
+// and tasks run inline on the submitting thread as worker 0. Returns NULL if
+// memory or threads run out.
+LzwPool *lzw_pool_create(int threads);
+
+// Wait for all submitted tasks, then stop the workers
+void lzw_pool_destroy(LzwPool *pool);
+
+int lzw_pool_threads(const LzwPool *pool);
+
+void lzw_pool_submit(LzwPool *pool, LzwTask *task, void (*run)(void *arg, int worker), void *arg);
+
+// Block until task has finished running, helping with queued tasks when
+// called from a worker
+void lzw_pool_wait(LzwPool *pool, LzwTask *task);
+
+// Number of online processors, at least 1
+int lzw_cpu_count(void);
+
+#endif
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include "lzw_report.h"
+
+static double ratio(uint64_t part, uint64_t whole) {
+    return whole > 0 ? (double)part / (double)whole : 0;
+}
+
+static void report_text(FILE *out, const LzwStats *s, uint64_t compressed_bytes) {
+    if (!s->enabled) {
+        fprintf(out, "Statistics are not available: the library was built with LZW_NO_STATS.\n");
+        return;
+    }
+    uint64_t phrases = s->codes - s->runs;
+    fprintf(out, "Blocks: %llu\n", (unsigned long long)s->blocks);
+    fprintf(out, "Codes: %llu, %.3f bytes per code\n", (unsigned long long)s->codes,
+            ratio(compressed_bytes, s->codes));
+    fprintf(out, "Average phrase length: %.2f symbols\n", ratio(s->symbols - s->run_symbols, phrases));
+    fprintf(out, "Runs: %llu covering %llu symbols\n", (unsigned long long)s->runs,
+            (unsigned long long)s->run_symbols);
+    if (s->hits + s->misses > 0) {
+        fprintf(out, "Dictionary lookups: %llu, %llu hits, %llu misses, %.1f%% hit rate\n",
+                (unsigned long long)(s->hits + s->misses), (unsigned long long)s->hits,
+                (unsigned long long)s->misses, 100 * ratio(s->hits, s->hits + s->misses));
+    }
+    fprintf(out, "Dictionary filled: in %llu of %llu blocks, after %.0f symbols on average\n",
+            (unsigned long long)s->filled_blocks, (unsigned long long)s->blocks,
+            ratio(s->fill_symbols, s->filled_blocks));
+    fprintf(out, "CLEAR codes: %llu\n", (unsigned long long)s->clears);
+    fprintf(out, "Dictionary growth: %llu LZW, %llu LZMW, %llu LZAP blocks\n",
+            (unsigned long long)(s->blocks - s->lzmw_blocks - s->lzap_blocks), (unsigned long long)s->lzmw_blocks,
+            (unsigned long long)s->lzap_blocks);
+    fprintf(out, "Huffman-coded: %llu of %llu blocks\n", (unsigned long long)s->huffman_blocks,
+            (unsigned long long)s->blocks);
+    fprintf(out, "Time coding: %.3f s over all threads, in I/O: %.3f s\n", s->coding_seconds, s->io_seconds);
+}
+
+static void report_json(FILE *out, const char *operation, uint64_t original_bytes, uint64_t compressed_bytes,
+                        const LzwStats *s) {
+    fprintf(out, "{\"operation\": \"%s\", \"original_bytes\": %llu, \"compressed_bytes\": %llu, "
+            "\"ratio\": %.4f, ", operation, (unsigned long long)original_bytes,
+            (unsigned long long)compressed_bytes, ratio(compressed_bytes, original_bytes));
+    if (!s->enabled) {
+        fprintf(out, "\"stats\": null}\n");
+        return;
+    }
+    fprintf(out, "\"stats\": {\"blocks\": %llu, \"symbols\": %llu, \"codes\": %llu, \"bytes_per_code\": %.4f, "
+            "\"average_phrase_length\": %.4f, \"runs\": %llu, \"run_symbols\": %llu, \"lookups\": %llu, "
+            "\"hits\": %llu, \"misses\": %llu, \"clears\": %llu, \"filled_blocks\": %llu, "
+            "\"average_fill_symbols\": %.1f, \"lzmw_blocks\": %llu, \"lzap_blocks\": %llu, \"huffman_blocks\": %llu, \"coding_seconds\": %.6f, \"io_seconds\": %.6f}}\n",
+            (unsigned long long)s->blocks, (unsigned long long)s->symbols, (unsigned long long)s->codes,
+            ratio(compressed_bytes, s->codes), ratio(s->symbols - s->run_symbols, s->codes - s->runs),
+            (unsigned long long)s->runs, (unsigned long long)s->run_symbols,
+            (unsigned long long)(s->hits + s->misses), (unsigned long long)s->hits,
+            (unsigned long long)s->misses, (unsigned long long)s->clears, (unsigned long long)s->filled_blocks,
+            ratio(s->fill_symbols, s->filled_blocks), (unsigned long long)s->lzmw_blocks,
+            (unsigned long long)s->lzap_blocks, (unsigned long long)s->huffman_blocks, s->coding_seconds,
+            s->io_seconds);
+}
+
+void lzw_report(FILE *out, const char *operation, uint64_t original_bytes, uint64_t compressed_bytes,
+                const LzwTotals *totals, const LzwReportOptions *options) {
+    if (options->json) {
+        report_json(out, operation, original_bytes, compressed_bytes, &totals->stats);
+        return;
+    }
+    fprintf(out, "Original file size: %llu bytes\n", (unsigned long long)original_bytes);
+    fprintf(out, "Compressed file size: %llu bytes\n", (unsigned long long)compressed_bytes);
+    if (original_bytes > 0) {
+        fprintf(out, "Compression ratio: %.2f%%\n", (1 - ratio(compressed_bytes, original_bytes)) * 100);
+    }
+    if (options->stats) {
+        report_text(out, &totals->stats, compressed_bytes);
+    }
+}
+
+LzwDictionary *lzw_report_load_dictionary(const char *path) {
+    LzwDictionary *dictionary;
+    int status = lzw_dictionary_load(&dictionary, path);
+    if (status == LZW_ERR_FORMAT) {
+        fprintf(stderr, "Error: %s is not an LZW dictionary.\n", path);
+    } else if (status != LZW_OK) {
+        fprintf(stderr, "Error: Cannot load dictionary %s: %s.\n", path, lzw_strerror(status));
+    }
+    return status == LZW_OK ? dictionary : NULL;
+}
@@ -0,0 +1,24 @@
+#ifndef LZW_REPORT_H
+#define LZW_REPORT_H
+
+#include <stdio.h>
+#include "lzw.h"
+
+// Summary the command-line tools print once a run has finished: the file
+// sizes and, on request, the coding counters, as text or as one JSON
+// object. original_bytes and compressed_bytes are the two sides of totals,
+// which way round depending on the operation.
+
+typedef struct {
+    int stats;                  // add the coding counters to the text report
+    int json;                   // print one JSON object, counters included, instead
+} LzwReportOptions;
+
+void lzw_report(FILE *out, const char *operation, uint64_t original_bytes, uint64_t compressed_bytes,
+                const LzwTotals *totals, const LzwReportOptions *options);
+
+// Load the dictionary a -D option names, printing why it cannot be used.
+// Returns NULL on failure.
+LzwDictionary *lzw_report_load_dictionary(const char *path);
+
+#endif
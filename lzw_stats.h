@@ -0,0 +1,47 @@
+#ifndef LZW_STATS_H
+#define LZW_STATS_H
+
+#include <time.h>
+#include "lzw.h"
+
+// LZW_COUNT wraps every update of an LzwStats in the coding loops, so that
+// -DLZW_NO_STATS compiles them out. Callers need _POSIX_C_SOURCE for the
+// clock.
+#ifdef LZW_NO_STATS
+#define LZW_STATS_ENABLED 0
+#define LZW_COUNT(update) ((void)0)
+#else
+#define LZW_STATS_ENABLED 1
+#define LZW_COUNT(update) ((void)(update))
+#endif
+
+// Monotonic time in seconds, or always 0 without stats
+static inline double lzw_stats_clock(void) {
+#ifdef LZW_NO_STATS
+    return 0;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+#endif
+}
+
+static inline void lzw_stats_add(LzwStats *total, const LzwStats *part) {
+    total->blocks += part->blocks;
+    total->symbols += part->symbols;
+    total->codes += part->codes;
+    total->runs += part->runs;
+    total->run_symbols += part->run_symbols;
+    total->hits += part->hits;
+    total->misses += part->misses;
+    total->clears += part->clears;
+    total->filled_blocks += part->filled_blocks;
+    total->fill_symbols += part->fill_symbols;
+    total->lzmw_blocks += part->lzmw_blocks;
+    total->lzap_blocks += part->lzap_blocks;
+    total->huffman_blocks += part->huffman_blocks;
+    total->coding_seconds += part->coding_seconds;
+    total->io_seconds += part->io_seconds;
+}
+
+#endif
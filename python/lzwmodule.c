@@ -0,0 +1,340 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lzw.h"
+
+// CPython binding over the library API. Input is read through the buffer
+// protocol, so bytes, memoryviews and C-contiguous NumPy arrays are coded
+// where they lie, and decompress can fill a caller's array in place. The
+// GIL is released while coding.
+
+static PyObject *LzwError;
+
+// Where the coders write: a heap buffer that grows, or a fixed buffer that
+// belongs to someone else
+typedef struct {
+    unsigned char *data;
+    size_t len;
+    size_t capacity;
+    int fixed;
+    int overflow;           // a fixed buffer was too small
+} Sink;
+
+static int sink_write(void *context, const void *data, size_t len) {
+    Sink *sink = context;
+    if (sink->capacity - sink->len < len) {
+        if (sink->fixed) {
+            sink->overflow = 1;
+            return -1;
+        }
+        size_t capacity = sink->capacity > 0 ? sink->capacity : 65536;
+        while (capacity - sink->len < len) {
+            capacity *= 2;
+        }
+        unsigned char *grown = realloc(sink->data, capacity);
+        if (grown == NULL) {
+            return -1;
+        }
+        sink->data = grown;
+        sink->capacity = capacity;
+    }
+    memcpy(sink->data + sink->len, data, len);
+    sink->len += len;
+    return 0;
+}
+
+// Raise a failed status: MemoryError, ValueError for bad parameters, and
+// lzw.error for the rest
+static PyObject *raise_status(int status, const char *message) {
+    if (status == LZW_ERR_MEMORY) {
+        return PyErr_NoMemory();
+    }
+    PyErr_SetString(status == LZW_ERR_PARAM ? PyExc_ValueError : LzwError,
+                    message[0] != '\0' ? message : lzw_strerror(status));
+    return NULL;
+}
+
+// Load the dictionary keyword if there is one. Returns -1 with an exception
+// set if it cannot be used.
+static int load_dictionary(const char *path, LzwDictionary **dictionary) {
+    *dictionary = NULL;
+    if (path == NULL) {
+        return 0;
+    }
+    int status;
+    Py_BEGIN_ALLOW_THREADS
+    status = lzw_dictionary_load(dictionary, path);
+    Py_END_ALLOW_THREADS
+    if (status == LZW_ERR_FORMAT) {
+        PyErr_Format(LzwError, "%s is not an LZW dictionary", path);
+        return -1;
+    }
+    if (status != LZW_OK) {
+        PyErr_Format(LzwError, "Cannot load dictionary %s: %s", path, lzw_strerror(status));
+        return -1;
+    }
+    return 0;
+}
+
+// Parse a growth keyword into LZW_GROWTH_*, -2 if it is unknown
+static int parse_growth(const char *rule) {
+    static const char *const names[] = {"lzw", "lzmw", "lzap"};
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(rule, names[i]) == 0) {
+            return i;
+        }
+    }
+    return strcmp(rule, "auto") == 0 ? LZW_GROWTH_AUTO : -2;
+}
+
+PyDoc_STRVAR(compress_doc,
+"compress(data, *, level=0, symbol_bits=8, max_code_bits=0, block_size=0,\n"
+"         threads=1, growth=None, dictionary=None) -> bytes\n"
+"\n"
+"Compress any C-contiguous buffer to an LZW container, the same format\n"
+"imageCompression writes. level trades speed for size as imageCompression -l\n"
+"does; symbol_bits=16 codes u16 elements as single symbols. max_code_bits\n"
+"and block_size (in bytes) of 0 take the library defaults, and threads=0\n"
+"uses every processor. growth is 'lzw', 'lzmw', 'lzap' or 'auto', and\n"
+"dictionary the path of an lzwTrain dictionary.");
+
+static PyObject *lzw_py_compress(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"data", "level", "symbol_bits", "max_code_bits", "block_size",
+                               "threads", "growth", "dictionary", NULL};
+    PyObject *data;
+    int level = 0, symbol_bits = 8, max_code_bits = 0, threads = 1;
+    Py_ssize_t block_size = 0;
+    const char *growth = NULL, *dictionary_file = NULL;
+    (void)self;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$iiinizz:compress", keywords, &data, &level, &symbol_bits,
+                                     &max_code_bits, &block_size, &threads, &growth, &dictionary_file)) {
+        return NULL;
+    }
+    if (level < 0 || level > 2) {
+        return PyErr_Format(PyExc_ValueError, "Invalid level: %d (must be 0-2)", level);
+    }
+    if (block_size < 0) {
+        return PyErr_Format(PyExc_ValueError, "Invalid block size: %zd bytes", block_size);
+    }
+
+    LzwParams params;
+    lzw_params_init(&params);
+    params.symbol_bits = symbol_bits;
+    if (max_code_bits > 0) {
+        params.max_code_bits = max_code_bits;
+    } else if (symbol_bits == 16) {
+        params.max_code_bits = LZW_DEFAULT_CODE_BITS_16;
+    }
+    if (block_size > 0) {
+        params.block_size = (size_t)block_size;
+    }
+    params.threads = threads;
+    if (level >= 1) {
+        params.entropy = LZW_ENTROPY_HUFFMAN;
+    }
+    if (growth != NULL) {
+        params.growth = parse_growth(growth);
+        if (params.growth == -2) {
+            return PyErr_Format(PyExc_ValueError, "Invalid growth rule: %s", growth);
+        }
+    } else if (level >= 2) {
+        params.growth = LZW_GROWTH_AUTO;
+    }
+
+    Py_buffer view;
+    if (PyObject_GetBuffer(data, &view, PyBUF_C_CONTIGUOUS) != 0) {
+        return NULL;
+    }
+    LzwDictionary *dictionary;
+    if (load_dictionary(dictionary_file, &dictionary) != 0) {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    params.dictionary = dictionary;
+
+    Sink sink = {NULL, 0, 0, 0, 0};
+    char message[LZW_MESSAGE_SIZE] = "";
+    int status;
+    Py_BEGIN_ALLOW_THREADS
+    LzwEncoder *enc = NULL;
+    sink.capacity = (size_t)view.len / 2 + 4096;
+    sink.data = malloc(sink.capacity);
+    status = sink.data != NULL ? lzw_encoder_create(&enc, &params, sink_write, &sink) : LZW_ERR_MEMORY;
+    if (status == LZW_OK) {
+        status = lzw_encoder_encode(enc, view.buf, (size_t)view.len);
+    }
+    if (status == LZW_OK) {
+        status = lzw_encoder_flush(enc);
+    }
+    if (enc != NULL) {
+        snprintf(message, sizeof(message), "%s", lzw_encoder_message(enc));
+    }
+    lzw_encoder_destroy(enc);
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&view);
+    lzw_dictionary_free(dictionary);
+
+    PyObject *result = status == LZW_OK ? PyBytes_FromStringAndSize((const char *)sink.data, (Py_ssize_t)sink.len)
+                                        : raise_status(status, message);
+    free(sink.data);
+    return result;
+}
+
+PyDoc_STRVAR(decompress_doc,
+"decompress(data, out=None, *, threads=1, dictionary=None) -> bytes or out\n"
+"\n"
+"Decompress an LZW container from any buffer. With out, a writable\n"
+"C-contiguous buffer such as numpy.empty(shape, dtype), the data is decoded\n"
+"straight into it and must fill it exactly; out is returned. Otherwise a new\n"
+"bytes object is returned. dictionary is the path of the lzwTrain dictionary\n"
+"the data was compressed with, if any.");
+
+static PyObject *lzw_py_decompress(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *keywords[] = {"data", "out", "threads", "dictionary", NULL};
+    PyObject *data, *out = Py_None;
+    int threads = 1;
+    const char *dictionary_file = NULL;
+    (void)self;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O$iz:decompress", keywords, &data, &out, &threads,
+                                     &dictionary_file)) {
+        return NULL;
+    }
+
+    Py_buffer in, target;
+    if (PyObject_GetBuffer(data, &in, PyBUF_C_CONTIGUOUS) != 0) {
+        return NULL;
+    }
+    uint64_t size;
+    int known = lzw_decoded_size(in.buf, (size_t)in.len, &size) == LZW_OK;
+    if (known && size > PY_SSIZE_T_MAX) {
+        PyBuffer_Release(&in);
+        return PyErr_NoMemory();
+    }
+
+    // Decode into out, into a bytes object of the size the index gives, or
+    // failing both into a heap buffer copied out at the end
+    PyObject *result = NULL;
+    Sink sink = {NULL, 0, 0, 1, 0};
+    if (out != Py_None) {
+        if (PyObject_GetBuffer(out, &target, PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE) != 0) {
+            PyBuffer_Release(&in);
+            return NULL;
+        }
+        if (known && size != (uint64_t)target.len) {
+            PyErr_Format(PyExc_ValueError, "out holds %zd bytes, but the data decodes to %llu", target.len,
+                         (unsigned long long)size);
+            PyBuffer_Release(&target);
+            PyBuffer_Release(&in);
+            return NULL;
+        }
+        sink.data = target.buf;
+        sink.capacity = (size_t)target.len;
+    } else if (known) {
+        result = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)size);
+        if (result == NULL) {
+            PyBuffer_Release(&in);
+            return NULL;
+        }
+        sink.data = (unsigned char *)PyBytes_AS_STRING(result);
+        sink.capacity = (size_t)size;
+    } else {
+        sink.fixed = 0;
+    }
+
+    LzwDictionary *dictionary;
+    int status = LZW_OK;
+    char message[LZW_MESSAGE_SIZE] = "";
+    if (load_dictionary(dictionary_file, &dictionary) != 0) {
+        status = LZW_ERR_IO;
+    } else {
+        LzwParams params;
+        lzw_params_init(&params);
+        params.threads = threads;
+        params.dictionary = dictionary;
+        Py_BEGIN_ALLOW_THREADS
+        LzwDecoder *dec = NULL;
+        status = lzw_decoder_create(&dec, &params, sink_write, &sink);
+        if (status == LZW_OK) {
+            status = lzw_decoder_decode(dec, in.buf, (size_t)in.len);
+        }
+        if (status == LZW_OK) {
+            status = lzw_decoder_finish(dec);
+        }
+        if (dec != NULL) {
+            snprintf(message, sizeof(message), "%s", lzw_decoder_message(dec));
+        }
+        lzw_decoder_destroy(dec);
+        Py_END_ALLOW_THREADS
+        lzw_dictionary_free(dictionary);
+        if (status != LZW_OK && sink.overflow && out != Py_None) {
+            PyErr_Format(PyExc_ValueError, "The data decodes to more than the %zu bytes of out", sink.capacity);
+        } else if (status != LZW_OK && sink.overflow) {
+            PyErr_Format(LzwError, "The data decodes to more than the %zu bytes its index records", sink.capacity);
+        } else if (status == LZW_OK && sink.fixed && sink.len != sink.capacity) {
+            if (out != Py_None) {
+                PyErr_Format(PyExc_ValueError, "The data decodes to %zu bytes, not the %zu of out", sink.len,
+                             sink.capacity);
+            } else {
+                PyErr_Format(LzwError, "The data decodes to %zu bytes, not the %zu its index records", sink.len,
+                             sink.capacity);
+            }
+            status = LZW_ERR_CORRUPT;
+        } else if (status != LZW_OK) {
+            raise_status(status, message);
+        }
+    }
+    PyBuffer_Release(&in);
+
+    if (out != Py_None) {
+        PyBuffer_Release(&target);
+        result = out;
+        Py_INCREF(result);
+    } else if (!sink.fixed) {
+        result = status == LZW_OK ? PyBytes_FromStringAndSize((const char *)sink.data, (Py_ssize_t)sink.len) : NULL;
+        free(sink.data);
+    }
+    if (status != LZW_OK) {
+        Py_CLEAR(result);
+    }
+    return result;
+}
+
+static PyMethodDef lzw_methods[] = {
+    {"compress", (PyCFunction)(void (*)(void))lzw_py_compress, METH_VARARGS | METH_KEYWORDS, compress_doc},
+    {"decompress", (PyCFunction)(void (*)(void))lzw_py_decompress, METH_VARARGS | METH_KEYWORDS, decompress_doc},
+    {NULL, NULL, 0, NULL},
+};
+
+PyDoc_STRVAR(module_doc,
+"LZW compression of raster arrays, in the container format of imageCompression.\n"
+"\n"
+"    packed = lzw.compress(array, symbol_bits=16, level=1)\n"
+"    restored = numpy.empty_like(array)\n"
+"    lzw.decompress(packed, out=restored)\n"
+"\n"
+"The container holds the bytes only; keep the shape and dtype alongside it.");
+
+static struct PyModuleDef lzw_module = {
+    PyModuleDef_HEAD_INIT, "lzw", module_doc, -1, lzw_methods, NULL, NULL, NULL, NULL,
+};
+
+PyMODINIT_FUNC PyInit_lzw(void) {
+    PyObject *module = PyModule_Create(&lzw_module);
+    if (module == NULL) {
+        return NULL;
+    }
+    LzwError = PyErr_NewException("lzw.error", NULL, NULL);
+    if (LzwError == NULL || PyModule_AddObject(module, "error", LzwError) != 0) {
+        Py_XDECREF(LzwError);
+        Py_DECREF(module);
+        return NULL;
+    }
+    Py_INCREF(LzwError);
+    if (PyModule_AddIntConstant(module, "FORMAT_VERSION", LZW_FORMAT_VERSION) != 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
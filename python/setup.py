@@ -0,0 +1,27 @@
+import os
+import re
+
+from setuptools import Extension, setup
+
+# The extension compiles the library in the directory above straight in,
+# taking the list of its sources from the makefile so the two never drift
+HERE = os.path.dirname(os.path.abspath(__file__))
+ROOT = os.path.dirname(HERE)
+
+with open(os.path.join(ROOT, "makefile")) as makefile:
+    library = re.search(r"^SRC_LIB = (.*)$", makefile.read(), re.MULTILINE).group(1).split()
+
+setup(
+    name="lzw",
+    version="1.0",
+    description="LZW compression of raster arrays through the buffer protocol",
+    ext_modules=[
+        Extension(
+            "lzw",
+            sources=[os.path.join(HERE, "lzwmodule.c")] + [os.path.join(ROOT, source) for source in library],
+            include_dirs=[ROOT],
+            extra_compile_args=["-std=c99", "-pthread"],
+            extra_link_args=["-pthread"],
+        )
+    ],
+)